@@ -1,50 +1,480 @@
 #include "tecnicofs-client-api.h"
+#include "tecnicofs-inprocess.h"
+
+static int sockfd;
+static socklen_t server_len, client_len;
+static struct sockaddr_un server_addr, client_addr;
+
+/*
+ * Shared memory requested with tfsSetSharedMemory (TFS_SHM_* flags): a
+ * session, if the server accepted it, whose rings carry requests and
+ * responses instead of the socket, and the namespace published by the
+ * server, if it publishes it, where lookups are resolved locally.
+ */
+static int use_shm;
+static TfsShmSession * shm;
+static int shm_connfd;
+static TfsNamespace * ns;
+
+/*
+ * Mounted on TFS_INPROCESS_TARGET: requests are executed by the file
+ * system engine linked into the client (tecnicofs-inprocess.h), as they are submitted, and their
+ * ids are queued until receive_response completes them, so callbacks and
+ * futures behave as with a server.
+ */
+static int inprocess;
+static uint32_t completed[TFS_MAX_WINDOW];
+static unsigned completed_head, completed_tail; /* running counts */
+
+/*
+ * Requests sent and not yet completed, in slot request_id % TFS_MAX_WINDOW.
+ * At most window of them are waiting for a response. Requests without a
+ * callback (futures) keep their result until tfsResult claims it; the
+ * callback of the others is called, and their slot freed, when their
+ * response arrives.
+ */
+#define PENDING_FREE 0
+#define PENDING_SENT 1
+#define PENDING_DONE 2
+
+typedef struct pendingRequest {
+  uint32_t request_id;
+  int state;
+  int result;
+  tfsCallback callback;
+  void * ctx;
+  int * results; /* where to store the results of a batch */
+  int atomic; /* the batch is a transaction */
+  TfsStats * stats; /* where to store the statistics of the server */
+} PendingRequest;
+
+static PendingRequest pending[TFS_MAX_WINDOW];
+static int window = TFS_MAX_WINDOW, in_flight;
+
+/* id of the last request sent (ids are positive ints, to be returned as handles) */
+static uint32_t last_request_id;
+
+/**
+ * Gets the result of a transaction from the results of its operations
+ * Returns:
+ *  - SUCCESS if committed, or the error of the operation that failed
+ */
+static int transaction_result(int * results, int num){
+  for(int i = 0; i < num; i++)
+    if(results[i] < 0)
+      return results[i];
+  return SUCCESS;
+}
 
 /**
- * Send message to server
+ * Completes a request with its result: calls its callback and frees its
+ * slot, or keeps the result for tfsResult.
+ */
+static void complete_request(PendingRequest * slot, int result){
+  if(slot->results && result >= 0 && slot->atomic)
+    result = transaction_result(slot->results, result);
+
+  in_flight--;
+  if(slot->callback){
+    /* free the slot first, the callback may send new requests */
+    slot->state = PENDING_FREE;
+    slot->callback(result, slot->ctx);
+  }
+  else{
+    slot->state = PENDING_DONE;
+    slot->result = result;
+  }
+}
+
+/**
+ * Completes the oldest request executed in-process.
+ * Returns:
+ *  - 1 if a request was completed, 0 if none was left
+ */
+static int receive_inprocess(){
+  PendingRequest * slot;
+
+  if(completed_head == completed_tail)
+    return 0;
+  slot = &pending[completed[completed_head++ % TFS_MAX_WINDOW] % TFS_MAX_WINDOW];
+  complete_request(slot, slot->result);
+  return 1;
+}
+
+/**
+ * Executes a request in-process and queues its completion.
  * Input:
- *  - sbuffer: buffer with the message
+ *  - request_id: id of the request, whose slot is already filled
+ *  - ops: operation, or operations of a batch
+ *  - num: number of operations (0 if it isn't a batch)
+ *  - flags: flags of the batch
  */
-void send_message(char * sbuffer){
-  if(sendto(sockfd, sbuffer, strlen(sbuffer), 0, (struct sockaddr *)&server_addr, server_len) < 0){
-    fprintf(stderr, "tecnicofs-client: error sending message to the server\n");
-    exit(EXIT_FAILURE);
+static void execute_inprocess(uint32_t request_id, TfsRequest * ops, int num, uint8_t flags){
+  PendingRequest * slot = &pending[request_id % TFS_MAX_WINDOW];
+
+  if(num == 0)
+    slot->result = tfs_inprocess_apply(ops);
+  else{
+    tfs_inprocess_apply_batch(ops, num, flags, slot->results);
+    slot->result = num;
   }
+  completed[completed_tail++ % TFS_MAX_WINDOW] = request_id;
 }
 
 /**
- * Receive message from server and gets result value form performed operation
+ * Receives one response from the server and completes its request.
+ * Responses to unknown requests are discarded.
+ * Input:
+ *  - flags: MSG_DONTWAIT to return if no response was received, or 0
  * Returns:
- *  - value of the operation (FAIL or SUCCESS)
+ *  - 1 if a response was received, 0 otherwise
  */
-int receive_message(){
-  char rbuffer[MAX_INPUT_SIZE];
-  int nread, result = FAIL;
-  if((nread = recvfrom(sockfd, rbuffer, MAX_INPUT_SIZE, 0, 0, 0)) < 0){
+static int receive_response(int flags){
+  char rbuffer[TFS_MAX_RESPONSE_SIZE];
+  uint32_t response_id;
+  int nread, result;
+
+  if(inprocess)
+    return receive_inprocess();
+  if(shm){
+    if((nread = tfs_shm_read(&shm->responses, rbuffer, sizeof(rbuffer), flags & MSG_DONTWAIT ? 0 : -1)) == 0)
+      return 0;
+    if(nread == FAIL){
+      fprintf(stderr, "tecnicofs-client: error receiving message from the server\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  else if((nread = recv(sockfd, rbuffer, sizeof(rbuffer), flags)) < 0){
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return 0;
     fprintf(stderr, "tecnicofs-client: error receiving message from the server\n");
     exit(EXIT_FAILURE);
   }
-  rbuffer[nread] = '\0';
-  sscanf(rbuffer, "%d", &result);
-  return result;
+  if(tfs_decode_response(rbuffer, nread, &response_id, &result) == FAIL)
+    return 1;
+
+  PendingRequest * slot = &pending[response_id % TFS_MAX_WINDOW];
+  if(slot->state != PENDING_SENT || slot->request_id != response_id)
+    return 1;
+
+  if(slot->results && result >= 0 &&
+      tfs_decode_batch_response(rbuffer, nread, slot->results, result) == FAIL)
+    result = TECNICOFS_ERROR_CONNECTION_ERROR;
+  if(slot->stats && result >= 0 && tfs_decode_stats_response(rbuffer, nread, slot->stats) == FAIL)
+    result = TECNICOFS_ERROR_CONNECTION_ERROR;
+  complete_request(slot, result);
+  return 1;
+}
+
+/**
+ * Sends a datagram to the server. While the server queue is full, keeps
+ * receiving responses, so that the server never blocks on a full client
+ * queue while the client blocks on a full server queue.
+ */
+static void send_datagram(char * sbuffer, int size){
+  if(shm){
+    /* the server consumes a request before writing its (smaller) response,
+     * so waiting for room can't deadlock once the responses are drained */
+    while(tfs_shm_write(&shm->requests, sbuffer, size, 0) == FAIL)
+      if(!receive_response(MSG_DONTWAIT) && tfs_shm_write(&shm->requests, sbuffer, size, -1) == SUCCESS)
+        break;
+    return;
+  }
+
+  while(send(sockfd, sbuffer, size, MSG_DONTWAIT) < 0){
+    if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+      fprintf(stderr, "tecnicofs-client: error sending message to the server\n");
+      exit(EXIT_FAILURE);
+    }
+    struct pollfd pfd = { .fd = sockfd, .events = POLLIN | POLLOUT };
+    if(poll(&pfd, 1, -1) > 0 && (pfd.revents & POLLIN))
+      receive_response(MSG_DONTWAIT);
+  }
+}
+
+/**
+ * Chooses what the next mount asks the server for: a shared-memory session
+ * (TFS_SHM_SESSION), used instead of the socket, and the namespace the
+ * server publishes (TFS_SHM_NAMESPACE), where lookups are resolved
+ * without requests. Without them, the socket and requests are used.
+ * Input:
+ *  - flags: TFS_SHM_* flags, or 0
+ * Returns:
+ *  - SUCCESS or FAIL (invalid flags)
+ */
+int tfsSetSharedMemory(int flags){
+  if(flags & ~(TFS_SHM_SESSION | TFS_SHM_NAMESPACE))
+    return FAIL;
+  use_shm = flags;
+  return SUCCESS;
+}
+
+/**
+ * Sets the maximum number of requests waiting for a response
+ * Input:
+ *  - size: window size, between 1 and TFS_MAX_WINDOW
+ * Returns:
+ *  - SUCCESS or FAIL
+ */
+int tfsSetWindow(int size){
+  if(size < 1 || size > TFS_MAX_WINDOW)
+    return FAIL;
+  window = size;
+  return SUCCESS;
+}
+
+/**
+ * Gets the id of a new request (ids are positive ints, to be returned as
+ * handles)
+ */
+static uint32_t next_request_id(){
+  last_request_id = (last_request_id + 1) & 0x7fffffff;
+  if(last_request_id == 0)
+    last_request_id = 1;
+  return last_request_id;
+}
+
+/**
+ * Takes the slot of a request about to be sent. Waits for responses
+ * (calling their callbacks) while the window is full.
+ * Input:
+ *  - request_id: id of the request
+ *  - results: where to store the results of a batch, or NULL
+ *  - atomic: the batch is a transaction
+ *  - callback: function called with the result, or NULL to claim the
+ *    result with tfsResult
+ *  - ctx: argument of the callback
+ * Returns:
+ *  - SUCCESS or TECNICOFS_ERROR_* code
+ */
+static int claim_slot(uint32_t request_id, int * results, int atomic, tfsCallback callback, void * ctx){
+  PendingRequest * slot = &pending[request_id % TFS_MAX_WINDOW];
+
+  while(in_flight >= window || slot->state == PENDING_SENT)
+    receive_response(0);
+
+  /* the slot still holds a result nobody claimed */
+  if(slot->state == PENDING_DONE)
+    return TECNICOFS_ERROR_OTHER;
+
+  slot->request_id = request_id;
+  slot->state = PENDING_SENT;
+  slot->callback = callback;
+  slot->ctx = ctx;
+  slot->results = results;
+  slot->atomic = atomic;
+  slot->stats = NULL;
+  in_flight++;
+  return SUCCESS;
+}
+
+/**
+ * Sends an encoded request without waiting for its response
+ * Input:
+ *  - request_id: id of the request
+ *  - sbuffer: encoded request
+ *  - size: size of the encoded request
+ *  - results, atomic, callback, ctx: as for claim_slot
+ * Returns:
+ *  - SUCCESS or TECNICOFS_ERROR_* code
+ */
+static int send_request(uint32_t request_id, char * sbuffer, int size, int * results, int atomic, tfsCallback callback, void * ctx){
+  int result;
+
+  if((result = claim_slot(request_id, results, atomic, callback, ctx)) != SUCCESS)
+    return result;
+  send_datagram(sbuffer, size);
+  return SUCCESS;
+}
+
+/**
+ * Checks a request executed in-process as its encoding would: a known
+ * opcode and arguments shorter than MAX_FILE_NAME
+ * Returns:
+ *  - SUCCESS or FAIL
+ */
+static int check_request(TfsRequest * request){
+  int num_args = tfs_num_args(request->opcode);
+
+  if(num_args == FAIL || request->opcode == TFS_OP_BATCH)
+    return FAIL;
+  for(int i = 0; i < num_args; i++)
+    if(memchr(request->args[i], '\0', MAX_FILE_NAME) == NULL)
+      return FAIL;
+  return SUCCESS;
+}
+
+/**
+ * Sends a request without waiting for its response
+ * Input:
+ *  - request: request to send (its request_id is set)
+ *  - callback: function called with the result, or NULL
+ *  - ctx: argument of the callback
+ * Returns:
+ *  - SUCCESS or TECNICOFS_ERROR_* code
+ */
+static int submit_request(TfsRequest * request, tfsCallback callback, void * ctx){
+  char sbuffer[TFS_MAX_REQUEST_SIZE];
+  int size, inumber;
+
+  request->request_id = next_request_id();
+
+  /* a lookup future is resolved in the published namespace, if no request
+   * of this client is still being executed by the server */
+  if(ns && request->opcode == TFS_OP_LOOKUP && !callback && in_flight == 0 &&
+      tfs_ns_lookup(ns, request->args[0], &inumber) == SUCCESS){
+    PendingRequest * slot = &pending[request->request_id % TFS_MAX_WINDOW];
+    if(slot->state != PENDING_FREE)
+      return TECNICOFS_ERROR_OTHER;
+    slot->request_id = request->request_id;
+    slot->state = PENDING_DONE;
+    slot->callback = NULL;
+    slot->result = inumber;
+    return SUCCESS;
+  }
+
+  if(inprocess){
+    int result;
+    if(check_request(request) == FAIL)
+      return TECNICOFS_ERROR_OTHER;
+    if((result = claim_slot(request->request_id, NULL, 0, callback, ctx)) != SUCCESS)
+      return result;
+    execute_inprocess(request->request_id, request, 0, 0);
+    return SUCCESS;
+  }
+
+  if((size = tfs_encode_request(request, sbuffer)) == FAIL)
+    return TECNICOFS_ERROR_OTHER;
+  return send_request(request->request_id, sbuffer, size, NULL, 0, callback, ctx);
+}
+
+/**
+ * Sends a request without waiting for its response (a future, claimed
+ * with tfsResult).
+ * Input:
+ *  - request: request to send (its request_id is set)
+ * Returns:
+ *  - SUCCESS or TECNICOFS_ERROR_* code
+ */
+int tfsSubmit(TfsRequest * request){
+  return submit_request(request, NULL, NULL);
+}
+
+/**
+ * Waits for the response to a request sent without a callback and claims
+ * it. Responses to other requests received meanwhile are completed.
+ * Input:
+ *  - request_id: id of the request
+ * Returns:
+ *  - value of the operation (SUCCESS, inumber or TECNICOFS_ERROR_* code)
+ */
+int tfsResult(uint32_t request_id){
+  PendingRequest * slot = &pending[request_id % TFS_MAX_WINDOW];
+
+  if(slot->state == PENDING_FREE || slot->request_id != request_id || slot->callback)
+    return TECNICOFS_ERROR_OTHER;
+
+  while(slot->state == PENDING_SENT)
+    receive_response(0);
+
+  slot->state = PENDING_FREE;
+  return slot->result;
+}
+
+/**
+ * Completes the requests whose responses already arrived, without waiting.
+ * Returns:
+ *  - number of responses received
+ */
+int tfsPoll(){
+  int received = 0;
+
+  while(in_flight > 0 && receive_response(MSG_DONTWAIT))
+    received++;
+  return received;
+}
+
+/**
+ * Waits until every request sent got its response.
+ * Returns:
+ *  - number of responses received
+ */
+int tfsWait(){
+  int received = 0;
+
+  while(in_flight > 0)
+    received += receive_response(0);
+  return received;
+}
+
+/**
+ * Fills a request
+ * Input:
+ *  - request: request to fill
+ *  - opcode: TFS_OP_* code
+ *  - nodeType: type of file to create ('f' or 'd'), ignored by other operations
+ *  - arg1: first argument
+ *  - arg2: second argument, or NULL
+ * Returns:
+ *  - SUCCESS or FAIL (invalid argument)
+ */
+static int make_request(TfsRequest * request, int opcode, char nodeType, char * arg1, char * arg2){
+  memset(request, 0, sizeof(TfsRequest));
+  request->opcode = opcode;
+  if(strlen(arg1) >= MAX_FILE_NAME || (arg2 && strlen(arg2) >= MAX_FILE_NAME))
+    return FAIL;
+  strcpy(request->args[0], arg1);
+  if(arg2)
+    strcpy(request->args[1], arg2);
+
+  if(opcode == TFS_OP_CREATE){
+    if(nodeType == 'd')
+      request->flags = TFS_FLAG_DIRECTORY;
+    else if(nodeType != 'f')
+      return FAIL;
+  }
+  return SUCCESS;
+}
+
+/**
+ * Sends a request without waiting for its response
+ * Returns:
+ *  - request_id (a positive handle) or TECNICOFS_ERROR_* code
+ */
+static int start_request(int opcode, char nodeType, char * arg1, char * arg2, tfsCallback callback, void * ctx){
+  TfsRequest request;
+  int result;
+
+  if(make_request(&request, opcode, nodeType, arg1, arg2) == FAIL)
+    return TECNICOFS_ERROR_OTHER;
+  if((result = submit_request(&request, callback, ctx)) != SUCCESS)
+    return result;
+  return request.request_id;
+}
+
+/**
+ * Sends a request and waits for its response
+ * Returns:
+ *  - value of the operation
+ */
+static int run_request(int opcode, char nodeType, char * arg1, char * arg2){
+  int request_id = start_request(opcode, nodeType, arg1, arg2, NULL, NULL);
+
+  if(request_id < 0)
+    return request_id;
+  return tfsResult(request_id);
 }
 
 /**
  * Requests create operation
  * Input:
  *  - filename: name of the file to be created
- *  - nodeType: type of file
+ *  - nodeType: type of file ('f' or 'd')
  * Returns:
- *  - value of the operation (FAIL or SUCCESS)
+ *  - value of the operation (SUCCESS or TECNICOFS_ERROR_* code)
  */
 int tfsCreate(char *filename, char nodeType) {
-  char sbuffer[MAX_INPUT_SIZE];
-  int result = FAIL;
-  sprintf(sbuffer, "%c %s %c", 'c', filename, nodeType);
-
-  send_message(sbuffer);
-  result = receive_message();
-  return result;
+  return run_request(TFS_OP_CREATE, nodeType, filename, NULL);
 }
 
 /**
@@ -52,16 +482,10 @@ int tfsCreate(char *filename, char nodeType) {
  * Input:
  *  - path: is the path to be deleted
  * Returns:
- *  - value of the operation (FAIL or SUCCESS)
+ *  - value of the operation (SUCCESS or TECNICOFS_ERROR_* code)
  */
 int tfsDelete(char *path) {
-  char sbuffer[MAX_INPUT_SIZE];
-  int result = FAIL;
-  sprintf(sbuffer, "%c %s", 'd', path);
-
-  send_message(sbuffer);
-  result = receive_message();
-  return result;
+  return run_request(TFS_OP_DELETE, 0, path, NULL);
 }
 
 /**
@@ -70,16 +494,10 @@ int tfsDelete(char *path) {
  *  - from: is the source path
  *  - to: is the destination path
  * Returns:
- *  - value of the operation (FAIL or SUCCESS)
+ *  - value of the operation (SUCCESS or TECNICOFS_ERROR_* code)
  */
 int tfsMove(char *from, char *to) {
-  char sbuffer[MAX_INPUT_SIZE];
-  int result = FAIL;
-  sprintf(sbuffer, "%c %s %s", 'm', from, to);
-
-  send_message(sbuffer);
-  result = receive_message();
-  return result;
+  return run_request(TFS_OP_MOVE, 0, from, to);
 }
 
 /**
@@ -87,35 +505,295 @@ int tfsMove(char *from, char *to) {
  * Input:
  *  - path: is the path to be looked up
  * Returns:
- *  - value of the operation (FAIL or SUCCESS)
+ *  - inumber of the path, or TECNICOFS_ERROR_* code
  */
 int tfsLookup(char *path) {
-  char sbuffer[MAX_INPUT_SIZE];
-  int result = FAIL;
-  sprintf(sbuffer, "%c %s", 'l', path);
-
-  send_message(sbuffer);
-  result = receive_message();
-  return result;
+  return run_request(TFS_OP_LOOKUP, 0, path, NULL);
 }
 
 /**
- * Request print operation. Receives print buffer and writes it to output file.
+ * Request print operation. The server writes the tree to the output file.
  * Input:
  *  - filename: is the name of the output file
+ * Returns:
+ *  - value of the operation (SUCCESS or TECNICOFS_ERROR_* code)
  */
 int tfsPrint(char *filename){
-  char sbuffer[MAX_INPUT_SIZE];
-  int result = FAIL;
-  sprintf(sbuffer, "%c %s", 'p', filename);
+  return run_request(TFS_OP_PRINT, 0, filename, NULL);
+}
+
+/**
+ * Request the lock profile. The server writes its most contended i-node
+ * locks, with their paths, to the output file.
+ * Input:
+ *  - filename: is the name of the output file
+ * Returns:
+ *  - value of the operation (SUCCESS, or TECNICOFS_ERROR_OTHER if the
+ *    server doesn't profile its locks)
+ */
+int tfsLockProfile(char *filename){
+  return run_request(TFS_OP_LOCKS, 0, filename, NULL);
+}
+
+/**
+ * Request a trace command. The server starts recording the trace of its
+ * requests ("on"), stops it ("off"), or writes it to an output file.
+ * Input:
+ *  - command: "on", "off" or the name of the output file
+ * Returns:
+ *  - value of the operation (SUCCESS or TECNICOFS_ERROR_* code)
+ */
+int tfsTrace(char *command){
+  return run_request(TFS_OP_TRACE, 0, command, NULL);
+}
+
+/*
+ * Asynchronous requests: they return as soon as the request is sent (or
+ * once the window has room), with the id of the request, a positive
+ * handle, or a TECNICOFS_ERROR_* code. The callback is called with the
+ * result from tfsPoll, tfsWait or any call waiting for responses. Without
+ * a callback, the handle is a future whose result is claimed with
+ * tfsResult.
+ */
+
+int tfsCreateAsync(char *filename, char nodeType, tfsCallback callback, void *ctx) {
+  return start_request(TFS_OP_CREATE, nodeType, filename, NULL, callback, ctx);
+}
+
+int tfsDeleteAsync(char *path, tfsCallback callback, void *ctx) {
+  return start_request(TFS_OP_DELETE, 0, path, NULL, callback, ctx);
+}
+
+int tfsMoveAsync(char *from, char *to, tfsCallback callback, void *ctx) {
+  return start_request(TFS_OP_MOVE, 0, from, to, callback, ctx);
+}
+
+int tfsLookupAsync(char *path, tfsCallback callback, void *ctx) {
+  return start_request(TFS_OP_LOOKUP, 0, path, NULL, callback, ctx);
+}
+
+int tfsPrintAsync(char *filename, tfsCallback callback, void *ctx) {
+  return start_request(TFS_OP_PRINT, 0, filename, NULL, callback, ctx);
+}
+
+/**
+ * Gets the statistics of the server: requests executed, errors and
+ * latencies of each operation, and requests waiting for a worker
+ * Input:
+ *  - stats: statistics to fill
+ * Returns:
+ *  - SUCCESS or TECNICOFS_ERROR_* code
+ */
+int tfsStats(TfsStats *stats) {
+  TfsRequest request;
+  int result;
 
-  send_message(sbuffer);
-  result = receive_message();
-  return result;
+  if(inprocess){
+    tfs_inprocess_stats(stats);
+    return SUCCESS;
+  }
+
+  memset(&request, 0, sizeof(request));
+  request.opcode = TFS_OP_STATS;
+  if((result = submit_request(&request, NULL, NULL)) != SUCCESS)
+    return result;
+  /* no response is received before it is waited for */
+  pending[request.request_id % TFS_MAX_WINDOW].stats = stats;
+  return tfsResult(request.request_id);
 }
 
 /**
- * Mounts client and server sockets
+ * Sends many operations in one request, without waiting for the response
+ * Input:
+ *  - ops: operations
+ *  - num: number of operations, up to TFS_MAX_BATCH
+ *  - results: array to store the result of each operation
+ *  - flags: flags of the batch (TFS_FLAG_ATOMIC)
+ *  - callback: function called with the result, or NULL
+ *  - ctx: argument of the callback
+ * Returns:
+ *  - request_id (a positive handle) or TECNICOFS_ERROR_* code
+ */
+static int start_batch(TfsRequest *ops, int num, int *results, uint8_t flags, tfsCallback callback, void *ctx) {
+  char sbuffer[TFS_MAX_BATCH_REQUEST_SIZE];
+  uint32_t request_id = next_request_id();
+  int size, result;
+
+  if(inprocess){
+    if(num <= 0 || num > TFS_MAX_BATCH)
+      return TECNICOFS_ERROR_OTHER;
+    for(int i = 0; i < num; i++)
+      if(check_request(&ops[i]) == FAIL)
+        return TECNICOFS_ERROR_OTHER;
+    if((result = claim_slot(request_id, results, flags & TFS_FLAG_ATOMIC, callback, ctx)) != SUCCESS)
+      return result;
+    execute_inprocess(request_id, ops, num, flags);
+    return request_id;
+  }
+
+  if((size = tfs_encode_batch(ops, num, request_id, flags, sbuffer)) == FAIL)
+    return TECNICOFS_ERROR_OTHER;
+  if((result = send_request(request_id, sbuffer, size, results, flags & TFS_FLAG_ATOMIC, callback, ctx)) != SUCCESS)
+    return result;
+  return request_id;
+}
+
+/**
+ * Sends many operations in one request, without waiting for the response.
+ * The server executes them in order. The callback (or tfsResult) gets the
+ * number of operations executed, or a TECNICOFS_ERROR_* code if the batch
+ * was rejected.
+ * Input:
+ *  - ops: operations (filled as for tfsSubmit, request ids are ignored)
+ *  - num: number of operations, up to TFS_MAX_BATCH
+ *  - results: array to store the result of each operation, valid until
+ *    the batch completes
+ *  - callback: function called with the result, or NULL
+ *  - ctx: argument of the callback
+ * Returns:
+ *  - request_id (a positive handle) or TECNICOFS_ERROR_* code
+ */
+int tfsBatchAsync(TfsRequest *ops, int num, int *results, tfsCallback callback, void *ctx) {
+  return start_batch(ops, num, results, 0, callback, ctx);
+}
+
+/**
+ * Sends many operations in one request and waits for their results
+ * Input:
+ *  - ops: operations
+ *  - num: number of operations, up to TFS_MAX_BATCH
+ *  - results: array to store the result of each operation
+ * Returns:
+ *  - number of operations executed, or TECNICOFS_ERROR_* code
+ */
+int tfsBatch(TfsRequest *ops, int num, int *results) {
+  int request_id = tfsBatchAsync(ops, num, results, NULL, NULL);
+
+  if(request_id < 0)
+    return request_id;
+  return tfsResult(request_id);
+}
+
+/**
+ * Sends a transaction, without waiting for the response. The server
+ * applies its operations (creates, deletes, moves and lookups) as a unit:
+ * all of them or none, and no other client sees the states in between.
+ * The callback (or tfsResult) gets SUCCESS if it was committed, or the
+ * error of the operation that failed.
+ * Input:
+ *  - ops: operations (filled as for tfsSubmit, request ids are ignored)
+ *  - num: number of operations, up to TFS_MAX_BATCH
+ *  - results: array to store the result of each operation, valid until
+ *    the transaction completes
+ *  - callback: function called with the result, or NULL
+ *  - ctx: argument of the callback
+ * Returns:
+ *  - request_id (a positive handle) or TECNICOFS_ERROR_* code
+ */
+int tfsTransactionAsync(TfsRequest *ops, int num, int *results, tfsCallback callback, void *ctx) {
+  return start_batch(ops, num, results, TFS_FLAG_ATOMIC, callback, ctx);
+}
+
+/**
+ * Sends a transaction and waits for its result
+ * Input:
+ *  - ops: operations
+ *  - num: number of operations, up to TFS_MAX_BATCH
+ *  - results: array to store the result of each operation
+ * Returns:
+ *  - SUCCESS if committed, or TECNICOFS_ERROR_* code
+ */
+int tfsTransaction(TfsRequest *ops, int num, int *results) {
+  int request_id = tfsTransactionAsync(ops, num, results, NULL, NULL);
+
+  if(request_id < 0)
+    return request_id;
+  return tfsResult(request_id);
+}
+
+/**
+ * Attaches to the shared-memory socket of the server: passes it the memfd
+ * of a new session, and gets the memfd of the published namespace, as
+ * requested by use_shm
+ * Input:
+ *  - server_socket_path
+ * Returns
+ * - FAIL or SUCCESS
+ */
+static int attach_shm(char * server_socket_path){
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct sockaddr_un addr;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr * cmsg;
+  char path[sizeof(addr.sun_path)], flags = use_shm, status = FAIL;
+  int fd = -1;
+
+  if(strlen(server_socket_path) + sizeof(TFS_SHM_SUFFIX) > sizeof(path))
+    return FAIL;
+  strcpy(path, server_socket_path);
+  strcat(path, TFS_SHM_SUFFIX);
+
+  if((shm_connfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+    return FAIL;
+  /* if the server doesn't answer in time, the socket is used */
+  if(tfs_shm_set_timeout(shm_connfd, TFS_SHM_ATTACH_TIMEOUT) == FAIL ||
+      connect(shm_connfd, (struct sockaddr *) &addr, set_socket_address(path, &addr)) < 0 ||
+      ((flags & TFS_SHM_SESSION) && (shm = tfs_shm_create(&fd)) == NULL)){
+    close(shm_connfd);
+    return FAIL;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &flags;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if(shm){
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+  if(sendmsg(shm_connfd, &msg, MSG_NOSIGNAL) != 1)
+    status = FAIL;
+  else{
+    /* the reply carries the memfd of the namespace, if published */
+    iov.iov_base = &status;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    if(recvmsg(shm_connfd, &msg, MSG_CMSG_CLOEXEC) != 1)
+      status = FAIL;
+    else if((cmsg = CMSG_FIRSTHDR(&msg)) != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+      int ns_fd;
+      memcpy(&ns_fd, CMSG_DATA(cmsg), sizeof(int));
+      ns = tfs_ns_map(ns_fd);
+      close(ns_fd);
+    }
+  }
+  if(fd >= 0)
+    close(fd);
+
+  if(status != SUCCESS && shm){
+    tfs_shm_unmap(shm);
+    shm = NULL;
+  }
+  /* the server ends the session when the connection is closed */
+  if(shm == NULL)
+    close(shm_connfd);
+  return status == SUCCESS ? SUCCESS : FAIL;
+}
+
+/**
+ * Mounts client and server sockets, or the file system engine linked into
+ * the client if the server is TFS_INPROCESS_TARGET (and then the client
+ * socket isn't used)
  * Input:
  *  - server_socket_path
  *  - client_socket_path
@@ -123,6 +801,13 @@ int tfsPrint(char *filename){
  * - FAIL or SUCCESS
  */
 int tfsMount(char * server_socket_path, char * client_socket_path) {
+  if(strcmp(server_socket_path, TFS_INPROCESS_TARGET) == 0){
+    if(tfs_inprocess_mount() == FAIL)
+      return FAIL;
+    inprocess = 1;
+    return SUCCESS;
+  }
+
   /* create socket */
   if((sockfd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0){
     fprintf(stderr, "tecnicofs-client: can't open socket\n");
@@ -144,6 +829,16 @@ int tfsMount(char * server_socket_path, char * client_socket_path) {
   /* set server socket address */
   server_len = set_socket_address(server_socket_path, &server_addr);
 
+  /* only the server sends to this socket, and sends wait for room in its queue */
+  if(connect(sockfd, (struct sockaddr *) &server_addr, server_len) < 0){
+    fprintf(stderr, "tecnicofs-client: can't connect to the server socket\n");
+    return FAIL;
+  }
+
+  /* the socket stays as the transport if there is no session */
+  if(use_shm)
+    attach_shm(server_socket_path);
+
   return SUCCESS;
 }
 
@@ -156,6 +851,24 @@ int tfsMount(char * server_socket_path, char * client_socket_path) {
  * - FAIL or SUCCESS
  */
 int tfsUnmount(char * client_socket_path) {
+  if(inprocess){
+    tfsWait();
+    tfs_inprocess_unmount();
+    inprocess = 0;
+    return SUCCESS;
+  }
+
+  /* the server ends the session when the connection is closed */
+  if(shm){
+    tfs_shm_unmap(shm);
+    shm = NULL;
+    close(shm_connfd);
+  }
+  if(ns){
+    tfs_ns_unmap(ns);
+    ns = NULL;
+  }
+
   if(unlink(client_socket_path) != 0){
     fprintf(stderr, "tecnicofs-client: error unlinking client socket path\n");
     return FAIL;
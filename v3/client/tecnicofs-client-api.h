@@ -2,32 +2,59 @@
 #define API_H
 
 #include "../tecnicofs-api-constants.h"
+#include "../tecnicofs-protocol.h"
+#include "../tecnicofs-shm.h"
 
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <sys/uio.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <errno.h>
+#include <poll.h>
 
-int sockfd;
-socklen_t server_len, client_len;
-struct sockaddr_un server_addr, client_addr;
+/* Maximum number of requests sent and not yet completed */
+#define TFS_MAX_WINDOW 4096
 
-void send_message(char*);
-int receive_message();
+/* Server of tfsMount that executes requests in the client process */
+#define TFS_INPROCESS_TARGET ":inprocess"
+
+/* Completion callback of an asynchronous request: result and context */
+typedef void (*tfsCallback)(int, void*);
+
+int tfsSetWindow(int);
+int tfsSetSharedMemory(int);
+int tfsSubmit(TfsRequest*);
+int tfsResult(uint32_t);
+int tfsPoll();
+int tfsWait();
 
 int tfsCreate(char*, char);
 int tfsDelete(char*);
 int tfsLookup(char*);
 int tfsMove(char*, char*);
 int tfsPrint(char*);
+int tfsLockProfile(char*);
+int tfsTrace(char*);
+int tfsStats(TfsStats*);
 int tfsMount(char*, char*);
 int tfsUnmount(char*);
 
+int tfsCreateAsync(char*, char, tfsCallback, void*);
+int tfsDeleteAsync(char*, tfsCallback, void*);
+int tfsLookupAsync(char*, tfsCallback, void*);
+int tfsMoveAsync(char*, char*, tfsCallback, void*);
+int tfsPrintAsync(char*, tfsCallback, void*);
+int tfsBatch(TfsRequest*, int, int*);
+int tfsBatchAsync(TfsRequest*, int, int*, tfsCallback, void*);
+int tfsTransaction(TfsRequest*, int, int*);
+int tfsTransactionAsync(TfsRequest*, int, int*, tfsCallback, void*);
+
 int set_socket_address(char*, struct sockaddr_un*);
 
 #endif /* CLIENT_H */
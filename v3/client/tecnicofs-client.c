@@ -12,24 +12,72 @@
 
 FILE* inputFile;
 char* serverName;
+int pipelineDepth = 1;
+int batchSize = 1;
+int shmFlags = 0; /* TFS_SHM_* flags of the mount */
 
 char server_socket_path[MAX_SOCKET_PATH];
 char client_socket_path[MAX_SOCKET_PATH];
 
+/* Commands of the input file sent in one request, waiting to have their results printed */
+typedef struct {
+    TfsRequest *requests; /* batchSize commands, or TFS_MAX_BATCH for a transaction */
+    int *results; /* results of a batch */
+    int num, capacity;
+    int transaction; /* the commands are a transaction ("x begin" ... "x end") */
+    int request_id; /* request sent, or TECNICOFS_ERROR_* code if it couldn't be sent */
+} PipelinedRequest;
+
 static void displayUsage (const char* appName) {
-    printf("Usage: %s inputfile server_socket_name\n", appName);
+    printf("Usage: %s [-p depth] [-b size] [-s] [-n] inputfile server_socket_name\n", appName);
+    printf("  -p depth  requests sent before waiting for a response (default 1)\n");
+    printf("  -b size   consecutive commands sent in one request (default 1)\n");
+    printf("  -s        send requests through shared memory, if the server accepts it\n");
+    printf("  -n        resolve lookups in the namespace published by the server, if any\n");
+    printf("server_socket_name %s runs the file system in the client process\n", TFS_INPROCESS_TARGET);
     exit(EXIT_FAILURE);
 }
 
 static void parseArgs (long argc, char* const argv[]) {
-    if (argc != 3) {
+    int option;
+
+    while ((option = getopt(argc, argv, "p:b:sn")) != -1) {
+        switch (option) {
+            case 'p':
+                pipelineDepth = atoi(optarg);
+                if (pipelineDepth < 1 || pipelineDepth > TFS_MAX_WINDOW) {
+                    fprintf(stderr, "Error: pipeline depth must be between 1 and %d\n", TFS_MAX_WINDOW);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'b':
+                batchSize = atoi(optarg);
+                if (batchSize < 1 || batchSize > TFS_MAX_BATCH) {
+                    fprintf(stderr, "Error: batch size must be between 1 and %d\n", TFS_MAX_BATCH);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                shmFlags |= TFS_SHM_SESSION;
+                break;
+            case 'n':
+                shmFlags |= TFS_SHM_NAMESPACE;
+                break;
+            default:
+                displayUsage(argv[0]);
+        }
+    }
+
+    tfsSetSharedMemory(shmFlags);
+
+    if (argc - optind != 2) {
         fprintf(stderr, "Invalid format:\n");
         displayUsage(argv[0]);
     }
 
-    serverName = argv[2];
+    serverName = argv[optind + 1];
 
-    inputFile = fopen(argv[1], "r");
+    inputFile = fopen(argv[optind], "r");
 
     if (inputFile== NULL) {
         fprintf(stderr, "Error: cannot open input file\n");
@@ -42,96 +90,252 @@ void errorParse(){
     exit(EXIT_FAILURE);
 }
 
-void *processInput() {
-    char line[MAX_INPUT_SIZE];
+/*
+ * Parses a transaction delimiter: "x begin" starts a transaction, whose
+ * commands are sent as a unit at "x end".
+ * Returns: 1 for "x begin", 0 for "x end", FAIL if the line is a command
+ */
+int parseTransaction(char *line) {
+    char token, word[MAX_INPUT_SIZE] = "";
 
-    while (fgets(line, sizeof(line)/sizeof(char), inputFile)) {
-        char op;
-        char arg1[MAX_INPUT_SIZE], arg2[MAX_INPUT_SIZE];
-        int res;
+    if (sscanf(line, "%c %s", &token, word) < 1 || token != 'x')
+        return FAIL;
+    if (strcmp(word, "begin") == 0)
+        return 1;
+    if (strcmp(word, "end") == 0)
+        return 0;
+    errorParse();
+    return FAIL;
+}
 
-        int numTokens = sscanf(line, "%c %s %s", &op, arg1, arg2);
+/* prints the result of a command */
+void printResult(TfsRequest *request, int res) {
+    char *arg1 = request->args[0], *arg2 = request->args[1];
 
-        /* perform minimal validation */
-        if (numTokens < 1) {
-            continue;
-        }
-        switch (op) {
-            case 'c':
-                if(numTokens != 3) {
-                    errorParse();
-                    break;
-                }
-                switch (arg2[0]) {
-                    case 'f':
-                        res = tfsCreate(arg1, 'f');
-                        if (!res)
-                          printf("Created file: %s\n", arg1);
-                        else
-                          printf("Unable to create file: %s\n", arg1);
-                        break;
-                    case 'd':
-                        res = tfsCreate(arg1, 'd');
-                        if (!res)
-                          printf("Created directory: %s\n", arg1);
-                        else
-                          printf("Unable to create directory: %s\n", arg1);
-                        break;
-                    default:
-                        fprintf(stderr, "Error: invalid node type\n");
-                }
-                break;
-            case 'l':
-                if(numTokens != 2)
-                    errorParse();
-                res = tfsLookup(arg1);
-                if (res >= 0)
-                    printf("Search: %s found\n", arg1);
-                else
-                    printf("Search: %s not found\n", arg1);
-                break;
-            case 'd':
-                if(numTokens != 2)
-                    errorParse();
-                res = tfsDelete(arg1);
+    switch (request->opcode) {
+        case TFS_OP_CREATE:
+            if (request->flags & TFS_FLAG_DIRECTORY) {
                 if (!res)
-                  printf("Deleted: %s\n", arg1);
+                  printf("Created directory: %s\n", arg1);
                 else
-                  printf("Unable to delete: %s\n", arg1);
-                break;
-            case 'm':
-                if(numTokens != 3)
-                    errorParse();
-                res = tfsMove(arg1, arg2);
+                  printf("Unable to create directory: %s\n", arg1);
+            }
+            else {
                 if (!res)
-                  printf("Moved: %s to %s\n", arg1, arg2);
+                  printf("Created file: %s\n", arg1);
                 else
-                  printf("Unable to move: %s to %s\n", arg1, arg2);
-                break;
-            case 'p':
-                if(numTokens != 2)
-                    errorParse();
-                res = tfsPrint(arg1);
-                if(!res)
-                    printf("Print to %s successful!\n", arg1);
-                else
-                    printf("Print to %s not successful!\n", arg1);
-                break;
-            case '#':
-                break;
-            default: { /* error */
-                errorParse();
+                  printf("Unable to create file: %s\n", arg1);
             }
+            break;
+        case TFS_OP_LOOKUP:
+            if (res >= 0)
+                printf("Search: %s found\n", arg1);
+            else
+                printf("Search: %s not found\n", arg1);
+            break;
+        case TFS_OP_DELETE:
+            if (!res)
+              printf("Deleted: %s\n", arg1);
+            else
+              printf("Unable to delete: %s\n", arg1);
+            break;
+        case TFS_OP_MOVE:
+            if (!res)
+              printf("Moved: %s to %s\n", arg1, arg2);
+            else
+              printf("Unable to move: %s to %s\n", arg1, arg2);
+            break;
+        case TFS_OP_PRINT:
+            if(!res)
+                printf("Print to %s successful!\n", arg1);
+            else
+                printf("Print to %s not successful!\n", arg1);
+            break;
+        case TFS_OP_LOCKS:
+            if(!res)
+                printf("Lock profile to %s successful!\n", arg1);
+            else
+                printf("Lock profile to %s not successful!\n", arg1);
+            break;
+        case TFS_OP_TRACE:
+            if(!res)
+                printf("Trace %s successful!\n", arg1);
+            else
+                printf("Trace %s not successful!\n", arg1);
+            break;
+    }
+}
+
+/* sends the commands of a request, in a batch if there are many */
+void sendRequest(PipelinedRequest *pipelined) {
+    if (pipelined->transaction) {
+        /* results not received count as failed */
+        for (int i = 0; i < pipelined->num; i++)
+            pipelined->results[i] = TECNICOFS_ERROR_OTHER;
+        pipelined->request_id = tfsTransactionAsync(pipelined->requests, pipelined->num, pipelined->results, NULL, NULL);
+    }
+    else if (pipelined->num == 1) {
+        int result = tfsSubmit(&pipelined->requests[0]);
+        pipelined->request_id = result == SUCCESS ? pipelined->requests[0].request_id : result;
+    }
+    else
+        pipelined->request_id = tfsBatchAsync(pipelined->requests, pipelined->num, pipelined->results, NULL, NULL);
+}
+
+/* waits for the results of a request and prints them */
+void completeRequest(PipelinedRequest *pipelined) {
+    int result = pipelined->request_id;
+
+    if (result > 0)
+        result = tfsResult(pipelined->request_id);
+
+    /* a transaction rolled back prints only the command that failed */
+    if (pipelined->transaction) {
+        int failed = 0;
+
+        if (result == SUCCESS)
+            for (int i = 0; i < pipelined->num; i++)
+                printResult(&pipelined->requests[i], pipelined->results[i]);
+        else if (pipelined->request_id > 0) {
+            while (failed < pipelined->num - 1 && pipelined->results[failed] >= 0)
+                failed++;
+            printResult(&pipelined->requests[failed], pipelined->results[failed]);
+        }
+        printf("%s transaction of %d commands\n", result == SUCCESS ? "Committed" :
+            pipelined->request_id > 0 ? "Rolled back" : "Unable to send", pipelined->num);
+        return;
+    }
+    if (pipelined->num == 1) {
+        printResult(&pipelined->requests[0], result);
+        return;
+    }
+    /* result of a batch is the number of commands executed */
+    for (int i = 0; i < pipelined->num; i++)
+        printResult(&pipelined->requests[i], result < 0 ? result :
+            i < result ? pipelined->results[i] : TECNICOFS_ERROR_OTHER);
+}
+
+/* grows the commands of a request to hold a transaction */
+void growRequest(PipelinedRequest *pipelined) {
+    if (pipelined->capacity == TFS_MAX_BATCH) {
+        fprintf(stderr, "Error: more than %d commands in a transaction\n", TFS_MAX_BATCH);
+        exit(EXIT_FAILURE);
+    }
+    pipelined->capacity = TFS_MAX_BATCH;
+    pipelined->requests = (TfsRequest*) realloc(pipelined->requests, sizeof(TfsRequest) * TFS_MAX_BATCH);
+    pipelined->results = (int*) realloc(pipelined->results, sizeof(int) * TFS_MAX_BATCH);
+    if (!pipelined->requests || !pipelined->results) {
+        fprintf(stderr, "Error: couldn't allocate memory for requests\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Sends the current request of the pipeline and returns the next one,
+ * first waiting for the oldest request if pipelineDepth are waiting.
+ * Input:
+ *  - pipeline: requests waiting for a response, from first
+ *  - first: pointer to the index of the oldest request
+ *  - num: pointer to the number of requests waiting
+ */
+PipelinedRequest *nextRequest(PipelinedRequest *pipeline, int *first, int *num) {
+    PipelinedRequest *current;
+
+    sendRequest(&pipeline[(*first + *num) % pipelineDepth]);
+    if (++*num == pipelineDepth) {
+        completeRequest(&pipeline[*first]);
+        *first = (*first + 1) % pipelineDepth;
+        (*num)--;
+    }
+    current = &pipeline[(*first + *num) % pipelineDepth];
+    current->num = 0;
+    current->transaction = 0;
+    return current;
+}
+
+/*
+ * Sends the commands of the input file, batchSize of them per request (or
+ * every command of a transaction in one), keeping up to pipelineDepth
+ * requests waiting for a response. Results are printed in the order of the
+ * file.
+ */
+void *processInput() {
+    char line[MAX_INPUT_SIZE];
+    PipelinedRequest *pipeline;
+    int first = 0, num = 0, delimiter;
+
+    pipeline = (PipelinedRequest*) malloc(sizeof(PipelinedRequest) * pipelineDepth);
+    for (int i = 0; pipeline && i < pipelineDepth; i++) {
+        pipeline[i].requests = (TfsRequest*) malloc(sizeof(TfsRequest) * batchSize);
+        pipeline[i].results = (int*) malloc(sizeof(int) * batchSize);
+        pipeline[i].capacity = batchSize;
+        if (!pipeline[i].requests || !pipeline[i].results)
+            pipeline = NULL;
+    }
+    if (pipeline == NULL) {
+        fprintf(stderr, "Error: couldn't allocate memory for requests\n");
+        exit(EXIT_FAILURE);
+    }
+    tfsSetWindow(pipelineDepth);
+
+    PipelinedRequest *current = &pipeline[0];
+    current->num = 0;
+    current->transaction = 0;
+
+    while (fgets(line, sizeof(line)/sizeof(char), inputFile)) {
+        if (line[0] == '#')
+            continue;
+
+        if ((delimiter = parseTransaction(line)) != FAIL) {
+            /* transactions don't nest, and aren't empty */
+            if (delimiter == current->transaction || (!delimiter && current->num == 0))
+                errorParse();
+            if (delimiter && current->num > 0)
+                current = nextRequest(pipeline, &first, &num);
+            if (delimiter)
+                current->transaction = 1;
+            else
+                current = nextRequest(pipeline, &first, &num);
+            continue;
         }
+
+        if (current->num == current->capacity)
+            growRequest(current);
+        if (tfs_decode_text_request(line, &current->requests[current->num++]) == FAIL)
+            errorParse();
+        if (current->transaction || current->num < batchSize)
+            continue;
+
+        current = nextRequest(pipeline, &first, &num);
+    }
+
+    if (current->transaction)
+        errorParse();
+    if (current->num > 0) {
+        sendRequest(current);
+        num++;
+    }
+    for (; num > 0; num--) {
+        completeRequest(&pipeline[first]);
+        first = (first + 1) % pipelineDepth;
+    }
+
+    for (int i = 0; i < pipelineDepth; i++) {
+        free(pipeline[i].requests);
+        free(pipeline[i].results);
     }
+    free(pipeline);
     fclose(inputFile);
     return NULL;
 }
 
 /* creates sockets paths with tmp_dir */
 void create_sockets_path(){
-    /* create server socket path */
-    sprintf(server_socket_path, "%s%s", tmp_dir, serverName);
+    /* create server socket path (the in-process target isn't a path) */
+    if (strcmp(serverName, TFS_INPROCESS_TARGET) == 0)
+        strcpy(server_socket_path, serverName);
+    else
+        sprintf(server_socket_path, "%s%s", tmp_dir, serverName);
 
     /* create client socket path */
     sprintf(client_socket_path, "%s%s%d", tmp_dir, "clientsocket", getpid());
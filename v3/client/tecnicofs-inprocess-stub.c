@@ -0,0 +1,25 @@
+#include <stdio.h>
+#include "tecnicofs-inprocess.h"
+
+/*
+ * For binaries built without the file system engine: the in-process
+ * target can't be mounted, so the other functions are never called.
+ */
+
+int tfs_inprocess_mount(){
+  fprintf(stderr, "tecnicofs-client: built without the in-process file system\n");
+  return FAIL;
+}
+
+void tfs_inprocess_unmount(){
+}
+
+int tfs_inprocess_apply(TfsRequest * request){
+  return TECNICOFS_ERROR_OTHER;
+}
+
+void tfs_inprocess_apply_batch(TfsRequest * ops, int num, uint8_t flags, int * results){
+}
+
+void tfs_inprocess_stats(TfsStats * stats){
+}
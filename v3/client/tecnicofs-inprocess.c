@@ -0,0 +1,49 @@
+#include "tecnicofs-inprocess.h"
+#include "../server/requests.h"
+#include "../server/stats.h"
+#include "../server/trace.h"
+
+/**
+ * Starts the file system engine
+ * Returns
+ * - SUCCESS
+ */
+int tfs_inprocess_mount(){
+  /* i-nodes are allocated on demand, as by a server without maxinodes */
+  init_fs(0);
+  stats_init();
+  trace_init();
+  return SUCCESS;
+}
+
+/**
+ * Releases the file system engine
+ */
+void tfs_inprocess_unmount(){
+  trace_destroy();
+  stats_destroy();
+  destroy_fs();
+}
+
+/**
+ * Executes a request
+ * Returns
+ * - result of the request, as a server answers it
+ */
+int tfs_inprocess_apply(TfsRequest * request){
+  return apply_request(request);
+}
+
+/**
+ * Executes the operations of a batch, storing the result of each
+ */
+void tfs_inprocess_apply_batch(TfsRequest * ops, int num, uint8_t flags, int * results){
+  apply_batch_requests(ops, num, flags, results);
+}
+
+/**
+ * Gets the statistics of the requests executed
+ */
+void tfs_inprocess_stats(TfsStats * stats){
+  stats_collect(stats);
+}
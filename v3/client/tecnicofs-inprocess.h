@@ -0,0 +1,19 @@
+#ifndef INPROCESS_H
+#define INPROCESS_H
+
+#include "../tecnicofs-protocol.h"
+
+/*
+ * File system engine of the server, run by the client mounted on
+ * TFS_INPROCESS_TARGET (tecnicofs-inprocess.c, in libtecnicofs-engine.a).
+ * Binaries that don't offer that target link tecnicofs-inprocess-stub.c
+ * instead, where it can't be mounted.
+ */
+
+int tfs_inprocess_mount();
+void tfs_inprocess_unmount();
+int tfs_inprocess_apply(TfsRequest*);
+void tfs_inprocess_apply_batch(TfsRequest*, int, uint8_t, int*);
+void tfs_inprocess_stats(TfsStats*);
+
+#endif
@@ -0,0 +1,580 @@
+/*
+ *
+ * TecnicoFS Load Generator
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+#include "tecnicofs-client-api.h"
+#include "../tecnicofs-histogram.h"
+
+/* Nanoseconds an open-loop session sleeps at most before polling */
+#define POLL_INTERVAL 20000
+
+/* Limit of directories of the namespace */
+#define MAX_DIRS (1 << 20)
+
+/* Operations of a transaction of the mix */
+#define TX_OPS 4
+
+char* serverName;
+int numSessions = 1;
+double rate = 0; /* requests per second of all sessions, 0 for closed loop */
+int depth = 1; /* requests in flight per session, in closed loop */
+double duration = 5;
+long opsPerSession = 0; /* requests per session, instead of the duration */
+int mix[TFS_OP_MAX] = { [TFS_OP_CREATE] = 20, [TFS_OP_DELETE] = 10, [TFS_OP_LOOKUP] = 60, [TFS_OP_MOVE] = 10 };
+int mixTotal;
+int width = 8, levels = 2, leafFiles = 4;
+int shmFlags = 0; /* TFS_SHM_* flags of the mounts */
+int json = 0;
+
+static const char *opNames[TFS_OP_MAX] = {
+    [TFS_OP_CREATE] = "create",
+    [TFS_OP_DELETE] = "delete",
+    [TFS_OP_LOOKUP] = "lookup",
+    [TFS_OP_MOVE] = "move",
+    [TFS_OP_BATCH] = "transaction",
+};
+
+/* Namespace created before the sessions start: directories of every level
+ * (the leaves last) and leafFiles files in each leaf */
+char **dirs;
+int numDirs, numLeaves;
+
+/* Results of a session, in memory shared with the parent */
+typedef struct {
+    TfsHistogram latencies[TFS_OP_MAX];
+    uint64_t errors[TFS_OP_MAX];
+    uint64_t start, end; /* nanoseconds */
+    int failed;
+} SessionStats;
+
+/* Request of a session in flight. Its latency counts from when it was
+ * due to be sent (in open loop) or sent (in closed loop) */
+typedef struct {
+    int opcode;
+    uint64_t start;
+    char path[MAX_FILE_NAME], dest[MAX_FILE_NAME];
+    int rollback; /* the transaction must be rolled back */
+    int results[TX_OPS];
+} Outstanding;
+
+/* State of the session run by this process */
+typedef struct {
+    pid_t pid; /* in the names of its files, unique across runs */
+    SessionStats *stats;
+    Outstanding outstanding[2 * TFS_MAX_WINDOW]; /* by number of request */
+    long submitted;
+    uint64_t deadline;
+    uint64_t random;
+    /* files created by the session: directory and number of each */
+    int *fileDirs, *fileIds, numFiles, maxFiles, nextFile;
+    /* operations of the transactions in flight, by number of request */
+    TfsRequest (*txOps)[TX_OPS];
+    /* file created by the last transaction rolled back, "" if checked */
+    char rolledBack[MAX_FILE_NAME];
+} Session;
+
+static void displayUsage (const char* appName) {
+    printf("Usage: %s [options] server_socket_name\n", appName);
+    printf("  -c sessions  concurrent client sessions, one process each (default 1)\n");
+    printf("  -r rate      requests per second of all sessions (open loop)\n");
+    printf("  -p depth     requests in flight per session without -r (default 1)\n");
+    printf("  -t seconds   duration (default 5)\n");
+    printf("  -k requests  requests per session, instead of a duration\n");
+    printf("  -m mix       weights of the operations (default create=20,delete=10,lookup=60,move=10),\n");
+    printf("               and of transactions (transaction=N, none by default)\n");
+    printf("  -w width     subdirectories of each directory (default 8)\n");
+    printf("  -d levels    levels of directories (default 2)\n");
+    printf("  -f files     files in each directory of the last level (default 4)\n");
+    printf("  -s           send requests through shared memory, if the server accepts it\n");
+    printf("  -n           resolve lookups in the namespace published by the server, if any\n");
+    printf("  -o format    csv (default) or json\n");
+    printf("server_socket_name %s runs the file system in each session\n", TFS_INPROCESS_TARGET);
+    exit(EXIT_FAILURE);
+}
+
+/* parses the weights of the operations, "op=weight,..." */
+static void parseMix (char *arg) {
+    char *saveptr, *item;
+
+    for (int i = 0; i < TFS_OP_MAX; i++)
+        mix[i] = 0;
+    for (item = strtok_r(arg, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+        char *weight = strchr(item, '=');
+        int op;
+
+        if (weight == NULL)
+            displayUsage("tecnicofs-loadgen");
+        *weight++ = '\0';
+        for (op = 0; op < TFS_OP_MAX; op++)
+            if (opNames[op] && strcmp(opNames[op], item) == 0)
+                break;
+        if (op == TFS_OP_MAX || atoi(weight) < 0) {
+            fprintf(stderr, "Error: invalid operation weight: %s\n", item);
+            exit(EXIT_FAILURE);
+        }
+        mix[op] = atoi(weight);
+    }
+}
+
+static void parseArgs (long argc, char* const argv[]) {
+    int option;
+
+    while ((option = getopt(argc, argv, "c:r:p:t:k:m:w:d:f:sno:")) != -1) {
+        switch (option) {
+            case 'c':
+                numSessions = atoi(optarg);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'p':
+                depth = atoi(optarg);
+                if (depth < 1 || depth > TFS_MAX_WINDOW) {
+                    fprintf(stderr, "Error: depth must be between 1 and %d\n", TFS_MAX_WINDOW);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                duration = atof(optarg);
+                break;
+            case 'k':
+                opsPerSession = atol(optarg);
+                break;
+            case 'm':
+                parseMix(optarg);
+                break;
+            case 'w':
+                width = atoi(optarg);
+                break;
+            case 'd':
+                levels = atoi(optarg);
+                break;
+            case 'f':
+                leafFiles = atoi(optarg);
+                break;
+            case 's':
+                shmFlags |= TFS_SHM_SESSION;
+                break;
+            case 'n':
+                shmFlags |= TFS_SHM_NAMESPACE;
+                break;
+            case 'o':
+                if (strcmp(optarg, "json") == 0)
+                    json = 1;
+                else if (strcmp(optarg, "csv") != 0)
+                    displayUsage(argv[0]);
+                break;
+            default:
+                displayUsage(argv[0]);
+        }
+    }
+
+    tfsSetSharedMemory(shmFlags);
+
+    if (argc - optind != 1) {
+        fprintf(stderr, "Invalid format:\n");
+        displayUsage(argv[0]);
+    }
+    serverName = argv[optind];
+
+    for (int i = 0; i < TFS_OP_MAX; i++)
+        mixTotal += mix[i];
+    if (numSessions < 1 || rate < 0 || duration <= 0 || opsPerSession < 0 || mixTotal == 0 ||
+            width < 1 || levels < 1 || leafFiles < 0) {
+        fprintf(stderr, "Error: invalid arguments\n");
+        displayUsage(argv[0]);
+    }
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* return next pseudo-random number of the session (xorshift) */
+static uint64_t next_random(Session *session) {
+    session->random ^= session->random << 13;
+    session->random ^= session->random >> 7;
+    session->random ^= session->random << 17;
+    return session->random;
+}
+
+/* builds the paths of the directories of every level, the leaves last */
+static void buildNamespace () {
+    int first = 0, count;
+
+    numLeaves = 1;
+    for (int level = 0; level < levels; level++) {
+        if (numDirs + (long) numLeaves * width > MAX_DIRS) {
+            fprintf(stderr, "Error: more than %d directories\n", MAX_DIRS);
+            exit(EXIT_FAILURE);
+        }
+        numLeaves *= width;
+        numDirs += numLeaves;
+    }
+    dirs = malloc(numDirs * sizeof(char*));
+
+    /* level by level, each directory after its parent */
+    count = 0;
+    for (int i = 0; i < width; i++) {
+        dirs[count] = malloc(MAX_FILE_NAME);
+        snprintf(dirs[count++], MAX_FILE_NAME, "/d%d", i);
+    }
+    while (count < numDirs) {
+        int parent = first++;
+        for (int i = 0; i < width; i++) {
+            dirs[count] = malloc(MAX_FILE_NAME);
+            if (snprintf(dirs[count++], MAX_FILE_NAME, "%s/d%d", dirs[parent], i) >= MAX_FILE_NAME - 16) {
+                fprintf(stderr, "Error: paths of the namespace are too long\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+}
+
+/* creates the namespace in the mounted file system (it may already exist) */
+static void populate () {
+    char path[MAX_FILE_NAME];
+
+    for (int i = 0; i < numDirs; i++)
+        tfsCreate(dirs[i], 'd');
+    for (int i = numDirs - numLeaves; i < numDirs; i++)
+        for (int j = 0; j < leafFiles; j++) {
+            snprintf(path, MAX_FILE_NAME, "%s/p%d", dirs[i], j);
+            tfsCreate(path, 'f');
+        }
+}
+
+/* gets a path to look up: a directory or a file of the namespace */
+static void lookupPath (Session *session, char *path) {
+    long node = next_random(session) % (numDirs + (long) numLeaves * leafFiles);
+
+    if (node < numDirs)
+        strcpy(path, dirs[node]);
+    else {
+        node -= numDirs;
+        snprintf(path, MAX_FILE_NAME, "%s/p%ld", dirs[numDirs - numLeaves + node / leafFiles], node % leafFiles);
+    }
+}
+
+/* gets the path of a file of the session */
+static void filePath (Session *session, int file, char *path) {
+    snprintf(path, MAX_FILE_NAME, "%s/f%d-%d", dirs[session->fileDirs[file]], session->pid, session->fileIds[file]);
+}
+
+/* picks a directory and a new name for a file of the session */
+static void newFile (Session *session, int file) {
+    session->fileDirs[file] = next_random(session) % numDirs;
+    session->fileIds[file] = session->nextFile++;
+}
+
+static Session session;
+
+/*
+ * Fills a transaction that creates a file, moves it to another directory
+ * and deletes it, so that, committed, it leaves nothing behind. One in four
+ * looks the file up after deleting it, which fails and rolls back the whole
+ * transaction; the next transaction creates its file at the same path,
+ * which fails unless the rollback undid the create.
+ */
+static void fillTransaction (Outstanding *request, TfsRequest *ops) {
+    if (session.rolledBack[0] != '\0') {
+        strcpy(request->path, session.rolledBack);
+        session.rolledBack[0] = '\0';
+    }
+    else
+        snprintf(request->path, MAX_FILE_NAME, "%s/x%d-%d", dirs[next_random(&session) % numDirs],
+            session.pid, session.nextFile++);
+    snprintf(request->dest, MAX_FILE_NAME, "%s/x%d-%d", dirs[next_random(&session) % numDirs],
+        session.pid, session.nextFile++);
+    request->rollback = next_random(&session) % 4 == 0;
+
+    memset(ops, 0, sizeof(TfsRequest) * TX_OPS);
+    ops[0].opcode = TFS_OP_CREATE;
+    strcpy(ops[0].args[0], request->path);
+    ops[1].opcode = TFS_OP_MOVE;
+    strcpy(ops[1].args[0], request->path);
+    strcpy(ops[1].args[1], request->dest);
+    ops[request->rollback ? 3 : 2].opcode = TFS_OP_LOOKUP;
+    ops[request->rollback ? 2 : 3].opcode = TFS_OP_DELETE;
+    strcpy(ops[2].args[0], request->dest);
+    strcpy(ops[3].args[0], request->dest);
+}
+
+/* records the result of a request of the session */
+static void requestDone (int result, void *ctx) {
+    Outstanding *request = ctx;
+
+    tfs_hist_record(&session.stats->latencies[request->opcode], now_ns() - request->start);
+    if (request->opcode == TFS_OP_BATCH) {
+        /* a transaction fails only if its result is not the expected one */
+        if (request->rollback && result == TECNICOFS_ERROR_FILE_NOT_FOUND)
+            strcpy(session.rolledBack, request->path);
+        else if (request->rollback || result != SUCCESS)
+            session.stats->errors[request->opcode]++;
+    }
+    else if (result < 0)
+        session.stats->errors[request->opcode]++;
+}
+
+/* return whether the session sent every request it had to */
+static int finished () {
+    if (opsPerSession > 0)
+        return session.submitted >= opsPerSession;
+    return now_ns() >= session.deadline;
+}
+
+/*
+ * Sends a request of the mix. Deletes and moves take a file the session
+ * created (a create is sent if it has none); transactions use files of
+ * their own (see fillTransaction).
+ * Input:
+ *  - start: time its latency counts from
+ *  - callback: completion callback
+ */
+static void submitRequest (uint64_t start, tfsCallback callback) {
+    int index = session.submitted++ % (2 * TFS_MAX_WINDOW);
+    Outstanding *request = &session.outstanding[index];
+    int pick = next_random(&session) % mixTotal, opcode, file, result;
+
+    for (opcode = 0; pick >= mix[opcode]; opcode++)
+        pick -= mix[opcode];
+    if ((opcode == TFS_OP_DELETE || opcode == TFS_OP_MOVE) && session.numFiles == 0)
+        opcode = TFS_OP_CREATE;
+    request->opcode = opcode;
+    request->start = start;
+
+    switch (opcode) {
+        case TFS_OP_CREATE:
+            if (session.numFiles == session.maxFiles) {
+                session.maxFiles = session.maxFiles ? 2 * session.maxFiles : 1024;
+                session.fileDirs = realloc(session.fileDirs, session.maxFiles * sizeof(int));
+                session.fileIds = realloc(session.fileIds, session.maxFiles * sizeof(int));
+            }
+            file = session.numFiles++;
+            newFile(&session, file);
+            filePath(&session, file, request->path);
+            result = tfsCreateAsync(request->path, 'f', callback, request);
+            break;
+        case TFS_OP_DELETE:
+            file = next_random(&session) % session.numFiles;
+            filePath(&session, file, request->path);
+            session.numFiles--;
+            session.fileDirs[file] = session.fileDirs[session.numFiles];
+            session.fileIds[file] = session.fileIds[session.numFiles];
+            result = tfsDeleteAsync(request->path, callback, request);
+            break;
+        case TFS_OP_MOVE:
+            file = next_random(&session) % session.numFiles;
+            filePath(&session, file, request->path);
+            newFile(&session, file);
+            filePath(&session, file, request->dest);
+            result = tfsMoveAsync(request->path, request->dest, callback, request);
+            break;
+        case TFS_OP_BATCH:
+            fillTransaction(request, session.txOps[index]);
+            result = tfsTransactionAsync(session.txOps[index], TX_OPS, request->results, callback, request);
+            break;
+        default:
+            lookupPath(&session, request->path);
+            result = tfsLookupAsync(request->path, callback, request);
+    }
+    if (result < 0)
+        callback(result, request);
+}
+
+/* records a request and sends the next one, keeping depth in flight */
+static void closedLoopDone (int result, void *ctx) {
+    requestDone(result, ctx);
+    if (!finished())
+        submitRequest(now_ns(), closedLoopDone);
+}
+
+/* sends requests at the rate of the session, whatever their latency */
+static void runOpenLoop () {
+    uint64_t interval = (uint64_t) (1e9 * numSessions / rate), next = session.stats->start, now;
+
+    while (!finished()) {
+        now = now_ns();
+        while (next <= now && !finished()) {
+            submitRequest(next, requestDone);
+            next += interval;
+        }
+        tfsPoll();
+
+        now = now_ns();
+        if (next > now) {
+            uint64_t sleep = next - now < POLL_INTERVAL ? next - now : POLL_INTERVAL;
+            struct timespec ts = { 0, (long) sleep };
+            nanosleep(&ts, NULL);
+        }
+    }
+    tfsWait();
+}
+
+/* runs a session, once the start pipe is closed */
+static void runSession (int id, SessionStats *stats, int ready, int start) {
+    char server_socket_path[MAX_SOCKET_PATH], client_socket_path[MAX_SOCKET_PATH], byte = 0;
+
+    session.pid = getpid();
+    session.stats = stats;
+    session.random = 0x9E3779B97F4A7C15ULL * (id + 1);
+    for (int i = 0; i < TFS_OP_MAX; i++)
+        tfs_hist_init(&stats->latencies[i]);
+    if (mix[TFS_OP_BATCH] > 0 &&
+            (session.txOps = malloc(2 * TFS_MAX_WINDOW * sizeof(*session.txOps))) == NULL)
+        exit(EXIT_FAILURE);
+
+    if (strcmp(serverName, TFS_INPROCESS_TARGET) == 0)
+        strcpy(server_socket_path, serverName);
+    else
+        sprintf(server_socket_path, "%s%s", tmp_dir, serverName);
+    sprintf(client_socket_path, "%s%s%d", tmp_dir, "loadgen", getpid());
+    if (tfsMount(server_socket_path, client_socket_path) != SUCCESS)
+        stats->failed = 1;
+    else if (strcmp(serverName, TFS_INPROCESS_TARGET) == 0)
+        populate();
+
+    if (write(ready, &byte, 1) != 1 || read(start, &byte, 1) != 0 || stats->failed)
+        exit(EXIT_FAILURE);
+
+    /* sleeps between polls end close to when they are due */
+    prctl(PR_SET_TIMERSLACK, 1000);
+    stats->start = now_ns();
+    session.deadline = stats->start + (uint64_t) (duration * 1e9);
+    if (rate > 0)
+        runOpenLoop();
+    else {
+        for (int i = 0; i < depth && !finished(); i++)
+            submitRequest(now_ns(), closedLoopDone);
+        tfsWait();
+    }
+    stats->end = now_ns();
+
+    tfsUnmount(client_socket_path);
+    exit(EXIT_SUCCESS);
+}
+
+/* prints the results of an operation (or of all, without opcode) */
+static void printResults (const char *name, TfsHistogram *hist, uint64_t errors, double seconds, int first) {
+    double mean = tfs_hist_mean(hist) / 1000, p50 = tfs_hist_percentile(hist, 50) / 1000.0;
+    double p99 = tfs_hist_percentile(hist, 99) / 1000.0, p999 = tfs_hist_percentile(hist, 99.9) / 1000.0;
+    double max = hist->max / 1000.0, throughput = seconds > 0 ? hist->count / seconds : 0;
+
+    if (json)
+        printf("%s    \"%s\": {\"count\": %lu, \"errors\": %lu, \"throughput\": %.1f, \"mean_us\": %.2f, "
+            "\"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f}", first ? "" : ",\n",
+            name, hist->count, errors, throughput, mean, p50, p99, p999, max);
+    else
+        printf("%s,%lu,%lu,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+            name, hist->count, errors, throughput, mean, p50, p99, p999, max);
+}
+
+/* merges the results of the sessions and prints them */
+static void report (SessionStats *stats) {
+    static TfsHistogram ops[TFS_OP_MAX], all;
+    uint64_t errors[TFS_OP_MAX] = { 0 }, allErrors = 0, start = stats[0].start, end = stats[0].end;
+    double seconds;
+    int first = 1;
+
+    for (int i = 0; i < TFS_OP_MAX; i++)
+        tfs_hist_init(&ops[i]);
+    tfs_hist_init(&all);
+    for (int s = 0; s < numSessions; s++) {
+        for (int i = 0; i < TFS_OP_MAX; i++) {
+            tfs_hist_merge(&ops[i], &stats[s].latencies[i]);
+            tfs_hist_merge(&all, &stats[s].latencies[i]);
+            errors[i] += stats[s].errors[i];
+            allErrors += stats[s].errors[i];
+        }
+        if (stats[s].start < start)
+            start = stats[s].start;
+        if (stats[s].end > end)
+            end = stats[s].end;
+    }
+    seconds = (end - start) / 1e9;
+
+    if (json)
+        printf("{\n  \"sessions\": %d,\n  \"mode\": \"%s\",\n  \"seconds\": %.3f,\n  \"ops\": {\n",
+            numSessions, rate > 0 ? "open" : "closed", seconds);
+    else
+        printf("op,count,errors,throughput,mean_us,p50_us,p99_us,p999_us,max_us\n");
+    for (int i = 0; i < TFS_OP_MAX; i++)
+        if (mix[i] > 0) {
+            printResults(opNames[i], &ops[i], errors[i], seconds, first);
+            first = 0;
+        }
+    printResults("all", &all, allErrors, seconds, first);
+    if (json)
+        printf("\n  }\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+    char client_socket_path[MAX_SOCKET_PATH], server_socket_path[MAX_SOCKET_PATH], byte;
+    int ready[2], start[2], failed = 0, status;
+    SessionStats *stats;
+
+    parseArgs(argc, argv);
+    buildNamespace();
+
+    /* the namespace is created once in a server, by a mount of its own */
+    if (strcmp(serverName, TFS_INPROCESS_TARGET) != 0) {
+        sprintf(server_socket_path, "%s%s", tmp_dir, serverName);
+        sprintf(client_socket_path, "%s%s%d", tmp_dir, "loadgen", getpid());
+        if (tfsMount(server_socket_path, client_socket_path) != SUCCESS) {
+            fprintf(stderr, "Unable to mount socket: %s\n", serverName);
+            exit(EXIT_FAILURE);
+        }
+        populate();
+        tfsUnmount(client_socket_path);
+    }
+
+    stats = mmap(NULL, numSessions * sizeof(SessionStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED || pipe(ready) != 0 || pipe(start) != 0) {
+        fprintf(stderr, "Error: can't create the sessions\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < numSessions; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(ready[0]);
+            close(start[1]);
+            runSession(i, &stats[i], ready[1], start[0]);
+        }
+        if (pid < 0) {
+            fprintf(stderr, "Error: can't create the sessions\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    close(ready[1]);
+    close(start[0]);
+
+    /* every session mounted before any starts */
+    for (int i = 0; i < numSessions; i++)
+        if (read(ready[0], &byte, 1) != 1)
+            break;
+    close(start[1]);
+
+    for (int i = 0; i < numSessions; i++)
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            failed = 1;
+    if (failed) {
+        fprintf(stderr, "Error: a session failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    report(stats);
+    exit(EXIT_SUCCESS);
+}
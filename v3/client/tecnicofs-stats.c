@@ -0,0 +1,139 @@
+/*
+ *
+ * TecnicoFS Statistics
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "tecnicofs-client-api.h"
+
+char* serverName;
+double interval = 0; /* seconds between polls, 0 to poll once */
+int json = 0;
+volatile sig_atomic_t stopped = 0;
+
+char server_socket_path[MAX_SOCKET_PATH];
+char client_socket_path[MAX_SOCKET_PATH];
+
+static void displayUsage (const char* appName) {
+    printf("Usage: %s [-i seconds] [-o csv|json] server_socket_name\n", appName);
+    printf("  -i seconds  poll the server every interval until interrupted\n");
+    printf("  -o format   csv (default) or json\n");
+    exit(EXIT_FAILURE);
+}
+
+static void parseArgs (long argc, char* const argv[]) {
+    int option;
+
+    while ((option = getopt(argc, argv, "i:o:")) != -1) {
+        switch (option) {
+            case 'i':
+                interval = atof(optarg);
+                if (interval <= 0) {
+                    fprintf(stderr, "Error: interval must be positive\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'o':
+                if (strcmp(optarg, "json") == 0)
+                    json = 1;
+                else if (strcmp(optarg, "csv") != 0)
+                    displayUsage(argv[0]);
+                break;
+            default:
+                displayUsage(argv[0]);
+        }
+    }
+
+    if (argc - optind != 1) {
+        fprintf(stderr, "Invalid format:\n");
+        displayUsage(argv[0]);
+    }
+    serverName = argv[optind];
+}
+
+/*
+ * Prints the statistics of a poll, with the rate of requests since the
+ * previous one (or since the server started).
+ */
+static void printStats (TfsStats *stats, TfsStats *previous) {
+    double seconds = (stats->uptime - previous->uptime) / 1e9;
+    int first = 1;
+
+    if (json)
+        printf("{\"uptime\": %.3f, \"threads\": %lu, \"queue_depth\": %lu, \"queue_max_depth\": %lu, \"ops\": {",
+            stats->uptime / 1e9, stats->threads, stats->queue_depth, stats->queue_max_depth);
+
+    for (int opcode = 0; opcode < TFS_OP_MAX; opcode++) {
+        TfsOpStats *op = &stats->ops[opcode];
+        double rate = seconds > 0 ? (op->count - previous->ops[opcode].count) / seconds : 0;
+
+        if (op->count == 0)
+            continue;
+        if (json)
+            printf("%s\"%s\": {\"count\": %lu, \"errors\": %lu, \"ops_per_s\": %.1f, \"p50_us\": %.2f, "
+                "\"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f, \"wait_mean_us\": %.2f, "
+                "\"wait_p99_us\": %.2f, \"work_mean_us\": %.2f, \"work_p99_us\": %.2f}", first ? "" : ", ",
+                tfs_op_name(opcode), op->count, op->errors, rate, op->latency_p50 / 1e3, op->latency_p99 / 1e3,
+                op->latency_p999 / 1e3, op->latency_max / 1e3, op->wait_mean / 1e3, op->wait_p99 / 1e3,
+                op->work_mean / 1e3, op->work_p99 / 1e3);
+        else
+            printf("%.3f,%s,%lu,%lu,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%lu,%lu\n",
+                stats->uptime / 1e9, tfs_op_name(opcode), op->count, op->errors, rate,
+                op->latency_p50 / 1e3, op->latency_p99 / 1e3, op->latency_p999 / 1e3, op->latency_max / 1e3,
+                op->wait_mean / 1e3, op->wait_p99 / 1e3, op->work_mean / 1e3, op->work_p99 / 1e3,
+                stats->queue_depth, stats->queue_max_depth);
+        first = 0;
+    }
+    if (json)
+        printf("}}\n");
+    fflush(stdout);
+}
+
+/* stops polling, so the client socket is unlinked */
+static void stop (int signal) {
+    stopped = 1;
+}
+
+int main(int argc, char* argv[]) {
+    TfsStats stats, previous;
+    int result;
+
+    parseArgs(argc, argv);
+    sprintf(server_socket_path, "%s%s", tmp_dir, serverName);
+    sprintf(client_socket_path, "%s%s%d", tmp_dir, "stats", getpid());
+    if (tfsMount(server_socket_path, client_socket_path) != SUCCESS) {
+        fprintf(stderr, "Unable to mount socket: %s\n", serverName);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!json)
+        printf("uptime,op,count,errors,ops_per_s,p50_us,p99_us,p999_us,max_us,"
+            "wait_mean_us,wait_p99_us,work_mean_us,work_p99_us,queue_depth,queue_max_depth\n");
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    memset(&previous, 0, sizeof(previous));
+    while ((result = tfsStats(&stats)) == SUCCESS) {
+        printStats(&stats, &previous);
+        if (interval == 0 || stopped)
+            break;
+        previous = stats;
+
+        struct timespec ts = { (time_t) interval, (long) ((interval - (time_t) interval) * 1e9) };
+        nanosleep(&ts, NULL);
+        if (stopped)
+            break;
+    }
+
+    tfsUnmount(client_socket_path);
+    if (result != SUCCESS) {
+        fprintf(stderr, "Error: the server didn't answer the statistics (%d)\n", result);
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
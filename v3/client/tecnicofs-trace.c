@@ -0,0 +1,208 @@
+/*
+ *
+ * TecnicoFS Trace
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../tecnicofs-trace.h"
+#include "../tecnicofs-protocol.h"
+
+/* Locks a thread holds at once (every component of two paths, with room) */
+#define MAX_HELD 256
+
+char* traceName;
+char* outputName = NULL;
+long requestFilter = -1; /* request whose events are converted, -1 for all */
+
+FILE* output;
+int numOutput = 0;
+unsigned long nextHold = 1;
+
+/* Lock held by a thread, drawn as an asynchronous slice from its acquisition */
+typedef struct {
+    int64_t inumber;
+    unsigned long id;
+    int mode;
+} HeldLock;
+
+static void displayUsage (const char* appName) {
+    printf("Usage: %s [-r request_id] tracefile [outputfile]\n", appName);
+    printf("Converts a trace written by the server ('t file') to the Chrome trace event\n");
+    printf("format (chrome://tracing, Perfetto), written to outputfile or the standard output.\n");
+    printf("  -r id  only the events of the requests with this id\n");
+    exit(EXIT_FAILURE);
+}
+
+static void parseArgs (long argc, char* const argv[]) {
+    int option;
+
+    while ((option = getopt(argc, argv, "r:")) != -1) {
+        switch (option) {
+            case 'r':
+                requestFilter = atol(optarg);
+                break;
+            default:
+                displayUsage(argv[0]);
+        }
+    }
+
+    if (argc - optind != 1 && argc - optind != 2) {
+        fprintf(stderr, "Invalid format:\n");
+        displayUsage(argv[0]);
+    }
+    traceName = argv[optind];
+    if (argc - optind == 2)
+        outputName = argv[optind + 1];
+}
+
+/* return name of the operation of an event (text commands have none) */
+static const char* opName (TfsTraceEvent *event) {
+    return event->opcode == 0 ? "command" : tfs_op_name(event->opcode);
+}
+
+/* starts a trace event, with its fields common to every event */
+static void beginEvent (const char* phase, TfsTraceEvent *event, uint64_t start, uint32_t thread) {
+    fprintf(output, "%s{\"ph\": \"%s\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f", numOutput++ ? ",\n" : "",
+        phase, thread, (event->time - start) / 1e3);
+}
+
+/*
+ * Converts the events of a thread: requests are slices, lock waits are
+ * slices inside them, locks held are asynchronous slices (they overlap
+ * without nesting) and the messages are instant events.
+ */
+static void convertThread (TfsTraceEvent *events, int num, uint64_t start, uint32_t thread) {
+    HeldLock held[MAX_HELD];
+    TfsTraceEvent *request = NULL; /* lock requested and not yet acquired */
+    int numHeld = 0, inRequest = 0;
+
+    for (int i = 0; i < num; i++) {
+        TfsTraceEvent *event = &events[i];
+        const char* mode = event->mode == TFS_TRACE_WRITE ? "write" : "read";
+
+        if (requestFilter >= 0 && event->request_id != requestFilter)
+            continue;
+        switch (event->type) {
+            case TFS_TRACE_RECEIVED:
+            case TFS_TRACE_SENT:
+                beginEvent("i", event, start, thread);
+                fprintf(output, ", \"s\": \"t\", \"name\": \"%s %s\", \"args\": {\"request_id\": %u",
+                    event->type == TFS_TRACE_RECEIVED ? "received" : "sent", opName(event), event->request_id);
+                if (event->type == TFS_TRACE_SENT)
+                    fprintf(output, ", \"result\": %d", event->result);
+                fprintf(output, "}}");
+                break;
+            case TFS_TRACE_BEGIN:
+                beginEvent("B", event, start, thread);
+                fprintf(output, ", \"name\": \"%s\", \"args\": {\"request_id\": %u}}", opName(event), event->request_id);
+                inRequest = 1;
+                break;
+            case TFS_TRACE_END:
+                /* its start may have been overwritten */
+                if (!inRequest)
+                    break;
+                beginEvent("E", event, start, thread);
+                fprintf(output, ", \"args\": {\"result\": %d}}", event->result);
+                inRequest = 0;
+                break;
+            case TFS_TRACE_LOCK_REQUEST:
+                request = event;
+                break;
+            case TFS_TRACE_LOCK_ACQUIRED:
+                if (request != NULL && request->inumber == event->inumber) {
+                    beginEvent("X", request, start, thread);
+                    fprintf(output, ", \"dur\": %.3f, \"name\": \"wait i-node %ld (%s)\", \"cat\": \"wait\"}",
+                        (event->time - request->time) / 1e3, event->inumber, mode);
+                }
+                request = NULL;
+                if (numHeld == MAX_HELD)
+                    break;
+                held[numHeld].inumber = event->inumber;
+                held[numHeld].id = nextHold++;
+                held[numHeld].mode = event->mode;
+                beginEvent("b", event, start, thread);
+                fprintf(output, ", \"id\": %lu, \"name\": \"i-node %ld\", \"cat\": \"lock\", "
+                    "\"args\": {\"mode\": \"%s\", \"request_id\": %u}}",
+                    held[numHeld].id, event->inumber, mode, event->request_id);
+                numHeld++;
+                break;
+            case TFS_TRACE_LOCK_RELEASED:
+                /* its acquisition may have been overwritten */
+                for (int j = numHeld - 1; j >= 0; j--) {
+                    if (held[j].inumber != event->inumber)
+                        continue;
+                    beginEvent("e", event, start, thread);
+                    fprintf(output, ", \"id\": %lu, \"name\": \"i-node %ld\", \"cat\": \"lock\"}",
+                        held[j].id, event->inumber);
+                    held[j] = held[--numHeld];
+                    break;
+                }
+                break;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    TfsTraceHeader header;
+    TfsTraceThread *threads;
+    TfsTraceEvent **events;
+    uint64_t start = UINT64_MAX;
+    FILE* input;
+
+    parseArgs(argc, argv);
+    if ((input = fopen(traceName, "r")) == NULL) {
+        fprintf(stderr, "Error: cannot open trace file\n");
+        exit(EXIT_FAILURE);
+    }
+    if (fread(&header, sizeof(header), 1, input) != 1 || header.magic != TFS_TRACE_MAGIC ||
+            header.version != TFS_TRACE_VERSION) {
+        fprintf(stderr, "Error: %s isn't a trace of this version\n", traceName);
+        exit(EXIT_FAILURE);
+    }
+
+    /* events are read first, to start the timeline at the earliest */
+    threads = (TfsTraceThread*) malloc(sizeof(TfsTraceThread) * (header.num_threads + 1));
+    events = (TfsTraceEvent**) malloc(sizeof(TfsTraceEvent*) * (header.num_threads + 1));
+    if (threads == NULL || events == NULL) {
+        fprintf(stderr, "Error: no memory for the trace\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < header.num_threads; i++) {
+        if (fread(&threads[i], sizeof(TfsTraceThread), 1, input) != 1 ||
+                (events[i] = (TfsTraceEvent*) malloc(sizeof(TfsTraceEvent) * (threads[i].num_events + 1))) == NULL ||
+                fread(events[i], sizeof(TfsTraceEvent), threads[i].num_events, input) != threads[i].num_events) {
+            fprintf(stderr, "Error: %s is truncated\n", traceName);
+            exit(EXIT_FAILURE);
+        }
+        if (threads[i].num_events > 0 && events[i][0].time < start)
+            start = events[i][0].time;
+    }
+    fclose(input);
+
+    if (outputName == NULL)
+        output = stdout;
+    else if ((output = fopen(outputName, "w")) == NULL) {
+        fprintf(stderr, "Error: cannot open output file\n");
+        exit(EXIT_FAILURE);
+    }
+    fprintf(output, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    for (int i = 0; i < header.num_threads; i++) {
+        fprintf(output, "%s{\"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"name\": \"thread_name\", "
+            "\"args\": {\"name\": \"thread %u\"}}", numOutput++ ? ",\n" : "", threads[i].thread, threads[i].thread);
+        convertThread(events[i], threads[i].num_events, start, threads[i].thread);
+        free(events[i]);
+    }
+    fprintf(output, "\n]}\n");
+    free(threads);
+    free(events);
+
+    if (output != stdout && fclose(output) != 0) {
+        fprintf(stderr, "Error: cannot close output file\n");
+        exit(EXIT_FAILURE);
+    }
+    exit(EXIT_SUCCESS);
+}
@@ -1,6 +1,11 @@
 #! /bin/bash
 
+# usage: ./runTests.sh inputdir outputdir maxthreads
+# runs each input file with a server of 1 to maxthreads threads, saving the
+# output of the client and printing the running time of the server
+
 files=($(ls -p $1| grep -v /))
+socket=runtests$$
 
 mkdir -p "${2}"
 
@@ -9,6 +14,14 @@ do
     for ((thrds = 1; thrds <= $3; thrds++))
     do
     echo InputFile="$fl" NumThreads=$thrds
-    ./tecnicofs "$1/$fl" "$2/${fl%.*}-$thrds.txt" $thrds | grep 'TecnicoFS completed in'
+    server/tecnicofs-server $thrds $socket > "$2/${fl%.*}-$thrds.server.txt" &
+    pid=$!
+    # wait for the server socket
+    while ! [ -S /tmp/so-2020-2021-ex3-023-$socket ] && kill -0 $pid 2> /dev/null; do sleep 0.1; done
+    client/tecnicofs-client "$1/$fl" $socket > "$2/${fl%.*}-$thrds.txt"
+    kill -INT $pid
+    wait $pid
+    grep 'TecnicoFS completed in' "$2/${fl%.*}-$thrds.server.txt"
+    rm -f "$2/${fl%.*}-$thrds.server.txt"
     done
-done
\ No newline at end of file
+done
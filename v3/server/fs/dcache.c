@@ -0,0 +1,281 @@
+/*
+ * Dentry cache: maps full paths to inumbers, including paths that don't
+ * exist (negative entries).
+ *
+ * Writers invalidate the paths they change while holding the i-node locks
+ * of the change, once it is done: create and delete invalidate their own
+ * path, move (which changes the paths of a whole subtree) invalidates the
+ * subtrees of its source and destination, before and after the change.
+ * Every path prefix has a generation (in a table indexed by its hash, so
+ * prefixes may share one), incremented to invalidate its subtree, and the
+ * root prefix is the global epoch. An entry records the sum of the
+ * generations of its prefixes, which only grows, and is valid while it is
+ * the same. Resolutions are inserted only if nothing was invalidated in
+ * their bucket, and no prefix of their path changed, since they started,
+ * so neither resolutions made with locks nor lockless ones can insert a
+ * path changed meanwhile.
+ */
+
+#include <string.h>
+#include "dcache.h"
+
+static DcacheBucket * dcache;
+static int num_buckets; /* power of two */
+static unsigned int * prefix_gens;
+static int num_prefix_gens; /* power of two */
+static unsigned int dcache_epoch;
+static unsigned long subtree_invalidations;
+
+/*
+ * Initializes the dentry cache.
+ * Input:
+ *  - entries: number of entries (rounded up to a power of two)
+ */
+void dcache_init(int entries) {
+	for (num_buckets = 1; num_buckets * DCACHE_WAYS < entries; num_buckets *= 2) {}
+	num_prefix_gens = num_buckets * DCACHE_WAYS;
+
+	dcache = (DcacheBucket*) calloc(num_buckets, sizeof(DcacheBucket));
+	prefix_gens = (unsigned int*) calloc(num_prefix_gens, sizeof(unsigned int));
+	if (!dcache || !prefix_gens) {
+		fprintf(stderr, "Error: couldn't allocate memory for dentry cache.\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < num_buckets; i++)
+		mutex_init(&dcache[i].lock);
+	dcache_epoch = 0;
+	subtree_invalidations = 0;
+}
+
+/*
+ * Destroys the dentry cache.
+ */
+void dcache_destroy() {
+	for (int i = 0; i < num_buckets; i++)
+		mutex_destroy(&dcache[i].lock);
+	free(dcache);
+	free(prefix_gens);
+}
+
+/*
+ * Normalizes a path: path components separated by a single '/', without
+ * leading or trailing slashes (root is the empty path).
+ * Input:
+ *  - path: path to normalize
+ *  - normalized: buffer of size MAX_FILE_NAME
+ */
+static void dcache_normalize(char *path, char *normalized) {
+	int len = 0;
+
+	for (char *c = path; *c && len < MAX_FILE_NAME - 1; c++) {
+		if (*c == '/' && (len == 0 || normalized[len - 1] == '/'))
+			continue;
+		normalized[len++] = *c;
+	}
+	if (len > 0 && normalized[len - 1] == '/')
+		len--;
+	normalized[len] = '\0';
+}
+
+static DcacheBucket * dcache_bucket(unsigned int hash) {
+	return &dcache[hash & (num_buckets - 1)];
+}
+
+/*
+ * Sums the generations of the prefixes of a normalized path, the path
+ * itself and the root included. The hash of a prefix is the hash of the
+ * path (dir_name_hash) up to its end.
+ */
+static unsigned int dcache_prefix_gens(char *path) {
+	unsigned int hash = 2166136261u, gens = __atomic_load_n(&dcache_epoch, __ATOMIC_ACQUIRE);
+
+	for (char *c = path; ; c++) {
+		if ((*c == '/' || *c == '\0') && c != path)
+			gens += __atomic_load_n(&prefix_gens[hash & (num_prefix_gens - 1)], __ATOMIC_ACQUIRE);
+		if (*c == '\0')
+			return gens;
+		hash ^= (unsigned char) *c;
+		hash *= 16777619u;
+	}
+}
+
+/*
+ * Finds a valid entry of a path in a bucket locked by the caller.
+ * Input:
+ *  - gens: current generations of the prefixes of the path
+ * Returns: entry or NULL
+ */
+static DcacheEntry * dcache_find(DcacheBucket *bucket, char *path, unsigned int hash, unsigned int gens) {
+	for (int i = 0; i < DCACHE_WAYS; i++) {
+		DcacheEntry *entry = &bucket->entries[i];
+		if (entry->valid && entry->hash == hash && strcmp(entry->path, path) == 0) {
+			if (entry->gens == gens)
+				return entry;
+			entry->valid = 0;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Prepares the key of a path, recording the current state of the cache.
+ * Must be called before resolving the path with lookup_node.
+ * Input:
+ *  - path: path to resolve
+ *  - key: key to fill
+ */
+void dcache_prepare(char *path, DcacheKey *key) {
+	DcacheBucket *bucket;
+
+	dcache_normalize(path, key->path);
+	key->hash = dir_name_hash(key->path);
+	bucket = dcache_bucket(key->hash);
+
+	mutex_lock(&bucket->lock);
+	key->gen = bucket->gen;
+	mutex_unlock(&bucket->lock);
+	key->gens = dcache_prefix_gens(key->path);
+}
+
+/*
+ * Looks for a path in the cache.
+ * Input:
+ *  - key: key prepared by dcache_prepare
+ *  - inumber: pointer to store the cached inumber (FAIL if negative)
+ * Returns: DCACHE_HIT, DCACHE_NEGATIVE or DCACHE_MISS
+ */
+int dcache_get(DcacheKey *key, int *inumber) {
+	DcacheBucket *bucket = dcache_bucket(key->hash);
+	unsigned int gens = dcache_prefix_gens(key->path);
+	DcacheEntry *entry;
+	int result = DCACHE_MISS;
+
+	mutex_lock(&bucket->lock);
+	if ((entry = dcache_find(bucket, key->path, key->hash, gens)) != NULL) {
+		*inumber = entry->inumber;
+		if (entry->inumber == FAIL) {
+			result = DCACHE_NEGATIVE;
+			bucket->negative_hits++;
+		}
+		else {
+			result = DCACHE_HIT;
+			bucket->hits++;
+		}
+	}
+	else
+		bucket->misses++;
+	mutex_unlock(&bucket->lock);
+	return result;
+}
+
+/*
+ * Inserts the resolution of a path, unless it was invalidated since
+ * dcache_prepare.
+ * Must be called while holding the i-node locks taken to resolve it, or
+ * after validating a lockless resolution.
+ * Input:
+ *  - key: key prepared by dcache_prepare
+ *  - inumber: resolved inumber, FAIL if the path doesn't exist
+ */
+void dcache_put(DcacheKey *key, int inumber) {
+	DcacheBucket *bucket = dcache_bucket(key->hash);
+	DcacheEntry *entry;
+
+	mutex_lock(&bucket->lock);
+	if (bucket->gen != key->gen || dcache_prefix_gens(key->path) != key->gens) {
+		mutex_unlock(&bucket->lock);
+		return;
+	}
+
+	if ((entry = dcache_find(bucket, key->path, key->hash, key->gens)) == NULL) {
+		for (int i = 0; i < DCACHE_WAYS && entry == NULL; i++)
+			if (!bucket->entries[i].valid)
+				entry = &bucket->entries[i];
+		if (entry == NULL) {
+			entry = &bucket->entries[bucket->next_victim];
+			bucket->next_victim = (bucket->next_victim + 1) % DCACHE_WAYS;
+		}
+	}
+
+	strcpy(entry->path, key->path);
+	entry->hash = key->hash;
+	entry->inumber = inumber;
+	entry->gens = key->gens;
+	entry->valid = 1;
+	mutex_unlock(&bucket->lock);
+}
+
+/*
+ * Invalidates the entry of a path (created or deleted).
+ * Must be called after the change, while holding the write lock of its
+ * parent.
+ * Input:
+ *  - path: path to invalidate
+ */
+void dcache_invalidate(char *path) {
+	char normalized[MAX_FILE_NAME];
+	unsigned int hash;
+	DcacheBucket *bucket;
+	DcacheEntry *entry;
+
+	dcache_normalize(path, normalized);
+	hash = dir_name_hash(normalized);
+	bucket = dcache_bucket(hash);
+
+	mutex_lock(&bucket->lock);
+	bucket->gen++;
+	bucket->invalidations++;
+	for (int i = 0; i < DCACHE_WAYS; i++) {
+		entry = &bucket->entries[i];
+		if (entry->valid && entry->hash == hash && strcmp(entry->path, normalized) == 0)
+			entry->valid = 0;
+	}
+	mutex_unlock(&bucket->lock);
+}
+
+/*
+ * Invalidates the entries of a path and of every path below it (a moved
+ * subtree, or the destination it is moved to).
+ * Must be called before and after the change, while holding its locks.
+ * Input:
+ *  - path: root of the subtree
+ */
+void dcache_invalidate_subtree(char *path) {
+	char normalized[MAX_FILE_NAME];
+
+	dcache_normalize(path, normalized);
+	if (normalized[0] == '\0') {
+		dcache_invalidate_all();
+		return;
+	}
+	__atomic_add_fetch(&prefix_gens[dir_name_hash(normalized) & (num_prefix_gens - 1)], 1, __ATOMIC_ACQ_REL);
+	__atomic_add_fetch(&subtree_invalidations, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Invalidates every entry (the subtree of the root).
+ * Must be called before and after changing the tree, while holding its
+ * locks.
+ */
+void dcache_invalidate_all() {
+	__atomic_add_fetch(&dcache_epoch, 1, __ATOMIC_ACQ_REL);
+}
+
+/*
+ * Sums the statistics of every bucket.
+ * Input:
+ *  - stats: pointer to store the statistics
+ */
+void dcache_get_stats(DcacheStats *stats) {
+	memset(stats, 0, sizeof(DcacheStats));
+	for (int i = 0; i < num_buckets; i++) {
+		mutex_lock(&dcache[i].lock);
+		stats->hits += dcache[i].hits;
+		stats->negative_hits += dcache[i].negative_hits;
+		stats->misses += dcache[i].misses;
+		stats->invalidations += dcache[i].invalidations;
+		mutex_unlock(&dcache[i].lock);
+	}
+	stats->invalidations += __atomic_load_n(&dcache_epoch, __ATOMIC_ACQUIRE) +
+		__atomic_load_n(&subtree_invalidations, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,63 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include "state.h"
+#include "../locks/mutex.h"
+
+/* Number of entries per bucket */
+#define DCACHE_WAYS 4
+/* Entries of the dentry cache unless set: one per i-node of the table, up
+ * to this many */
+#define DCACHE_DEFAULT_MAX_ENTRIES (1 << 17)
+
+/* Results of a dentry cache probe */
+#define DCACHE_MISS 0
+#define DCACHE_HIT 1
+#define DCACHE_NEGATIVE 2
+
+/*
+ * Cached path resolution. Negative entries have inumber FAIL.
+ */
+typedef struct dcacheEntry {
+	char path[MAX_FILE_NAME];
+	unsigned int hash;
+	int inumber;
+	unsigned int gens; /* generations of its prefixes when it was resolved */
+	int valid;
+} DcacheEntry;
+
+typedef struct dcacheBucket {
+	pthread_mutex_t lock;
+	unsigned int gen; /* incremented on every invalidation in this bucket */
+	int next_victim;
+	DcacheEntry entries[DCACHE_WAYS];
+	/* statistics, protected by lock */
+	unsigned long hits, negative_hits, misses, invalidations;
+} DcacheBucket;
+
+/*
+ * Normalized path and the cache state observed before resolving it.
+ * Only resolutions started after the last invalidation get inserted.
+ */
+typedef struct dcacheKey {
+	char path[MAX_FILE_NAME];
+	unsigned int hash;
+	unsigned int gen;
+	unsigned int gens;
+} DcacheKey;
+
+typedef struct dcacheStats {
+	unsigned long hits, negative_hits, misses, invalidations;
+} DcacheStats;
+
+void dcache_init(int);
+void dcache_destroy();
+void dcache_prepare(char*, DcacheKey*);
+int dcache_get(DcacheKey*, int*);
+void dcache_put(DcacheKey*, int);
+void dcache_invalidate(char*);
+void dcache_invalidate_subtree(char*);
+void dcache_invalidate_all();
+void dcache_get_stats(DcacheStats*);
+
+#endif /* DCACHE_H */
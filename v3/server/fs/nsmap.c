@@ -0,0 +1,130 @@
+/*
+ * Published namespace: a copy of every directory entry in shared memory
+ * (see tecnicofs-shm.h), so clients resolve lookups without asking the
+ * server.
+ *
+ * Directories add and remove their entries here while they change them,
+ * holding the write lock of the directory. Each stripe of the table has a
+ * mutex, held while one of its entries changes, with the version of the
+ * stripe odd, so changes of different stripes don't wait for each other.
+ * Operations made of many changes (moves, transactions) open a section,
+ * which takes the mutexes of every stripe, in order, and makes the version
+ * of the table odd until its end, so they are seen as a unit. They open it
+ * once every lock they need is held, and a change takes no lock while it
+ * holds a mutex, so these are never held while waiting for an i-node lock.
+ */
+
+#include <string.h>
+#include "nsmap.h"
+
+static TfsNsWriter nsmap_writer;
+static TfsNamespace *nsmap;
+static int nsmap_memfd = -1;
+
+/* mutex of each stripe of the table, in a cache line of its own */
+typedef struct nsmapStripe {
+	pthread_mutex_t mutex;
+} __attribute__((aligned(64))) NsmapStripe;
+
+static NsmapStripe nsmap_stripes[TFS_NS_STRIPES];
+
+/* sections opened by this thread */
+static __thread int nsmap_depth;
+
+/*
+ * Publishes the namespace, which must still be empty.
+ * Input:
+ *  - size: number of slots, a power of two, at least TFS_NS_STRIPES
+ * Returns: SUCCESS or FAIL
+ */
+int nsmap_publish(int size) {
+	if (tfs_ns_create(&nsmap_writer, &nsmap_memfd, size) == FAIL) {
+		nsmap_memfd = -1;
+		return FAIL;
+	}
+	nsmap = nsmap_writer.ns;
+	for (int i = 0; i < TFS_NS_STRIPES; i++)
+		mutex_init(&nsmap_stripes[i].mutex);
+	return SUCCESS;
+}
+
+/* return descriptor of the published namespace, or -1 */
+int nsmap_fd() {
+	return nsmap_memfd;
+}
+
+/*
+ * Opens a section of changes, which clients see as a unit. Sections nest.
+ */
+void nsmap_write_begin() {
+	if (nsmap == NULL || nsmap_depth++ > 0)
+		return;
+	for (int i = 0; i < TFS_NS_STRIPES; i++)
+		mutex_lock(&nsmap_stripes[i].mutex);
+	__atomic_store_n(&nsmap->version, nsmap->version + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void nsmap_write_end() {
+	if (nsmap == NULL || --nsmap_depth > 0)
+		return;
+	__atomic_store_n(&nsmap->version, nsmap->version + 1, __ATOMIC_RELEASE);
+	for (int i = TFS_NS_STRIPES - 1; i >= 0; i--)
+		mutex_unlock(&nsmap_stripes[i].mutex);
+}
+
+/*
+ * Starts a change of an entry of a stripe, unless a section of this thread
+ * already holds every stripe.
+ */
+static void nsmap_stripe_begin(int stripe) {
+	TfsNsStripe *header = &nsmap->stripes[stripe];
+
+	if (nsmap_depth > 0)
+		return;
+	mutex_lock(&nsmap_stripes[stripe].mutex);
+	__atomic_store_n(&header->version, header->version + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void nsmap_stripe_end(int stripe) {
+	TfsNsStripe *header = &nsmap->stripes[stripe];
+
+	if (nsmap_depth > 0)
+		return;
+	__atomic_store_n(&header->version, header->version + 1, __ATOMIC_RELEASE);
+	mutex_unlock(&nsmap_stripes[stripe].mutex);
+}
+
+/*
+ * Publishes a new directory entry.
+ * Input:
+ *  - parent: i-number of the directory
+ *  - inumber: i-number of the entry
+ *  - name: name of the entry
+ */
+void nsmap_add(int parent, int inumber, char *name) {
+	int stripe;
+
+	if (nsmap == NULL)
+		return;
+	stripe = tfs_ns_stripe(parent, name);
+	nsmap_stripe_begin(stripe);
+	/* if the stripe is full, clients ask the server about missing names */
+	tfs_ns_add(&nsmap_writer, parent, name, inumber);
+	nsmap_stripe_end(stripe);
+}
+
+/*
+ * Removes a published directory entry.
+ */
+void nsmap_remove(int parent, char *name) {
+	int stripe;
+
+	if (nsmap == NULL)
+		return;
+	stripe = tfs_ns_stripe(parent, name);
+	nsmap_stripe_begin(stripe);
+	tfs_ns_remove(&nsmap_writer, parent, name);
+	nsmap_stripe_end(stripe);
+}
@@ -0,0 +1,17 @@
+#ifndef NSMAP_H
+#define NSMAP_H
+
+#include "state.h"
+#include "../../tecnicofs-shm.h"
+
+/* Default number of slots of the published namespace (power of two) */
+#define NSMAP_DEFAULT_SIZE (1 << 16)
+
+int nsmap_publish(int);
+int nsmap_fd();
+void nsmap_write_begin();
+void nsmap_write_end();
+void nsmap_add(int, int, char*);
+void nsmap_remove(int, char*);
+
+#endif /* NSMAP_H */
@@ -1,13 +1,34 @@
 #include "operations.h"
+#include "../probes.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+/* Release ancestor locks while traversing paths (hand-over-hand) */
+static bool lock_coupling = false;
+
+/* Entries of the dentry cache, 0 for the default */
+static int dcache_entries = 0;
+
+/* Most contended i-nodes listed by print_lock_profile, 0 if not profiling */
+static int lock_profile_top = 0;
+
+/* Lockless lookups attempted, and the ones that didn't fall back to locks */
+static unsigned long optimistic_attempts, optimistic_successes;
+
 /*
  * Initializes tecnicofs and creates root node.
+ * Input:
+ *  - max_inodes: maximum number of i-nodes (default if not positive)
  */
-void init_fs() {
-	inode_table_init();
+void init_fs(int max_inodes) {
+	inode_table_init(max_inodes);
+	if (dcache_entries > 0)
+		dcache_init(dcache_entries);
+	else if (inode_table_max_size() < DCACHE_DEFAULT_MAX_ENTRIES)
+		dcache_init(inode_table_max_size());
+	else
+		dcache_init(DCACHE_DEFAULT_MAX_ENTRIES);
 	
 	/* create root inode */
 	int root = generate_new_inumber();
@@ -21,28 +42,50 @@ void init_fs() {
 
 
 /*
- * Destroy tecnicofs and inode table
+ * Selects lock coupling traversal: each i-node lock is released once the
+ * lock of its child is taken, instead of at the end of the operation.
+ * Create and delete validate the parent directory once it is locked, and
+ * resolutions cached while ancestors were released are checked against
+ * the generations of their prefixes in the dentry cache, which moves
+ * increment.
+ * Input:
+ *  - enabled: true to release ancestor locks while traversing paths
  */
-void destroy_fs() {
-	inode_table_destroy();
+void set_lock_coupling(bool enabled) {
+	lock_coupling = enabled;
 }
 
 /*
- * Check if first string is a subset of second string
+ * Sets the number of entries of the dentry cache (by default one per
+ * i-node, up to DCACHE_DEFAULT_MAX_ENTRIES). Must be called before init_fs.
  * Input:
- *  - str1: first string
- *  - str2: second string
- * Returns:
- *  - true: if first string is a subset of second string
- *  - false: if first string is not a subset of second string
+ *  - entries: number of entries, rounded up to a power of two
+ */
+void set_dcache_size(int entries) {
+	dcache_entries = entries;
+}
+
+/*
+ * Starts profiling the i-node locks: acquisitions, contended acquisitions
+ * and waits of each lock, in read and write mode. Must be called before
+ * the file system is used by other threads.
+ * Input:
+ *  - top: number of i-nodes listed by print_lock_profile
+ */
+void set_lock_profile(int top) {
+	if (rwlock_profile_start(LOCK_PROFILE_SIZE) != 0) {
+		fprintf(stderr, "Error: couldn't allocate memory for lock profile.\n");
+		exit(EXIT_FAILURE);
+	}
+	lock_profile_top = top;
+}
+
+/*
+ * Destroy tecnicofs and inode table
  */
-bool check_if_subset(char * str1, char * str2){
-	bool is_subset = true;
-	for(int i = 0; i < strlen(str1); i++)
-		for(int j = 0; j < strlen(str2); j++)
-			if(str1[i] != str2[i])
-				is_subset = false;
-	return is_subset;
+void destroy_fs() {
+	inode_table_destroy();
+	dcache_destroy();
 }
 
 /* Given a path, fills pointers with strings for the parent path and child
@@ -80,31 +123,41 @@ void split_parent_child_from_path(char * path, char ** parent, char ** child) {
 
 }
 
+/* Splits a path in its components
+ * Input:
+ *  - path: the path to split. ATENTION: the function alters this parameter
+ *  - components: array of MAX_PATH_COMPONENTS pointers to store the components
+ * Returns: number of components
+ */
+int split_path_components(char * path, char ** components) {
+	char *saveptr, *component;
+	int num = 0;
+
+	for (component = strtok_r(path, "/", &saveptr); component != NULL && num < MAX_PATH_COMPONENTS;
+		component = strtok_r(NULL, "/", &saveptr))
+		components[num++] = component;
+	return num;
+}
+
 /*
- * Unlock every lock, free list and return FAIL
+ * Unlock every lock and return an error
+ * Input:
+ *  - locks: Locks pointer
+ *  - error: TECNICOFS_ERROR_* code to return
  */
-int exit_and_unlock(Locks * locks){
+int exit_and_unlock(Locks * locks, int error){
 	list_unlock_all(locks);
-	list_free(locks);
-	return FAIL;
+	return error;
 }
 
 /*
  * Checks if content of directory is not empty.
  * Input:
- *  - entries: entries of directory
+ *  - dir: directory
  * Returns: SUCCESS or FAIL
  */
-int is_dir_empty(DirEntry *dirEntries) {
-	if (dirEntries == NULL) {
-		return FAIL;
-	}
-	for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-		if (dirEntries[i].inumber != FREE_INODE) {
-			return FAIL;
-		}
-	}
-	return SUCCESS;
+int is_dir_empty(Directory *dir) {
+	return dir_is_empty(dir);
 }
 
 
@@ -112,21 +165,46 @@ int is_dir_empty(DirEntry *dirEntries) {
  * Looks for node in directory entry from name.
  * Input:
  *  - name: path of node
- *  - entries: entries of directory
+ *  - dir: directory
  * Returns:
  *  - inumber: found node's inumber
  *  - FAIL: if not found
  */
-int lookup_sub_node(char *name, DirEntry *entries) {
-	if (entries == NULL) {
-		return FAIL;
+int lookup_sub_node(char *name, Directory *dir) {
+	return dir_lookup(dir, name);
+}
+
+/*
+ * Looks up the directory where an entry is created or deleted and
+ * write-locks it.
+ * A directory found in the dentry cache is locked alone, and kept only if
+ * the cache still maps the path to it once locked (it can't be moved or
+ * deleted while locked and moves of its ancestors invalidate the cache).
+ * Otherwise the path is resolved with lookup_node.
+ * Input:
+ *  - name: path of the directory
+ *  - locks: Locks pointer
+ * Returns:
+ *  inumber: identifier of the i-node, if found
+ *     FAIL: otherwise
+ */
+int lookup_parent_node(char *name, Locks * locks) {
+	DcacheKey key;
+	int inumber, cached;
+
+	dcache_prepare(name, &key);
+	if(dcache_get(&key, &cached) == DCACHE_HIT){
+		list_add_lock(locks, get_inode_lock(cached));
+		list_write_lock(locks);
+		if(dcache_get(&key, &inumber) == DCACHE_HIT && inumber == cached)
+			return inumber;
+		list_reset(locks);
+		dcache_prepare(name, &key);
 	}
-	for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (entries[i].inumber != FREE_INODE && strcmp(entries[i].name, name) == 0) {
-            return entries[i].inumber;
-        }
-    }
-	return FAIL;
+
+	inumber = lookup_node(name, locks, WRITE);
+	dcache_put(&key, inumber);
+	return inumber;
 }
 
 /*
@@ -134,7 +212,7 @@ int lookup_sub_node(char *name, DirEntry *entries) {
  * Input:
  *  - name: path of node
  *  - nodeType: type of node
- * Returns: SUCCESS or FAIL
+ * Returns: SUCCESS or TECNICOFS_ERROR_* code
  */
 int create(char *name, type nodeType){
 	int parent_inumber, child_inumber;
@@ -143,31 +221,32 @@ int create(char *name, type nodeType){
 	/* use for copy */
 	type pType;
 	union Data pdata;
-	Locks * locks = list_create(INODE_TABLE_SIZE);
+	Locks lock_list, * locks = &lock_list;
+	list_init(locks);
 
 	strcpy(name_copy, name);
 	split_parent_child_from_path(name_copy, &parent_name, &child_name);
 
-	if((parent_inumber = lookup_node(parent_name, locks, WRITE)) == FAIL){
+	if((parent_inumber = lookup_parent_node(parent_name, locks)) == FAIL){
 		printf("failed to create %s, invalid parent dir %s\n", name, parent_name);
-		return exit_and_unlock(locks);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_NOT_FOUND);
 	}
 
 	inode_get(parent_inumber, &pType, &pdata);
 	
 	if(pType != T_DIRECTORY){
 		printf("failed to create %s, parent %s is not a dir\n", name, parent_name);
-		return exit_and_unlock(locks);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_NOT_FOUND);
 	}
 	
-	if (lookup_sub_node(child_name, pdata.dirEntries) != FAIL){
+	if (lookup_sub_node(child_name, pdata.dir) != FAIL){
 		printf("failed to create %s, already exists in dir %s\n", child_name, parent_name);
-		return exit_and_unlock(locks);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_ALREADY_EXISTS);
 	}
 
 	if ((child_inumber = generate_new_inumber()) == FAIL){
 		printf("failed to create %s in  %s, couldn't allocate inode\n", child_name, parent_name);
-		return exit_and_unlock(locks);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_OTHER);
 	}
 	list_add_lock(locks, get_inode_lock(child_inumber));
 	list_write_lock(locks);
@@ -175,136 +254,59 @@ int create(char *name, type nodeType){
 
 	if (dir_add_entry(parent_inumber, child_inumber, child_name) == FAIL){
 		printf("could not add entry %s in dir %s\n", child_name, parent_name);
-		return exit_and_unlock(locks);
+		inode_delete(child_inumber);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_OTHER);
 	};
+	dcache_invalidate(name);
 
-	exit_and_unlock(locks);
-	return SUCCESS;
-}
-
-/*
- * Verify if source path is valid
- * Locks accessed i-nodes.
- * Store source parent inumber and source child inumber in dest_inumbers (int*)
- * Input:
- *  - locks: Locks pointer
- *  - src_name: path of source node
- *  - src_parent_name: parent name of source node
- *  - src_child_name: child name of source node
- *  - src_inumber: int array of source parent inumber and source child inumber
- * Returns: SUCCESS or FAIL
- */
-int verify_source(Locks * locks, char * src_name, char * src_parent_name, char * src_child_name, int * src_inumbers){
-	int src_parent_inumber, src_child_inumber;
-	type src_parent_type;
-	union Data src_parent_data;
-
-	if ((src_parent_inumber = lookup_node(src_parent_name, locks, WRITE)) == FAIL) {
-		printf("failed to move from %s, invalid source parent dir %s\n", src_name, src_parent_name);
-		return exit_and_unlock(locks);
-	}
-
-
-	inode_get(src_parent_inumber, &src_parent_type, &src_parent_data);
-
-	if(src_parent_type != T_DIRECTORY) {
-		printf("failed to move from %s, source parent %s is not a dir\n", src_name, src_parent_name);
-		return exit_and_unlock(locks);
-	}
-
-	if((src_child_inumber = lookup_sub_node(src_child_name, src_parent_data.dirEntries)) == FAIL){
-		printf("could not move from %s, does not exist in dir %s\n", src_name, src_parent_name);
-		return exit_and_unlock(locks);
-	}
-
-	src_inumbers[0] = src_parent_inumber;
-	src_inumbers[1] = src_child_inumber;
-
+	list_unlock_all(locks);
 	return SUCCESS;
 }
 
 /*
- * Verify if destination path is valid
- * Locks accessed i-nodes.
- * Store destination parent inumber and destination child inumber in dest_inumbers (int*)
+ * Looks up the directory data of an i-node.
  * Input:
- *  - locks: Locks pointer
- *  - dest_name: path of destination node
- *  - dest_parent_name: parent name of destination node
- *  - dest_child_name: child name of destination node
- *  - src_parent_name: parent name of source node
- *  - src_parent_inumber: parent inumber of source node
- *  - dest_inumber: int array of destination parent inumber and destination child inumber
- * Returns: SUCCESS or FAIL
+ *  - inumber: identifier of the i-node
+ * Returns:
+ *  - directory of the i-node
+ *  - NULL: if the i-node is not a directory
  */
-int verify_destination(Locks * locks, char * dest_name, char * dest_parent_name, char * dest_child_name, char* src_parent_name, int src_parent_inumber, int * dest_inumbers){
-	int dest_parent_inumber, dest_child_inumber;
-	type dest_parent_type;
-	union Data dest_parent_data;
-
-	if((dest_parent_inumber = lookup_node(dest_parent_name, locks, DONOTHING)) == FAIL) {
-		printf("failed to move to %s, invalid destination parent dir %s\n", dest_name, dest_parent_name);
-		return exit_and_unlock(locks);
-	}
-
-	if(src_parent_inumber != dest_parent_inumber){
-
-		/* checks if destination parent name is part of source parent name. If so, unlocks read-locked */
-		/* i-node in source path which is the same i-node of destination parent i-node to be write-locked */
-		if(check_if_subset(dest_parent_name, src_parent_name) == true){
-			pthread_rwlock_t * dest_parent_inode_lock = get_inode_lock(dest_parent_inumber);
-			rwlock_unlock(dest_parent_inode_lock);
-		}
-
-		/* try to write-lock dest parent i-node until it succeeds */
-		if(list_try_write_lock(locks) != 0){
-			pthread_rwlock_t * src_parent_inode_lock = get_inode_lock(src_parent_inumber);
-			rwlock_unlock(src_parent_inode_lock);
-			int acquired = 0, num_trys = 1;
-
-			/* interlayer locking and unlocking inode of source parent until it can lock inode of destination parent (prevents deadlocks) */
-			while(!acquired){
-				rwlock_write_lock(src_parent_inode_lock);
-				if(list_try_write_lock(locks) == 0)
-					acquired = 1;
-				else{
-					rwlock_unlock(src_parent_inode_lock);
-					usleep((rand()%(++num_trys * MAXSLEEPTIME)) * 1000); // sleep for miliseconds (increases with number of tries)
-				}
-			}
-		}
-	}
-
-	inode_get(dest_parent_inumber, &dest_parent_type, &dest_parent_data);
-
-	if(dest_parent_type != T_DIRECTORY) {
-		printf("failed to move to %s, destination parent %s is not a dir\n", dest_name, dest_parent_name);
-		return exit_and_unlock(locks);
-	}
-
-
-	if((dest_child_inumber = lookup_sub_node(dest_child_name, dest_parent_data.dirEntries)) != FAIL){
-		printf("could not move to %s, already exists in dir %s\n", dest_name, src_parent_name);
-		return exit_and_unlock(locks);
-	}
-
-	dest_inumbers[0] = dest_parent_inumber;
-	dest_inumbers[1] = dest_child_inumber;
+Directory * get_node_dir(int inumber) {
+	type nType;
+	union Data data;
 
-	return SUCCESS;
+	if (inode_get(inumber, &nType, &data) == FAIL || nType != T_DIRECTORY)
+		return NULL;
+	return data.dir;
 }
 
 /*
- * Move a source path to a destination path
+ * Move a source path to a destination path.
+ * Locks are taken in a global order, so moves never deadlock and never
+ * retry: first the path down to the deepest common ancestor of both parent
+ * directories, then the two branches below it, the branch whose first
+ * i-node has the lower inumber first. Every move going through a common
+ * ancestor locks its children in the same order, and holds the locks of
+ * the ancestors of every i-node it locks, so the order can't change while
+ * the locks are taken.
+ * In lock coupling mode, the locks above the common ancestor are released
+ * on the way down: two moves that could form a cycle (or deadlock) have
+ * the same common ancestor, so they still lock its branches in order.
  * Input:
  *  - src_name: path of source node
  *  - dest_name: path of destination node
- * Returns: SUCCESS or FAIL
+ * Returns: SUCCESS or TECNICOFS_ERROR_* code
  */
 int move(char * src_name, char * dest_name){
-	Locks * locks = list_create(INODE_TABLE_SIZE);
+	Locks lock_list, * locks = &lock_list;
 	char *src_parent_name, *src_child_name, src_name_copy[MAX_FILE_NAME], *dest_parent_name, *dest_child_name, dest_name_copy[MAX_FILE_NAME];
-	int src_inumbers[MAXINUMBERS], dest_inumbers[MAXINUMBERS], src_parent_inumber, src_child_inumber, dest_parent_inumber;
+	char src_parent_copy[MAX_FILE_NAME], dest_parent_copy[MAX_FILE_NAME];
+	char *src_components[MAX_PATH_COMPONENTS], *dest_components[MAX_PATH_COMPONENTS];
+	int num_src, num_dest, common, common_inumber, src_branch, dest_branch;
+	int src_parent_inumber, src_child_inumber, dest_parent_inumber = FAIL;
+	Directory *common_dir, *src_parent_dir, *dest_parent_dir;
+
+	list_init(locks);
 
 	/* split source path */
 	strcpy(src_name_copy, src_name);
@@ -317,41 +319,114 @@ int move(char * src_name, char * dest_name){
 	/* check if both paths are the same */
 	if(strcmp(src_name, dest_name) == 0){
 		printf("failed to move %s to %s. Source and destination paths are the same.\n", src_name, dest_name);
-		return FAIL;
+		return TECNICOFS_ERROR_OTHER;
+	}
+
+	/* split parent paths in components and find their common ancestor */
+	strcpy(src_parent_copy, src_parent_name);
+	num_src = split_path_components(src_parent_copy, src_components);
+	strcpy(dest_parent_copy, dest_parent_name);
+	num_dest = split_path_components(dest_parent_copy, dest_components);
+
+	for(common = 0; common < num_src && common < num_dest; common++)
+		if(strcmp(src_components[common], dest_components[common]) != 0)
+			break;
+
+	/* lock common ancestor, to write if it is one of the parents */
+	common_inumber = lookup_node_from(FS_ROOT, src_components, common, locks,
+		(common == num_src || common == num_dest) ? WRITE : READ, lock_coupling);
+
+	if(common_inumber == FAIL || (common_dir = get_node_dir(common_inumber)) == NULL){
+		printf("failed to move %s to %s, invalid parent dirs\n", src_name, dest_name);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_NOT_FOUND);
+	}
+
+	/* first i-node of each branch below the common ancestor */
+	if(common == num_src)
+		src_branch = lookup_sub_node(src_child_name, common_dir);
+	else
+		src_branch = lookup_sub_node(src_components[common], common_dir);
+
+	if(src_branch == FAIL){
+		printf("could not move from %s, does not exist in dir %s\n", src_name, src_parent_name);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_NOT_FOUND);
+	}
+
+	if(common == num_dest)
+		dest_branch = FAIL;
+	else if((dest_branch = lookup_sub_node(dest_components[common], common_dir)) == FAIL){
+		printf("failed to move to %s, invalid destination parent dir %s\n", dest_name, dest_parent_name);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_NOT_FOUND);
 	}
 
-	/* check if destination path is a subpath of source path */
-	if(check_if_subset(src_name, dest_name) == true){
+	if(src_branch == dest_branch){
 		printf("failed to move %s to %s. Cannot move to a subdirectory of itself.\n", src_name, dest_name);
-		return FAIL;
+		return exit_and_unlock(locks, TECNICOFS_ERROR_OTHER);
 	}
 
-	if(verify_source(locks, src_name, src_parent_name, src_child_name, src_inumbers) == FAIL)
-		return FAIL;
+	if(common == num_dest)
+		dest_parent_inumber = common_inumber;
 
-	src_parent_inumber = src_inumbers[0];
-	src_child_inumber = src_inumbers[1];
+	/* destination branch goes first if its first i-node has a lower inumber */
+	if(dest_branch != FAIL && dest_branch < src_branch)
+		dest_parent_inumber = lookup_node_from(dest_branch, dest_components + common + 1, num_dest - common - 1, locks, WRITE, false);
+
+	if(common == num_src){
+		src_parent_inumber = common_inumber;
+		src_child_inumber = src_branch;
+	}
+	else{
+		src_parent_inumber = lookup_node_from(src_branch, src_components + common + 1, num_src - common - 1, locks, WRITE, false);
+		if(src_parent_inumber == FAIL || (src_parent_dir = get_node_dir(src_parent_inumber)) == NULL){
+			printf("failed to move from %s, invalid source parent dir %s\n", src_name, src_parent_name);
+			return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_NOT_FOUND);
+		}
+		if((src_child_inumber = lookup_sub_node(src_child_name, src_parent_dir)) == FAIL){
+			printf("could not move from %s, does not exist in dir %s\n", src_name, src_parent_name);
+			return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_NOT_FOUND);
+		}
+	}
 
 	/* add source child i-node lock to the list and write-locks it */
 	list_add_lock(locks, get_inode_lock(src_child_inumber));
 	list_write_lock(locks);
 
-	if(verify_destination(locks, dest_name, dest_parent_name, dest_child_name, src_parent_name, src_parent_inumber, dest_inumbers) == FAIL)
-		return FAIL;
+	if(dest_branch != FAIL && dest_branch > src_branch)
+		dest_parent_inumber = lookup_node_from(dest_branch, dest_components + common + 1, num_dest - common - 1, locks, WRITE, false);
 
-	dest_parent_inumber = dest_inumbers[0];
+	if(dest_parent_inumber == FAIL || (dest_parent_dir = get_node_dir(dest_parent_inumber)) == NULL){
+		printf("failed to move to %s, invalid destination parent dir %s\n", dest_name, dest_parent_name);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_NOT_FOUND);
+	}
+
+	if(lookup_sub_node(dest_child_name, dest_parent_dir) != FAIL){
+		printf("could not move to %s, already exists in dir %s\n", dest_name, dest_parent_name);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_ALREADY_EXISTS);
+	}
+
+	/* paths of the moved subtree, and the ones below the destination, change */
+	dcache_invalidate_subtree(src_name);
+	dcache_invalidate_subtree(dest_name);
+	/* clients resolving paths in the published namespace see both changes at once */
+	nsmap_write_begin();
 
 	if (dir_add_entry(dest_parent_inumber, src_child_inumber, dest_child_name) == FAIL){
+		nsmap_write_end();
 		printf("failed to move %s to %s. Could not add entry %s in dir %s\n", src_name, dest_name, dest_child_name, dest_parent_name);
-		return exit_and_unlock(locks);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_OTHER);
 	}
 
-	if (dir_reset_entry(src_parent_inumber, src_child_inumber) == FAIL) {
+	if (dir_reset_entry(src_parent_inumber, src_child_inumber, src_child_name) == FAIL) {
+		nsmap_write_end();
 		printf("failed to move %s to %s. Failed to delete %s from dir %s\n", src_name, dest_name, src_child_name, src_parent_name);
-		return exit_and_unlock(locks);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_OTHER);
 	}
+	nsmap_write_end();
+	/* again, for lockless lookups that resolved the paths before the move */
+	dcache_invalidate_subtree(src_name);
+	dcache_invalidate_subtree(dest_name);
 
-	exit_and_unlock(locks);
+	list_unlock_all(locks);
 	return SUCCESS;
 }
 
@@ -359,7 +434,7 @@ int move(char * src_name, char * dest_name){
  * Deletes a node given a path.
  * Input:
  *  - name: path of node
- * Returns: SUCCESS or FAIL
+ * Returns: SUCCESS or TECNICOFS_ERROR_* code
  */
 int delete(char *name){
 
@@ -369,27 +444,28 @@ int delete(char *name){
 	type pType, cType;
 	union Data pdata, cdata;
 
-	Locks * locks = list_create(INODE_TABLE_SIZE);
+	Locks lock_list, * locks = &lock_list;
+	list_init(locks);
 
 	strcpy(name_copy, name);
 	split_parent_child_from_path(name_copy, &parent_name, &child_name);
 
 
-	if ((parent_inumber = lookup_node(parent_name, locks, WRITE)) == FAIL) {
+	if ((parent_inumber = lookup_parent_node(parent_name, locks)) == FAIL) {
 		printf("failed to delete %s, invalid parent dir %s\n", name, parent_name);
-		return exit_and_unlock(locks);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_NOT_FOUND);
 	}
 
 	inode_get(parent_inumber, &pType, &pdata);
 
 	if(pType != T_DIRECTORY) {
 		printf("failed to delete %s, parent %s is not a dir\n", name, parent_name);
-		return exit_and_unlock(locks);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_NOT_FOUND);
 	}
 
-	if((child_inumber = lookup_sub_node(child_name, pdata.dirEntries)) == FAIL){
+	if((child_inumber = lookup_sub_node(child_name, pdata.dir)) == FAIL){
 		printf("could not delete %s, does not exist in dir %s\n", name, parent_name);
-		return exit_and_unlock(locks);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_FILE_NOT_FOUND);
 	}
 
 	/* add child i-node lock to the list and write-locks it */
@@ -397,107 +473,286 @@ int delete(char *name){
 	list_write_lock(locks);
 	inode_get(child_inumber, &cType, &cdata);
 
-	if (cType == T_DIRECTORY && is_dir_empty(cdata.dirEntries) == FAIL) {
+	if (cType == T_DIRECTORY && is_dir_empty(cdata.dir) == FAIL) {
 		printf("could not delete %s: is a directory and not empty\n", name);
-		return exit_and_unlock(locks);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_OTHER);
 	}
 
 	/* remove entry from folder that contained deleted node */
-	if (dir_reset_entry(parent_inumber, child_inumber) == FAIL) {
+	if (dir_reset_entry(parent_inumber, child_inumber, child_name) == FAIL) {
 		printf("failed to delete %s from dir %s\n", child_name, parent_name);
-		return exit_and_unlock(locks);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_OTHER);
 	}
+	dcache_invalidate(name);
 
 	if (inode_delete(child_inumber) == FAIL) {
 		printf("could not delete inode number %d from dir %s\n", child_inumber, parent_name);
-		return exit_and_unlock(locks);
+		return exit_and_unlock(locks, TECNICOFS_ERROR_OTHER);
 	}
 	
-	exit_and_unlock(locks);
+	list_unlock_all(locks);
+	return SUCCESS;
+}
+
+/*
+ * Lookup for a path without taking locks, validating the version of every
+ * directory read once the whole path is resolved. Fails while transactions
+ * are in progress.
+ * Input:
+ *  - components: path components
+ *  - num: number of components
+ *  - inumber: pointer to store the inumber found (FAIL if not found)
+ * Returns: SUCCESS, or FAIL if a directory changed during the lookup
+ */
+static int lookup_node_optimistic(char ** components, int num, int * inumber) {
+	int path[MAX_PATH_COMPONENTS], current = FS_ROOT, depth;
+	unsigned int versions[MAX_PATH_COMPONENTS], tree;
+
+	if (tree_read_begin(&tree) == FAIL)
+		return FAIL;
+	for (depth = 0; depth < num && current != FAIL; depth++) {
+		path[depth] = current;
+		if (dir_lookup_optimistic(current, components[depth], &versions[depth], &current) == FAIL)
+			return FAIL;
+	}
+
+	for (int i = 0; i < depth; i++)
+		if (inode_read_validate(path[i], versions[i]) == FAIL)
+			return FAIL;
+	if (tree_read_validate(tree) == FAIL)
+		return FAIL;
+
+	*inumber = current;
 	return SUCCESS;
 }
 
 /*
  * Lookup for a given path.
+ * Tries the dentry cache, then a lockless lookup, before resolving the path
+ * with locks. Writers invalidate the dentry cache after changing the tree,
+ * so lockless resolutions started before a change are not cached.
  * Input:
  *  - name: path of node
  * Returns:
  *  inumber: identifier of the i-node, if found
- *     FAIL: otherwise
+ *  TECNICOFS_ERROR_FILE_NOT_FOUND: otherwise
  */
 int lookup(char *name){
-	int current_inumber;
-	Locks * locks = list_create(INODE_TABLE_SIZE);
-	current_inumber = lookup_node(name, locks, READ);
-	list_unlock_all(locks);
-	list_free(locks);
-
-	return current_inumber;
+	int current_inumber, num, found;
+	char path_copy[MAX_FILE_NAME], *components[MAX_PATH_COMPONENTS];
+	DcacheKey key;
+
+	dcache_prepare(name, &key);
+	if(dcache_get(&key, &current_inumber) == DCACHE_MISS){
+		strncpy(path_copy, name, MAX_FILE_NAME - 1);
+		path_copy[MAX_FILE_NAME - 1] = '\0';
+		num = split_path_components(path_copy, components);
+
+		__atomic_add_fetch(&optimistic_attempts, 1, __ATOMIC_RELAXED);
+		lockless_read_begin();
+		found = lookup_node_optimistic(components, num, &current_inumber);
+		lockless_read_end();
+		if(found == SUCCESS){
+			__atomic_add_fetch(&optimistic_successes, 1, __ATOMIC_RELAXED);
+			dcache_put(&key, current_inumber);
+		}
+		else{
+			Locks lock_list, * locks = &lock_list;
+			list_init(locks);
+			current_inumber = lookup_node(name, locks, READ);
+			dcache_put(&key, current_inumber);
+			list_unlock_all(locks);
+		}
+	}
 
+	return current_inumber == FAIL ? TECNICOFS_ERROR_FILE_NOT_FOUND : current_inumber;
 }
 
 /*
  * Lookup for a given path.
  * Input:
  *  - name: path of node
+ *  - locks: Locks pointer
+ *  - mode: READ or WRITE
  * Returns:
  *  inumber: identifier of the i-node, if found
  *     FAIL: otherwise
- * locks every path to read except last one:
- * if mode = DONOTHING (0): DOES NOT lock inode of last path but adds it to list of locks
- * if mode = WRITE (1): locks to write mode when strtok reaches last path
- * if mode = READ (2): locks to read mode when strtok reaches last path
- * 
+ * locks every path to read except last one, which is locked in the given
+ * mode. In lock coupling mode only the last i-node stays locked.
  */
 int lookup_node(char *name, Locks * locks, int mode) {
-	char *saveptr, *path;
-	char delim[] = "/";
-	int current_inumber = FS_ROOT;
-	char *full_path = (char*) malloc(sizeof(char) * MAX_FILE_NAME);
-	strcpy(full_path, name);
+	char path_copy[MAX_FILE_NAME], *components[MAX_PATH_COMPONENTS];
+	int num;
 
-	/* use for copy */
-	type nType;
-	union Data data;
+	/* tokenized in place, in a copy on the stack */
+	strncpy(path_copy, name, MAX_FILE_NAME - 1);
+	path_copy[MAX_FILE_NAME - 1] = '\0';
+	num = split_path_components(path_copy, components);
 
-	/* search for all sub nodes */
-	do{
-		list_add_lock(locks, get_inode_lock(current_inumber));
+	return lookup_node_from(FS_ROOT, components, num, locks, mode, lock_coupling);
+}
+
+/*
+ * Lookup for a path below a given i-node, given its components.
+ * Input:
+ *  - inumber: identifier of the starting i-node (not locked yet)
+ *  - components: path components below the starting i-node
+ *  - num: number of components
+ *  - locks: Locks pointer
+ *  - mode: READ or WRITE
+ *  - couple: release each i-node lock once its child is locked
+ * Returns:
+ *  inumber: identifier of the i-node, if found
+ *     FAIL: otherwise
+ * locks the starting i-node and every i-node in the path to read, except
+ * the last one, which is locked in the given mode
+ */
+int lookup_node_from(int inumber, char ** components, int num, Locks * locks, int mode, bool couple) {
+	Directory *dir;
 
-		/* if next path is null which means the current path is the last one */
-		if((path = strtok_r(full_path, delim, &saveptr)) == NULL){
-			if(mode == WRITE)
+	for (int i = 0; ; i++) {
+		list_add_lock(locks, get_inode_lock(inumber));
+		if (i == num) {
+			if (mode == WRITE)
 				list_write_lock(locks);
-			else if(mode == READ)
+			else
 				list_read_lock(locks);
-			return current_inumber;
+			if (couple && i > 0)
+				list_release_previous(locks);
+			return inumber;
 		}
 		list_read_lock(locks);
-		inode_get(current_inumber, &nType, &data);
-		full_path = NULL;
+		if (couple && i > 0)
+			list_release_previous(locks);
 
-	} while((current_inumber = lookup_sub_node(path, data.dirEntries)) != FAIL);
-	
-	return current_inumber;
+		if ((dir = get_node_dir(inumber)) == NULL ||
+			(inumber = lookup_sub_node(components[i], dir)) == FAIL)
+			return FAIL;
+	}
+}
+
+/*
+ * Gets the number of lockless lookups attempted and of the ones that
+ * succeeded without falling back to locks.
+ * Input:
+ *  - attempts: pointer to store the attempts
+ *  - successes: pointer to store the successes
+ */
+void get_optimistic_stats(unsigned long * attempts, unsigned long * successes) {
+	*attempts = __atomic_load_n(&optimistic_attempts, __ATOMIC_RELAXED);
+	*successes = __atomic_load_n(&optimistic_successes, __ATOMIC_RELAXED);
 }
 
 /*
  * Prints tecnicofs tree.
+ * The tree is copied into a snapshot first, so other operations only wait
+ * for the copy, and are never stopped while the file is written.
  * Input:
  *  - filename: name of output file
+ * Returns: SUCCESS or TECNICOFS_ERROR_OTHER
  */
 int print_tecnicofs_tree(char * filename){
+	Snapshot snapshot;
+	int result = SUCCESS;
+
+	PROBE1(print__start, filename);
+	snapshot_take(&snapshot, FS_ROOT);
+
 	FILE *fp = fopen(filename, "w");
     if(!fp){
         printf("Error opening output file %s\n", filename);
-		return FAIL;
+		snapshot_free(&snapshot);
+		PROBE2(print__end, filename, TECNICOFS_ERROR_OTHER);
+		return TECNICOFS_ERROR_OTHER;
 	}
 	
-	inode_print_tree(fp, FS_ROOT, "");
+	snapshot_print(fp, &snapshot);
+	snapshot_free(&snapshot);
 	
 	if(fclose(fp) != 0){
 		printf("Error closing output file %s\n", filename);
-		return FAIL;
+		result = TECNICOFS_ERROR_OTHER;
+	}
+	PROBE2(print__end, filename, result);
+	return result;
+}
+
+/*
+ * Writes the profiles of the most contended i-node locks, one i-node per
+ * line, with the path it currently has ("-" if it was deleted, or kept
+ * changing while its path was looked for). The counters belong to the
+ * inumber, so a reused i-node keeps the ones of its previous files. The
+ * paths are found without locks, from the listed i-nodes up, so a dump
+ * neither waits for writers nor counts in the profile.
+ * Input:
+ *  - fp: output file
+ * Returns: SUCCESS, or TECNICOFS_ERROR_OTHER if the locks aren't profiled
+ */
+int dump_lock_profile(FILE * fp){
+	RwlockProfile *top;
+	int *inumbers, num;
+	char (*paths)[MAX_FILE_NAME];
+	uint64_t dropped;
+
+	if (lock_profile_top == 0)
+		return TECNICOFS_ERROR_OTHER;
+	top = (RwlockProfile*) malloc(sizeof(RwlockProfile) * lock_profile_top);
+	inumbers = (int*) malloc(sizeof(int) * lock_profile_top);
+	paths = malloc(sizeof(*paths) * lock_profile_top);
+	if (!top || !inumbers || !paths) {
+		fprintf(stderr, "Error: couldn't allocate memory for lock profile.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	num = rwlock_profile_top(top, lock_profile_top, &dropped);
+	lockless_read_begin();
+	for (int i = 0; i < num; i++) {
+		int attempt;
+		inumbers[i] = inode_of_lock(top[i].rwlock);
+		for (attempt = 0; attempt < 4 && inode_find_path(inumbers[i], paths[i]) == FAIL; attempt++) {}
+		if (attempt == 4)
+			paths[i][0] = '\0';
 	}
+	lockless_read_end();
+
+	fprintf(fp, "inumber path read_acquired read_contended read_wait_us read_max_wait_us "
+		"write_acquired write_contended write_wait_us write_max_wait_us\n");
+	for (int i = 0; i < num; i++) {
+		RwlockModeProfile *r = &top[i].modes[RWLOCK_READ], *w = &top[i].modes[RWLOCK_WRITE];
+		fprintf(fp, "%d %s %lu %lu %.1f %.1f %lu %lu %.1f %.1f\n", inumbers[i], paths[i][0] ? paths[i] : "-",
+			r->acquired, r->contended, r->wait_total / 1e3, r->wait_max / 1e3,
+			w->acquired, w->contended, w->wait_total / 1e3, w->wait_max / 1e3);
+	}
+	if (dropped)
+		fprintf(fp, "# %lu attempts on locks beyond the %d profiled\n", dropped, LOCK_PROFILE_SIZE);
+
+	free(top);
+	free(inumbers);
+	free(paths);
 	return SUCCESS;
 }
+
+/*
+ * Prints the profiles of the most contended i-node locks (see
+ * dump_lock_profile).
+ * Input:
+ *  - filename: name of output file
+ * Returns: SUCCESS or TECNICOFS_ERROR_OTHER
+ */
+int print_lock_profile(char * filename){
+	FILE *fp;
+	int result;
+
+	if (lock_profile_top == 0)
+		return TECNICOFS_ERROR_OTHER;
+	if ((fp = fopen(filename, "w")) == NULL) {
+		printf("Error opening output file %s\n", filename);
+		return TECNICOFS_ERROR_OTHER;
+	}
+	result = dump_lock_profile(fp);
+	if (fclose(fp) != 0) {
+		printf("Error closing output file %s\n", filename);
+		return TECNICOFS_ERROR_OTHER;
+	}
+	return result;
+}
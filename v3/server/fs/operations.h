@@ -1,6 +1,10 @@
 #ifndef FS_H
 #define FS_H
 #include "state.h"
+#include "dcache.h"
+#include "snapshot.h"
+#include "transaction.h"
+#include "nsmap.h"
 #include "../locks/rwlock.h"
 #include <pthread.h>
 #include <unistd.h>
@@ -9,31 +13,40 @@
 
 
 /* Constants that describe type of operation to realize */
-#define DONOTHING 0
 #define WRITE 1
 #define READ 2
 
-#define MAXSLEEPTIME 1
+/* Maximum number of components of a path */
+#define MAX_PATH_COMPONENTS (MAX_FILE_NAME / 2)
 
-/* Maximum i-node numbers in move command (1 for parent, 1 for source) */
-#define MAXINUMBERS 2
+/* I-node locks profiled by set_lock_profile, and default number of them
+ * listed by print_lock_profile */
+#define LOCK_PROFILE_SIZE (1 << 16)
+#define LOCK_PROFILE_DEFAULT_TOP 20
 
-void init_fs();
+void init_fs(int);
+void set_lock_coupling(bool);
+void set_dcache_size(int);
+void set_lock_profile(int);
 void destroy_fs();
 
-bool check_if_subset(char*, char*);
 void split_parent_child_from_path(char*, char**, char**);
-int exit_and_unlock(Locks*);
-int is_dir_empty(DirEntry*);
+int split_path_components(char*, char**);
+int exit_and_unlock(Locks*, int);
+int is_dir_empty(Directory*);
 int exit_create_with_message(char*, char*, char*, Locks*, char*);
 
 int create(char*, type);
-int verify_source(Locks*, char*, char*, char*, int*);
-int verify_destination(Locks*, char*, char*, char*, char*, int, int*);
 int move(char*, char*);
 int delete(char*);
 int lookup(char*);
 int lookup_node(char*, Locks*, int);
+int lookup_node_from(int, char**, int, Locks*, int, bool);
+Directory * get_node_dir(int);
+int lookup_parent_node(char*, Locks*);
+void get_optimistic_stats(unsigned long*, unsigned long*);
 int print_tecnicofs_tree(char*);
+int dump_lock_profile(FILE*);
+int print_lock_profile(char*);
 
 #endif /* FS_H */
@@ -0,0 +1,177 @@
+/*
+ * Tree snapshots, used to print the file system without stopping it.
+ *
+ * The tree is read-locked i-node by i-node, in pre-order with the children
+ * of every directory visited by increasing inumber, which is the order the
+ * other operations take their locks in: every path top-down, and the
+ * branches below the common ancestor of a move by increasing inumber of
+ * their first i-node. Only the path to the i-node being copied is locked:
+ * a directory is unlocked once its subtree is copied, and its lock keeps
+ * its children from leaving it meanwhile. The copy is written without
+ * holding any lock.
+ */
+
+#include <string.h>
+#include "snapshot.h"
+
+/*
+ * Grows an array to hold at least needed elements.
+ */
+static void * snapshot_reserve(void *array, int *capacity, int needed, size_t size) {
+	if (needed <= *capacity)
+		return array;
+
+	while (*capacity < needed)
+		*capacity = *capacity ? *capacity * 2 : 64;
+	if ((array = realloc(array, size * *capacity)) == NULL) {
+		fprintf(stderr, "Error: couldn't allocate memory for tree snapshot.\n");
+		exit(EXIT_FAILURE);
+	}
+	return array;
+}
+
+/*
+ * Appends nodes to the snapshot.
+ * Returns: index of the first appended node
+ */
+static int snapshot_add_nodes(Snapshot *snapshot, int num) {
+	int first = snapshot->num_nodes;
+
+	snapshot->nodes = snapshot_reserve(snapshot->nodes, &snapshot->nodes_capacity,
+		first + num, sizeof(SnapshotNode));
+	snapshot->num_nodes += num;
+	return first;
+}
+
+/*
+ * Appends a name to the names buffer.
+ * Returns: offset of the name
+ */
+static int snapshot_add_name(Snapshot *snapshot, char *name) {
+	int offset = snapshot->names_size, len = strlen(name) + 1;
+
+	snapshot->names = snapshot_reserve(snapshot->names, &snapshot->names_capacity,
+		offset + len, sizeof(char));
+	memcpy(snapshot->names + offset, name, len);
+	snapshot->names_size += len;
+	return offset;
+}
+
+/* child of a directory, sorted by inumber to be visited */
+typedef struct snapshotChild {
+	int inumber;
+	int node;
+} SnapshotChild;
+
+static int snapshot_child_compare(const void *a, const void *b) {
+	return ((SnapshotChild*) a)->inumber - ((SnapshotChild*) b)->inumber;
+}
+
+/*
+ * Read-locks an i-node and copies it, then its subtree, and unlocks it.
+ * Input:
+ *  - snapshot: snapshot being taken
+ *  - node: index of the node (its name and inumber are already copied)
+ */
+static void snapshot_take_node(Snapshot *snapshot, int node) {
+	int inumber = snapshot->nodes[node].inumber, first, num;
+	inode_t *inode = inode_table_get(inumber);
+	SnapshotChild children[DIR_INITIAL_ENTRIES], *sorted = children;
+
+	rwlock_read_lock(&inode->lock);
+	snapshot->nodes[node].nodeType = inode->nodeType;
+	snapshot->nodes[node].first_child = snapshot->num_nodes;
+	snapshot->nodes[node].num_children = 0;
+	if (inode->nodeType != T_DIRECTORY) {
+		rwlock_unlock(&inode->lock);
+		return;
+	}
+
+	Directory *dir = inode->data.dir;
+	num = dir->num_entries;
+	first = snapshot_add_nodes(snapshot, num);
+	snapshot->nodes[node].first_child = first;
+	snapshot->nodes[node].num_children = num;
+	if (num > DIR_INITIAL_ENTRIES && (sorted = (SnapshotChild*) malloc(sizeof(SnapshotChild) * num)) == NULL) {
+		fprintf(stderr, "Error: couldn't allocate memory for tree snapshot.\n");
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < num; i++) {
+		snapshot->nodes[first + i].name = snapshot_add_name(snapshot, dir->entries[i].name);
+		snapshot->nodes[first + i].inumber = dir->entries[i].inumber;
+		sorted[i].inumber = dir->entries[i].inumber;
+		sorted[i].node = first + i;
+	}
+
+	/* visit children by increasing inumber */
+	qsort(sorted, num, sizeof(SnapshotChild), snapshot_child_compare);
+	for (int i = 0; i < num; i++)
+		snapshot_take_node(snapshot, sorted[i].node);
+	rwlock_unlock(&inode->lock);
+	if (sorted != children)
+		free(sorted);
+}
+
+/*
+ * Takes a snapshot of a tree. An i-node stays read-locked only while it
+ * and its subtree are copied, so lookups never wait and a change waits
+ * at most for the copy of the subtree of what it changes. Every entry
+ * copied was in its directory when that directory was copied; entries
+ * moved meanwhile between a copied and a not yet copied directory may be
+ * missing or copied twice.
+ * Input:
+ *  - snapshot: snapshot to fill
+ *  - inumber: identifier of the root of the tree
+ */
+void snapshot_take(Snapshot *snapshot, int inumber) {
+	memset(snapshot, 0, sizeof(Snapshot));
+
+	int root = snapshot_add_nodes(snapshot, 1);
+	snapshot->nodes[root].name = snapshot_add_name(snapshot, "");
+	snapshot->nodes[root].inumber = inumber;
+	snapshot_take_node(snapshot, root);
+}
+
+/*
+ * Prints a node of a snapshot and its subtree.
+ * Input:
+ *  - fp: output file
+ *  - snapshot: snapshot
+ *  - node: index of the node
+ *  - path: path of the node
+ */
+static void snapshot_print_node(FILE *fp, Snapshot *snapshot, int node, char *path) {
+	SnapshotNode *current = &snapshot->nodes[node];
+
+	if (current->nodeType != T_FILE && current->nodeType != T_DIRECTORY)
+		return;
+
+	fprintf(fp, "%s\n", path);
+	for (int i = 0; i < current->num_children; i++) {
+		SnapshotNode *child = &snapshot->nodes[current->first_child + i];
+		char child_path[MAX_FILE_NAME];
+		if (snprintf(child_path, sizeof(child_path), "%s/%s", path, snapshot->names + child->name) >= sizeof(child_path)) {
+			fprintf(stderr, "truncation when building full path\n");
+		}
+		snapshot_print_node(fp, snapshot, current->first_child + i, child_path);
+	}
+}
+
+/*
+ * Prints the tree of a snapshot, one path per line, in the format of
+ * inode_print_tree.
+ * Input:
+ *  - fp: output file
+ *  - snapshot: snapshot
+ */
+void snapshot_print(FILE *fp, Snapshot *snapshot) {
+	snapshot_print_node(fp, snapshot, 0, "");
+}
+
+/*
+ * Releases the memory of a snapshot.
+ */
+void snapshot_free(Snapshot *snapshot) {
+	free(snapshot->nodes);
+	free(snapshot->names);
+}
@@ -0,0 +1,33 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "state.h"
+
+/*
+ * Copy of an i-node of the tree. The children of a directory are stored
+ * contiguously, in the order of its entries.
+ */
+typedef struct snapshotNode {
+	int name; /* offset of the entry name in the names buffer */
+	int inumber;
+	type nodeType;
+	int first_child; /* index of the first child node */
+	int num_children;
+} SnapshotNode;
+
+/*
+ * Copy of the names and types of a tree, taken directory by directory
+ * while the path to each one was read-locked.
+ */
+typedef struct snapshot {
+	SnapshotNode *nodes;
+	int num_nodes, nodes_capacity;
+	char *names;
+	int names_size, names_capacity;
+} Snapshot;
+
+void snapshot_take(Snapshot*, int);
+void snapshot_print(FILE*, Snapshot*);
+void snapshot_free(Snapshot*);
+
+#endif /* SNAPSHOT_H */
@@ -2,11 +2,196 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <stdint.h>
 #include "state.h"
+#include "nsmap.h"
+#include "../probes.h"
+
+/*
+ * The i-node table is a directory of fixed size segments. Segments are
+ * allocated on demand and never moved, so the address of an i-node (and of
+ * its lock) stays valid while the table grows.
+ */
+static inode_t ** inode_segments;
+static int max_segments;
+static int max_inodes;
+static int num_segments;    /* allocated segments, read without table_mutex */
+static int next_unused;     /* first i-node never handed out */
+static pthread_mutex_t table_mutex;
+
+/*
+ * Deleted i-nodes are kept in a lock-free stack linked through next_free.
+ * The head holds (inumber + 1) in the low 32 bits, 0 meaning empty, and a
+ * tag in the high 32 bits that changes on every pop to prevent ABA.
+ */
+static uint64_t free_head;
+
+/*
+ * State of every thread using the table: its cache of deleted i-nodes,
+ * used before the shared stack, and the lockless read it has in progress.
+ * States are registered, so allocations that find the table full can
+ * drain the caches, and retired arrays are freed once no lockless read
+ * may use them. The state of an exiting thread is released, with its
+ * cache going back to the shared stack. Only drains lock the cache of
+ * another thread.
+ */
+typedef struct threadState {
+    pthread_mutex_t lock; /* of the cache */
+    int inumbers[INODE_FREE_CACHE_SIZE];
+    int num;
+    unsigned long reading; /* reclaim epoch when its lockless read started, 0 if none */
+    struct threadState * next;
+} ThreadState;
+
+static ThreadState * thread_states;     /* registered states, protected by states_mutex */
+static pthread_mutex_t states_mutex;
+static pthread_key_t states_key;
+static unsigned int table_generation;  /* incremented by inode_table_init */
+
+/* state of this thread, valid if created for the current table */
+static __thread ThreadState * local_state;
+static __thread unsigned int local_generation;
+
+/* Directories of deleted i-nodes, reused with their entry arrays */
+static Directory * dir_pool;
+static int dir_pool_size;
+static pthread_mutex_t dir_pool_mutex;
+
+/*
+ * Entry arrays replaced by dir_grow, and released directories, kept while
+ * lockless readers may still be using them. Each one is tagged with the reclaim epoch, incremented
+ * once it is replaced, and is freed once every lockless read in progress
+ * started at that epoch or later. Protected by dir_pool_mutex.
+ */
+typedef struct retiredArray {
+    void * array;
+    unsigned long epoch;
+    struct retiredArray * next;
+} RetiredArray;
+static RetiredArray * retired_arrays;
+static unsigned long reclaim_epoch;
+
+static void dir_free(Directory*);
+static void dir_retire(void*);
+static void thread_state_release(void*);
+
+/* return address of i-node with the given inumber */
+inode_t * inode_table_get(int inumber){
+    return &inode_segments[inumber >> INODE_SEGMENT_SHIFT][inumber & INODE_SEGMENT_MASK];
+}
+
+/* return number of i-nodes currently allocated in the table */
+int inode_table_size(){
+    return __atomic_load_n(&num_segments, __ATOMIC_ACQUIRE) * INODE_SEGMENT_SIZE;
+}
+
+/* return maximum number of i-nodes the table can hold */
+int inode_table_max_size(){
+    return max_inodes;
+}
 
 /* return address of current inode rwlock */
 pthread_rwlock_t * get_inode_lock(int inumber){
-    return &inode_table[inumber].lock;
+    return &inode_table_get(inumber)->lock;
+}
+
+/*
+ * Finds the i-node of a rwlock.
+ * Returns: inumber, or FAIL if the rwlock isn't the lock of an i-node
+ */
+int inode_of_lock(pthread_rwlock_t * rwlock){
+    int segments = __atomic_load_n(&num_segments, __ATOMIC_ACQUIRE);
+
+    for (int s = 0; s < segments; s++) {
+        inode_t * segment = inode_segments[s];
+        uintptr_t offset = (uintptr_t) rwlock - (uintptr_t) segment;
+
+        if (offset < sizeof(inode_t) * INODE_SEGMENT_SIZE && &segment[offset / sizeof(inode_t)].lock == rwlock)
+            return (s << INODE_SEGMENT_SHIFT) + (int) (offset / sizeof(inode_t));
+    }
+    return FAIL;
+}
+
+/*
+ * Checks if inumber identifies an allocated i-node in use.
+ */
+static int inode_is_valid(int inumber){
+    return inumber >= 0 && inumber < inode_table_size() && inode_table_get(inumber)->nodeType != T_NONE;
+}
+
+/*
+ * Every i-node has a seqlock for lockless readers: writers, holding the
+ * i-node write lock, make its version odd while they change it, and
+ * readers check that the version was even and didn't change around their
+ * reads.
+ */
+static void inode_write_begin(inode_t *inode){
+    __atomic_store_n(&inode->version, inode->version + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void inode_write_end(inode_t *inode){
+    __atomic_store_n(&inode->version, inode->version + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Starts a lockless read of an i-node.
+ * Returns: version to validate the read with (odd if being changed)
+ */
+unsigned int inode_read_begin(int inumber){
+    return __atomic_load_n(&inode_table_get(inumber)->version, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Checks that an i-node didn't change since inode_read_begin.
+ * Returns: SUCCESS or FAIL
+ */
+int inode_read_validate(int inumber, unsigned int version){
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&inode_table_get(inumber)->version, __ATOMIC_RELAXED) != version)
+        return FAIL;
+    return SUCCESS;
+}
+
+/*
+ * Transactions change many directories as a unit: while one is in
+ * progress lockless readers fall back to locks, and readers that started
+ * before it fail their validation.
+ */
+static unsigned int tree_writers, tree_version;
+
+void tree_write_begin(){
+    __atomic_add_fetch(&tree_writers, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&tree_version, 1, __ATOMIC_SEQ_CST);
+}
+
+void tree_write_end(){
+    __atomic_add_fetch(&tree_version, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&tree_writers, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Starts a lockless read of the tree.
+ * Input:
+ *  - version: pointer to store the version to validate the read with
+ * Returns: SUCCESS, or FAIL if a transaction is in progress
+ */
+int tree_read_begin(unsigned int *version){
+    *version = __atomic_load_n(&tree_version, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&tree_writers, __ATOMIC_SEQ_CST) != 0)
+        return FAIL;
+    return SUCCESS;
+}
+
+/*
+ * Checks that no transaction started since tree_read_begin.
+ * Returns: SUCCESS or FAIL
+ */
+int tree_read_validate(unsigned int version){
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&tree_version, __ATOMIC_RELAXED) != version)
+        return FAIL;
+    return SUCCESS;
 }
 
 /*
@@ -16,17 +201,70 @@ void insert_delay(int cycles){
     for (int i = 0; i < cycles; i++) {}
 }
 
+/*
+ * Allocates and initializes a new segment of i-nodes.
+ * Must be called with table_mutex locked.
+ * Returns: SUCCESS or FAIL (table reached its maximum size)
+ */
+static int inode_table_grow(){
+    inode_t * segment;
+
+    if (num_segments == max_segments)
+        return FAIL;
+
+    if ((segment = (inode_t*) malloc(sizeof(inode_t) * INODE_SEGMENT_SIZE)) == NULL) {
+        fprintf(stderr, "Error: couldn't allocate memory for i-node table segment.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < INODE_SEGMENT_SIZE; i++) {
+        segment[i].nodeType = T_NONE;
+        segment[i].next_free = FREE_INODE;
+        segment[i].parent = FREE_INODE;
+        segment[i].version = 0;
+        segment[i].data.fileContents = NULL;
+        rwlock_init(&segment[i].lock);
+    }
+
+    inode_segments[num_segments] = segment;
+    /* publish segment only after it is initialized */
+    __atomic_store_n(&num_segments, num_segments + 1, __ATOMIC_RELEASE);
+    return SUCCESS;
+}
 
 /*
  * Initializes the i-nodes table.
+ * Input:
+ *  - max_size: maximum number of i-nodes (INODE_TABLE_MAX_SIZE if not positive)
  */
-void inode_table_init() {
-    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        inode_table[i].nodeType = T_NONE;
-        inode_table[i].data.dirEntries = NULL;
-        inode_table[i].data.fileContents = NULL;
-        rwlock_init(&inode_table[i].lock);
+void inode_table_init(int max_size) {
+    max_inodes = max_size > 0 ? max_size : INODE_TABLE_MAX_SIZE;
+    max_segments = (max_inodes + INODE_SEGMENT_SIZE - 1) / INODE_SEGMENT_SIZE;
+    num_segments = 0;
+    next_unused = 0;
+    free_head = 0;
+
+    if ((inode_segments = (inode_t**) calloc(max_segments, sizeof(inode_t*))) == NULL) {
+        fprintf(stderr, "Error: couldn't allocate memory for i-node table.\n");
+        exit(EXIT_FAILURE);
+    }
+    mutex_init(&table_mutex);
+    mutex_init(&dir_pool_mutex);
+    mutex_init(&states_mutex);
+    if (pthread_key_create(&states_key, thread_state_release) != 0) {
+        fprintf(stderr, "Error: couldn't create key of thread states.\n");
+        exit(EXIT_FAILURE);
     }
+    thread_states = NULL;
+    table_generation++;
+    dir_pool = NULL;
+    dir_pool_size = 0;
+    retired_arrays = NULL;
+    reclaim_epoch = 1;
+
+    mutex_lock(&table_mutex);
+    inode_table_grow();
+    mutex_unlock(&table_mutex);
 }
 
 /*
@@ -34,59 +272,218 @@ void inode_table_init() {
  */
 
 void inode_table_destroy() {
-    for (int i = 0; i < INODE_TABLE_SIZE; i++) {
-        if (inode_table[i].nodeType != T_NONE) {
-            /* as data is an union, the same pointer is used for both dirEntries and fileContents */
-            /* just release one of them */
-	        if (inode_table[i].data.dirEntries)
-                free(inode_table[i].data.dirEntries);
+    for (int s = 0; s < num_segments; s++) {
+        inode_t * segment = inode_segments[s];
+        for (int i = 0; i < INODE_SEGMENT_SIZE; i++) {
+            if (segment[i].nodeType == T_DIRECTORY)
+                dir_free(segment[i].data.dir);
+            else if (segment[i].nodeType == T_FILE && segment[i].data.fileContents)
+                free(segment[i].data.fileContents);
+            rwlock_destroy(&segment[i].lock);
         }
-        rwlock_destroy(&inode_table[i].lock);
+        free(segment);
+    }
+    free(inode_segments);
+    mutex_destroy(&table_mutex);
+
+    pthread_key_delete(states_key);
+    while (thread_states) {
+        ThreadState * state = thread_states;
+        thread_states = state->next;
+        mutex_destroy(&state->lock);
+        free(state);
     }
+    local_state = NULL;
+    mutex_destroy(&states_mutex);
+
+    while (dir_pool) {
+        Directory * dir = dir_pool;
+        dir_pool = dir->next_free;
+        dir_free(dir);
+    }
+    while (retired_arrays) {
+        RetiredArray * retired = retired_arrays;
+        retired_arrays = retired->next;
+        free(retired->array);
+        free(retired);
+    }
+    mutex_destroy(&dir_pool_mutex);
 }
 
 /*
- * Creates a new i-node in the table with the given information.
- * Read locks every i-node lock before accessing it.
- * Input:
- *  - parent_inumber: parent inumber where its node is locked to write
- * Returns:
- *  inumber: identifier of the new i-node, if successfully created
- *     FAIL: if an error occurs
+ * Pushes a deleted i-node to the shared free stack.
+ */
+static void free_stack_push(int inumber){
+    uint64_t head = __atomic_load_n(&free_head, __ATOMIC_ACQUIRE), new_head;
+
+    do {
+        inode_table_get(inumber)->next_free = (int) (head & 0xffffffff) - 1;
+        new_head = (head & ~(uint64_t) 0xffffffff) | (uint64_t) (inumber + 1);
+    } while (!__atomic_compare_exchange_n(&free_head, &head, new_head, true, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Pops a deleted i-node from the shared free stack.
+ * Returns: inumber or FAIL if the stack is empty
+ */
+static int free_stack_pop(){
+    uint64_t head = __atomic_load_n(&free_head, __ATOMIC_ACQUIRE), new_head;
+    int inumber;
+
+    do {
+        if ((inumber = (int) (head & 0xffffffff) - 1) == FREE_INODE)
+            return FAIL;
+        /* i-node memory is never released, so a stale next_free only makes the exchange fail */
+        uint64_t next = (uint64_t) (inode_table_get(inumber)->next_free + 1);
+        new_head = ((head >> 32) + 1) << 32 | next;
+    } while (!__atomic_compare_exchange_n(&free_head, &head, new_head, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    return inumber;
+}
+
+/*
+ * Hands out an i-node never used before, growing the table if needed.
+ * Returns: inumber or FAIL if the table reached its maximum size
  */
+static int next_unused_inumber(){
+    int inumber = __atomic_load_n(&next_unused, __ATOMIC_RELAXED);
 
+    do {
+        if (inumber >= max_inodes)
+            return FAIL;
+    } while (!__atomic_compare_exchange_n(&next_unused, &inumber, inumber + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    if (inumber >= inode_table_size()) {
+        mutex_lock(&table_mutex);
+        while (inumber >= inode_table_size())
+            inode_table_grow();
+        mutex_unlock(&table_mutex);
+    }
+    return inumber;
+}
+
+/*
+ * Returns the state of the calling thread, registering a new one on its
+ * first use of the table.
+ */
+static ThreadState * thread_state_get(){
+    ThreadState * state;
+
+    if (local_state != NULL && local_generation == table_generation)
+        return local_state;
+
+    if ((state = (ThreadState*) malloc(sizeof(ThreadState))) == NULL) {
+        fprintf(stderr, "Error: couldn't allocate memory for thread state.\n");
+        exit(EXIT_FAILURE);
+    }
+    mutex_init(&state->lock);
+    state->num = 0;
+    state->reading = 0;
+    mutex_lock(&states_mutex);
+    state->next = thread_states;
+    thread_states = state;
+    mutex_unlock(&states_mutex);
+    pthread_setspecific(states_key, state);
+
+    local_state = state;
+    local_generation = table_generation;
+    return state;
+}
+
+/*
+ * Releases the state of an exiting thread, returning its cache to the
+ * shared stack.
+ */
+static void thread_state_release(void * arg){
+    ThreadState * state = (ThreadState*) arg, ** prev;
+
+    mutex_lock(&states_mutex);
+    for (prev = &thread_states; *prev != state; prev = &(*prev)->next) {}
+    *prev = state->next;
+    mutex_unlock(&states_mutex);
+
+    for (int i = 0; i < state->num; i++)
+        free_stack_push(state->inumbers[i]);
+    mutex_destroy(&state->lock);
+    free(state);
+}
+
+/*
+ * Moves the i-nodes of every thread cache to the shared stack.
+ */
+static void free_caches_drain(){
+    mutex_lock(&states_mutex);
+    for (ThreadState * state = thread_states; state != NULL; state = state->next) {
+        mutex_lock(&state->lock);
+        while (state->num > 0)
+            free_stack_push(state->inumbers[--state->num]);
+        mutex_unlock(&state->lock);
+    }
+    mutex_unlock(&states_mutex);
+}
+
+/*
+ * Allocates a free i-node. The returned i-node belongs only to the caller
+ * until it is released by inode_delete, so no other thread can pick it.
+ * Deleted i-nodes are reused first (from the thread cache, then from the
+ * shared stack) and never used ones are handed out after. Once the table
+ * is full, the caches of the other threads are drained before failing.
+ * Returns:
+ *  inumber: identifier of the new i-node, if successfully allocated
+ *     FAIL: if the table is full
+ */
 int generate_new_inumber(){
-    pthread_rwlock_t * rwlock;
+    ThreadState * state = thread_state_get();
+    int inumber = FAIL;
 
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    for(int inumber = 0; inumber < INODE_TABLE_SIZE; inumber++){
-        rwlock = get_inode_lock(inumber);
-        if(rwlock_try_read_lock(rwlock) == 0){
-            if(inode_table[inumber].nodeType == T_NONE){
-                rwlock_unlock(rwlock);
-                return inumber;
-            }
-            rwlock_unlock(rwlock);
-        }
+    mutex_lock(&state->lock);
+    if (state->num > 0)
+        inumber = state->inumbers[--state->num];
+    mutex_unlock(&state->lock);
+
+    if (inumber == FAIL && (inumber = free_stack_pop()) == FAIL &&
+            (inumber = next_unused_inumber()) == FAIL) {
+        free_caches_drain();
+        inumber = free_stack_pop();
     }
-    return FAIL;
+
+    PROBE1(inode__alloc, inumber);
+    return inumber;
+}
+
+/*
+ * Returns a deleted i-node to the allocator.
+ */
+static void inode_release(int inumber){
+    ThreadState * state = thread_state_get();
+
+    mutex_lock(&state->lock);
+    if (state->num < INODE_FREE_CACHE_SIZE) {
+        state->inumbers[state->num++] = inumber;
+        inumber = FAIL;
+    }
+    mutex_unlock(&state->lock);
+    if (inumber != FAIL)
+        free_stack_push(inumber);
 }
 
 int inode_create(type nType, int inumber) {
-    inode_table[inumber].nodeType = nType;
+    inode_t * inode = inode_table_get(inumber);
+
+    inode_write_begin(inode);
+    inode->nodeType = nType;
+    __atomic_store_n(&inode->parent, FREE_INODE, __ATOMIC_RELAXED);
     if (nType == T_DIRECTORY) {
         /* Initializes entry table */
-         inode_table[inumber].data.dirEntries = malloc(sizeof(DirEntry) * MAX_DIR_ENTRIES);
-                
-        for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-            inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-        }
+        inode->data.dir = dir_create();
     }
     else {
-        inode_table[inumber].data.fileContents = NULL;
+        inode->data.fileContents = NULL;
     }
+    inode_write_end(inode);
     return FAIL;
 }
 
@@ -100,15 +497,24 @@ int inode_delete(int inumber) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_is_valid(inumber)) {
         printf("inode_delete: invalid inumber\n");
         return FAIL;
     } 
 
-    inode_table[inumber].nodeType = T_NONE;
+    inode_t * inode = inode_table_get(inumber);
+    inode_write_begin(inode);
     /* see inode_table_destroy function */
-    if (inode_table[inumber].data.dirEntries)
-        free(inode_table[inumber].data.dirEntries);
+    if (inode->nodeType == T_DIRECTORY)
+        dir_destroy(inode->data.dir);
+    else if (inode->data.fileContents)
+        free(inode->data.fileContents);
+    inode->nodeType = T_NONE;
+    inode->data.fileContents = NULL;
+    inode_write_end(inode);
+
+    inode_release(inumber);
+    PROBE1(inode__free, inumber);
     return SUCCESS;
 }
 
@@ -126,57 +532,450 @@ int inode_get(int inumber, type *nType, union Data *data) {
      /* Used for testing synchronization speedup */
     insert_delay(DELAY);
     
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_is_valid(inumber)) {
         printf("inode_get: invalid inumber %d\n", inumber);
         return FAIL;
     }
 
 
+    inode_t * inode = inode_table_get(inumber);
+
     if (nType)
-        *nType = inode_table[inumber].nodeType;
+        *nType = inode->nodeType;
 
     if (data)
-        *data = inode_table[inumber].data;
+        *data = inode->data;
 
     return SUCCESS;
 }
 
 
+/*
+ * Computes the hash of an entry name (FNV-1a).
+ */
+unsigned int dir_name_hash(char *name) {
+    unsigned int hash = 2166136261u;
+    for (; *name; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Allocates an empty directory, reusing one from the pool if possible.
+ */
+Directory * dir_create() {
+    Directory * dir = NULL;
+
+    mutex_lock(&dir_pool_mutex);
+    if (dir_pool) {
+        dir = dir_pool;
+        dir_pool = dir->next_free;
+        dir_pool_size--;
+    }
+    mutex_unlock(&dir_pool_mutex);
+    if (dir)
+        return dir;
+
+    dir = (Directory*) malloc(sizeof(Directory));
+    if (dir) {
+        dir->entries = (DirEntry*) malloc(sizeof(DirEntry) * DIR_INITIAL_ENTRIES);
+        dir->index = (int*) calloc(2 * DIR_INITIAL_ENTRIES, sizeof(int));
+    }
+    if (!dir || !dir->entries || !dir->index) {
+        fprintf(stderr, "Error: couldn't allocate memory for directory.\n");
+        exit(EXIT_FAILURE);
+    }
+    dir->num_entries = 0;
+    dir->capacity = DIR_INITIAL_ENTRIES;
+    dir->index_size = 2 * DIR_INITIAL_ENTRIES;
+    return dir;
+}
+
+/*
+ * Releases the memory of a directory.
+ */
+static void dir_free(Directory *dir) {
+    free(dir->entries);
+    free(dir->index);
+    free(dir);
+}
+
+/*
+ * Empties a directory and returns it to the pool, if it has its initial
+ * capacity and the pool has room. Otherwise the directory is released,
+ * once no lockless reader may be using it.
+ */
+void dir_destroy(Directory *dir) {
+    int pooled = 0;
+
+    if (dir->capacity == DIR_INITIAL_ENTRIES) {
+        memset(dir->index, 0, sizeof(int) * dir->index_size);
+        dir->num_entries = 0;
+
+        mutex_lock(&dir_pool_mutex);
+        if (dir_pool_size < DIR_POOL_MAX) {
+            dir->next_free = dir_pool;
+            dir_pool = dir;
+            dir_pool_size++;
+            pooled = 1;
+        }
+        mutex_unlock(&dir_pool_mutex);
+    }
+
+    if (!pooled) {
+        dir_retire(dir->entries);
+        dir_retire(dir->index);
+        dir_retire(dir);
+    }
+}
+
+/*
+ * Starts a lockless read of directories (dir_lookup_optimistic): the
+ * arrays it reaches are not freed until lockless_read_end.
+ */
+void lockless_read_begin() {
+    ThreadState * state = thread_state_get();
+
+    __atomic_store_n(&state->reading, __atomic_load_n(&reclaim_epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    /* the epoch is visible to reclaims before any directory is read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* Ends the lockless read of the calling thread */
+void lockless_read_end() {
+    __atomic_store_n(&local_state->reading, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Frees the retired arrays that no lockless read in progress started
+ * before. Must be called with dir_pool_mutex locked.
+ */
+static void dir_reclaim() {
+    unsigned long oldest = (unsigned long) -1;
+    RetiredArray ** prev = &retired_arrays;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    mutex_lock(&states_mutex);
+    for (ThreadState * state = thread_states; state != NULL; state = state->next) {
+        unsigned long reading = __atomic_load_n(&state->reading, __ATOMIC_ACQUIRE);
+        if (reading != 0 && reading < oldest)
+            oldest = reading;
+    }
+    mutex_unlock(&states_mutex);
+
+    while (*prev != NULL) {
+        RetiredArray * retired = *prev;
+        if (retired->epoch <= oldest) {
+            *prev = retired->next;
+            free(retired->array);
+            free(retired);
+        }
+        else
+            prev = &retired->next;
+    }
+}
+
+/*
+ * Retires an array replaced by dir_grow, or the memory of a released
+ * directory, once no longer reachable, and frees the retired memory no
+ * lockless reader may be using.
+ */
+static void dir_retire(void *array) {
+    RetiredArray * retired = (RetiredArray*) malloc(sizeof(RetiredArray));
+
+    if (!retired) {
+        fprintf(stderr, "Error: couldn't allocate memory for directory entries.\n");
+        exit(EXIT_FAILURE);
+    }
+    retired->array = array;
+    mutex_lock(&dir_pool_mutex);
+    retired->epoch = __atomic_add_fetch(&reclaim_epoch, 1, __ATOMIC_SEQ_CST);
+    retired->next = retired_arrays;
+    retired_arrays = retired;
+    dir_reclaim();
+    mutex_unlock(&dir_pool_mutex);
+}
+
+/*
+ * Finds the index slot of an entry name.
+ * Returns: slot holding the entry, or the free slot ending its probe sequence
+ */
+static int dir_find_slot(Directory *dir, char *name, unsigned int hash) {
+    int mask = dir->index_size - 1;
+    int slot = hash & mask;
+
+    while (dir->index[slot] != 0) {
+        DirEntry *entry = &dir->entries[dir->index[slot] - 1];
+        if (entry->hash == hash && strcmp(entry->name, name) == 0)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/*
+ * Doubles the capacity of a directory and rebuilds its index.
+ * The new arrays are published before the new sizes, so lockless readers
+ * always index arrays at least as large as the sizes they read, and the
+ * old ones are retired once replaced.
+ */
+static void dir_grow(Directory *dir) {
+    int capacity = dir->capacity * 2, index_size = dir->index_size * 2;
+    DirEntry *entries = (DirEntry*) malloc(sizeof(DirEntry) * capacity);
+    int *index = (int*) calloc(index_size, sizeof(int));
+    DirEntry *old_entries = dir->entries;
+    int *old_index = dir->index;
+
+    if (!entries || !index) {
+        fprintf(stderr, "Error: couldn't allocate memory for directory entries.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(entries, dir->entries, sizeof(DirEntry) * dir->num_entries);
+
+    for (int i = 0; i < dir->num_entries; i++) {
+        int slot = entries[i].hash & (index_size - 1);
+        while (index[slot] != 0)
+            slot = (slot + 1) & (index_size - 1);
+        index[slot] = i + 1;
+    }
+
+    __atomic_store_n(&dir->entries, entries, __ATOMIC_RELAXED);
+    __atomic_store_n(&dir->index, index, __ATOMIC_RELAXED);
+    __atomic_store_n(&dir->capacity, capacity, __ATOMIC_RELEASE);
+    __atomic_store_n(&dir->index_size, index_size, __ATOMIC_RELEASE);
+    dir_retire(old_entries);
+    dir_retire(old_index);
+}
+
+/*
+ * Looks for an entry in a directory.
+ * Input:
+ *  - dir: directory
+ *  - name: name of the entry
+ * Returns:
+ *  - inumber: entry inumber, if found
+ *  - FAIL: if not found
+ */
+int dir_lookup(Directory *dir, char *name) {
+    int slot, position;
+
+    if (dir == NULL)
+        return FAIL;
+
+    slot = dir_find_slot(dir, name, dir_name_hash(name));
+    if ((position = dir->index[slot]) == 0)
+        return FAIL;
+    return dir->entries[position - 1].inumber;
+}
+
+/*
+ * Looks for an entry in a directory i-node without locking it.
+ * Everything read may be changing: the directory is only accessed once the
+ * version shows it belongs to the i-node, indexes are bounded by the sizes
+ * read, and the caller must validate the version once done. Must be called
+ * between lockless_read_begin and lockless_read_end.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - name: name of the entry
+ *  - version: pointer to store the version of the i-node
+ *  - sub_inumber: pointer to store the entry inumber (FAIL if not found,
+ *    or if the i-node is not a directory)
+ * Returns: SUCCESS, or FAIL if the i-node was being changed
+ */
+int dir_lookup_optimistic(int inumber, char *name, unsigned int *version, int *sub_inumber) {
+    if (inumber < 0 || inumber >= inode_table_size())
+        return FAIL;
+
+    inode_t * inode = inode_table_get(inumber);
+    if ((*version = inode_read_begin(inumber)) & 1)
+        return FAIL;
+    type nType = __atomic_load_n(&inode->nodeType, __ATOMIC_RELAXED);
+    Directory * dir = __atomic_load_n(&inode->data.dir, __ATOMIC_RELAXED);
+    if (inode_read_validate(inumber, *version) == FAIL)
+        return FAIL;
+
+    *sub_inumber = FAIL;
+    if (nType != T_DIRECTORY || dir == NULL)
+        return SUCCESS;
+
+    int index_size = __atomic_load_n(&dir->index_size, __ATOMIC_ACQUIRE);
+    int capacity = __atomic_load_n(&dir->capacity, __ATOMIC_ACQUIRE);
+    int *index = __atomic_load_n(&dir->index, __ATOMIC_RELAXED);
+    DirEntry *entries = __atomic_load_n(&dir->entries, __ATOMIC_RELAXED);
+    unsigned int hash = dir_name_hash(name);
+    int mask = index_size - 1, slot = hash & mask;
+
+    for (int probes = 0; probes < index_size; probes++, slot = (slot + 1) & mask) {
+        int position = __atomic_load_n(&index[slot], __ATOMIC_RELAXED);
+        if (position == 0)
+            break;
+        if (position < 0 || position > capacity)
+            return FAIL;
+        DirEntry *entry = &entries[position - 1];
+        if (entry->hash == hash && strncmp(entry->name, name, MAX_FILE_NAME) == 0) {
+            *sub_inumber = entry->inumber;
+            break;
+        }
+    }
+    return SUCCESS;
+}
+
+/*
+ * Looks for the name of an entry of a directory without taking locks,
+ * like dir_lookup_optimistic.
+ * Input:
+ *  - inumber: identifier of the directory
+ *  - sub_inumber: identifier of the entry
+ *  - version: pointer to store the version of the directory
+ *  - name: buffer of MAX_FILE_NAME to store the name of the entry
+ * Returns: SUCCESS, or FAIL if the entry isn't there or the directory was
+ *  being changed
+ */
+static int dir_name_optimistic(int inumber, int sub_inumber, unsigned int *version, char *name) {
+    inode_t * inode = inode_table_get(inumber);
+
+    if ((*version = inode_read_begin(inumber)) & 1)
+        return FAIL;
+    type nType = __atomic_load_n(&inode->nodeType, __ATOMIC_RELAXED);
+    Directory * dir = __atomic_load_n(&inode->data.dir, __ATOMIC_RELAXED);
+    if (inode_read_validate(inumber, *version) == FAIL || nType != T_DIRECTORY || dir == NULL)
+        return FAIL;
+
+    /* the array read holds at least capacity entries */
+    int capacity = __atomic_load_n(&dir->capacity, __ATOMIC_ACQUIRE);
+    DirEntry *entries = __atomic_load_n(&dir->entries, __ATOMIC_RELAXED);
+    int num = __atomic_load_n(&dir->num_entries, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < num && i < capacity; i++) {
+        if (__atomic_load_n(&entries[i].inumber, __ATOMIC_RELAXED) == sub_inumber) {
+            memcpy(name, entries[i].name, MAX_FILE_NAME);
+            name[MAX_FILE_NAME - 1] = '\0';
+            return SUCCESS;
+        }
+    }
+    return FAIL;
+}
+
+/*
+ * Finds the path of an i-node without taking locks, going up through the
+ * directory each i-node was last added to, and validating the version of
+ * every directory read once the root is reached. Must be called between
+ * lockless_read_begin and lockless_read_end.
+ * Input:
+ *  - inumber: identifier of the i-node
+ *  - path: buffer of MAX_FILE_NAME to store the path ("/" for the root)
+ * Returns: SUCCESS, or FAIL if the i-node is in no directory or a
+ *  directory changed during the search
+ */
+int inode_find_path(int inumber, char *path) {
+    int parents[MAX_FILE_NAME / 2], depth = 0, position = MAX_FILE_NAME - 1;
+    unsigned int versions[MAX_FILE_NAME / 2], tree;
+    char buffer[MAX_FILE_NAME], name[MAX_FILE_NAME];
+
+    if (inumber < 0 || inumber >= inode_table_size() || tree_read_begin(&tree) == FAIL)
+        return FAIL;
+
+    /* the path is built backwards, from the end of the buffer */
+    buffer[position] = '\0';
+    for (int current = inumber; current != FS_ROOT; current = parents[depth++]) {
+        int parent = __atomic_load_n(&inode_table_get(current)->parent, __ATOMIC_RELAXED);
+        if (depth == MAX_FILE_NAME / 2 || parent < 0 || parent >= inode_table_size() ||
+                dir_name_optimistic(parent, current, &versions[depth], name) == FAIL)
+            return FAIL;
+
+        int len = strlen(name);
+        if (len + 1 > position)
+            return FAIL;
+        position -= len;
+        memcpy(buffer + position, name, len);
+        buffer[--position] = '/';
+        parents[depth] = parent;
+    }
+
+    for (int i = 0; i < depth; i++)
+        if (inode_read_validate(parents[i], versions[i]) == FAIL)
+            return FAIL;
+    if (tree_read_validate(tree) == FAIL)
+        return FAIL;
+    strcpy(path, depth == 0 ? "/" : buffer + position);
+    return SUCCESS;
+}
+
+/*
+ * Checks if a directory has no entries.
+ * Returns: SUCCESS if empty, FAIL otherwise
+ */
+int dir_is_empty(Directory *dir) {
+    if (dir == NULL || dir->num_entries != 0)
+        return FAIL;
+    return SUCCESS;
+}
+
 /*
  * Resets an entry for a directory.
+ * Removes it from the index (backward shift deletion) and moves the last
+ * entry into its position.
  * Input:
  *  - inumber: identifier of the i-node
  *  - sub_inumber: identifier of the sub i-node entry
+ *  - sub_name: name of the sub i-node entry
  * Returns: SUCCESS or FAIL
  */
-int dir_reset_entry(int inumber, int sub_inumber) {
+int dir_reset_entry(int inumber, int sub_inumber, char *sub_name) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_is_valid(inumber)) {
         printf("inode_reset_entry: invalid inumber\n");
         return FAIL;
     }
 
-    if (inode_table[inumber].nodeType != T_DIRECTORY) {
+    Directory * dir = inode_table_get(inumber)->data.dir;
+
+    if (inode_table_get(inumber)->nodeType != T_DIRECTORY) {
         printf("inode_reset_entry: can only reset entry to directories\n");
         return FAIL;
     }
 
-    if ((sub_inumber < FREE_INODE) || (sub_inumber > INODE_TABLE_SIZE) || (inode_table[sub_inumber].nodeType == T_NONE)) {
+    if (!inode_is_valid(sub_inumber)) {
         printf("inode_reset_entry: invalid entry inumber\n");
         return FAIL;
     }
 
-    
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == sub_inumber) {
-            inode_table[inumber].data.dirEntries[i].inumber = FREE_INODE;
-            inode_table[inumber].data.dirEntries[i].name[0] = '\0';
-            return SUCCESS;
+    int mask = dir->index_size - 1;
+    int slot = dir_find_slot(dir, sub_name, dir_name_hash(sub_name));
+    int position = dir->index[slot] - 1;
+
+    if (position < 0 || dir->entries[position].inumber != sub_inumber)
+        return FAIL;
+
+    inode_write_begin(inode_table_get(inumber));
+
+    /* shift back the entries that probed past the removed slot */
+    for (int next = (slot + 1) & mask; dir->index[next] != 0; next = (next + 1) & mask) {
+        int home = dir->entries[dir->index[next] - 1].hash & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            dir->index[slot] = dir->index[next];
+            slot = next;
         }
     }
-    return FAIL;
+    dir->index[slot] = 0;
+
+    /* fill the hole with the last entry */
+    int last = --dir->num_entries;
+    if (position != last) {
+        DirEntry *moved = &dir->entries[last];
+        slot = moved->hash & mask;
+        while (dir->index[slot] != last + 1)
+            slot = (slot + 1) & mask;
+        dir->index[slot] = position + 1;
+        dir->entries[position] = *moved;
+    }
+    nsmap_remove(inumber, sub_name);
+    inode_write_end(inode_table_get(inumber));
+    return SUCCESS;
 }
 
 
@@ -192,17 +991,19 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
     /* Used for testing synchronization speedup */
     insert_delay(DELAY);
 
-    if ((inumber < 0) || (inumber > INODE_TABLE_SIZE) || (inode_table[inumber].nodeType == T_NONE)) {
+    if (!inode_is_valid(inumber)) {
         printf("inode_add_entry: invalid inumber\n");
         return FAIL;
     }
 
-    if (inode_table[inumber].nodeType != T_DIRECTORY) {
+    Directory * dir = inode_table_get(inumber)->data.dir;
+
+    if (inode_table_get(inumber)->nodeType != T_DIRECTORY) {
         printf("inode_add_entry: can only add entry to directories\n");
         return FAIL;
     }
 
-    if ((sub_inumber < 0) || (sub_inumber > INODE_TABLE_SIZE) || (inode_table[sub_inumber].nodeType == T_NONE)) {
+    if (!inode_is_valid(sub_inumber)) {
         printf("inode_add_entry: invalid entry inumber\n");
         return FAIL;
     }
@@ -213,14 +1014,31 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
         return FAIL;
     }
     
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (inode_table[inumber].data.dirEntries[i].inumber == FREE_INODE) {
-            inode_table[inumber].data.dirEntries[i].inumber = sub_inumber;
-            strcpy(inode_table[inumber].data.dirEntries[i].name, sub_name);
-            return SUCCESS;
-        }
+    if (strlen(sub_name) >= MAX_FILE_NAME) {
+        printf("inode_add_entry: entry name too long\n");
+        return FAIL;
     }
-    return FAIL;
+
+    unsigned int hash = dir_name_hash(sub_name);
+    int slot = dir_find_slot(dir, sub_name, hash);
+    if (dir->index[slot] != 0)
+        return FAIL;
+
+    inode_write_begin(inode_table_get(inumber));
+    if (dir->num_entries == dir->capacity) {
+        dir_grow(dir);
+        slot = dir_find_slot(dir, sub_name, hash);
+    }
+
+    DirEntry *entry = &dir->entries[dir->num_entries];
+    entry->inumber = sub_inumber;
+    entry->hash = hash;
+    strcpy(entry->name, sub_name);
+    dir->index[slot] = ++dir->num_entries;
+    __atomic_store_n(&inode_table_get(sub_inumber)->parent, inumber, __ATOMIC_RELAXED);
+    nsmap_add(inumber, sub_inumber, sub_name);
+    inode_write_end(inode_table_get(inumber));
+    return SUCCESS;
 }
 
 
@@ -231,22 +1049,22 @@ int dir_add_entry(int inumber, int sub_inumber, char *sub_name) {
  *  - name: pointer to the name of current file/dir
  */
 void inode_print_tree(FILE *fp, int inumber, char *name) {
+    inode_t * inode = inode_table_get(inumber);
     
-    if (inode_table[inumber].nodeType == T_FILE) {
+    if (inode->nodeType == T_FILE) {
         fprintf(fp, "%s\n", name);
         return;
     }
 
-    if (inode_table[inumber].nodeType == T_DIRECTORY) {
+    if (inode->nodeType == T_DIRECTORY) {
         fprintf(fp, "%s\n", name);
-        for (int i = 0; i < MAX_DIR_ENTRIES; i++) {
-            if (inode_table[inumber].data.dirEntries[i].inumber != FREE_INODE) {
-                char path[MAX_FILE_NAME];
-                if (snprintf(path, sizeof(path), "%s/%s", name, inode_table[inumber].data.dirEntries[i].name) > sizeof(path)) {
-                    fprintf(stderr, "truncation when building full path\n");
-                }
-                inode_print_tree(fp, inode_table[inumber].data.dirEntries[i].inumber, path);
+        for (int i = 0; i < inode->data.dir->num_entries; i++) {
+            DirEntry *entry = &inode->data.dir->entries[i];
+            char path[MAX_FILE_NAME];
+            if (snprintf(path, sizeof(path), "%s/%s", name, entry->name) > sizeof(path)) {
+                fprintf(stderr, "truncation when building full path\n");
             }
+            inode_print_tree(fp, entry->inumber, path);
         }
     }
 }
@@ -11,10 +11,27 @@
 #define FS_ROOT 0
 
 #define FREE_INODE -1
-#define INODE_TABLE_SIZE 50
-#define MAX_DIR_ENTRIES 20
 
+/* Initial number of entries of a directory (grows on demand) */
+#define DIR_INITIAL_ENTRIES 8
+
+/* Deleted directories of initial capacity kept for reuse (others are released) */
+#define DIR_POOL_MAX 1024
+
+/* The i-node table grows in segments of INODE_SEGMENT_SIZE i-nodes */
+#define INODE_SEGMENT_SHIFT 10
+#define INODE_SEGMENT_SIZE (1 << INODE_SEGMENT_SHIFT)
+#define INODE_SEGMENT_MASK (INODE_SEGMENT_SIZE - 1)
+
+/* Number of deleted i-nodes each thread keeps for its own allocations */
+#define INODE_FREE_CACHE_SIZE 16
+
+/* Default maximum number of i-nodes in the table */
+#define INODE_TABLE_MAX_SIZE (1 << 24)
+
+#ifndef DELAY
 #define DELAY 5000
+#endif
 
 /*
  * Contains the name of the entry and respective i-number
@@ -22,14 +39,32 @@
 typedef struct dirEntry {
 	char name[MAX_FILE_NAME];
 	int inumber;
+	unsigned int hash; /* hash of name */
 } DirEntry;
 
 /*
- * Data is either text (file) or entries (DirEntry)
+ * Directory entries are kept in a dense array, in a deterministic order,
+ * and indexed by an open addressing (linear probing) hash table keyed by
+ * the hash of their names.
+ * Deleted directories are pooled for reuse, up to DIR_POOL_MAX of initial
+ * capacity, and the others are released, like the arrays they replace,
+ * once no lockless reader may be using them.
+ */
+typedef struct directory {
+	DirEntry *entries;
+	int *index; /* position + 1 in entries, 0 if slot is free */
+	int num_entries;
+	int capacity; /* size of entries */
+	int index_size; /* power of two, at least twice capacity */
+	struct directory *next_free; /* next directory in the pool */
+} Directory;
+
+/*
+ * Data is either text (file) or entries (Directory)
  */
 union Data {
 	char *fileContents; /* for files */
-	DirEntry *dirEntries; /* for directories */
+	Directory *dir; /* for directories */
 };
 
 /*
@@ -39,22 +74,43 @@ typedef struct inode_t {
 	type nodeType;
 	union Data data;
 	pthread_rwlock_t lock;
+	unsigned int version; /* seqlock, odd while the i-node is being changed */
+	int next_free; /* next deleted i-node, used by the allocator */
+	int parent; /* directory it was last added to, FREE_INODE if none */
     /* more i-node attributes will be added in future exercises */
 } inode_t;
 
-inode_t inode_table[INODE_TABLE_SIZE];
 
 
+inode_t * inode_table_get(int);
+int inode_table_size();
+int inode_table_max_size();
 pthread_rwlock_t * get_inode_lock(int);
+int inode_of_lock(pthread_rwlock_t*);
 void insert_delay(int);
-void inode_table_init();
+unsigned int inode_read_begin(int);
+int inode_read_validate(int, unsigned int);
+void tree_write_begin();
+void tree_write_end();
+int tree_read_begin(unsigned int*);
+int tree_read_validate(unsigned int);
+void inode_table_init(int);
 void inode_table_destroy();
 int generate_new_inumber();
 int inode_create(type, int);
 int inode_delete(int);
 int inode_get(int, type*, union Data*);
 int inode_set_file(int, char*, int);
-int dir_reset_entry(int, int);
+unsigned int dir_name_hash(char*);
+Directory * dir_create();
+void dir_destroy(Directory*);
+int dir_lookup(Directory*, char*);
+void lockless_read_begin();
+void lockless_read_end();
+int dir_lookup_optimistic(int, char*, unsigned int*, int*);
+int inode_find_path(int, char*);
+int dir_is_empty(Directory*);
+int dir_reset_entry(int, int, char*);
 int dir_add_entry(int, int, char*);
 void inode_print_tree(FILE*, int, char*);
 void inode_print_tree_aux(FILE*, int, char*);
@@ -0,0 +1,533 @@
+/*
+ * Transactions: sequences of operations applied as a unit.
+ *
+ * Only the i-nodes the operations go through are locked: the paths of
+ * every operation form a tree, which is locked from the root in
+ * pre-order, with the children of every directory locked by increasing
+ * inumber. That is the order moves and tree snapshots take their locks
+ * in, consistent with every other operation, so transactions never
+ * deadlock and never retry. The parent directories of creates, deletes and
+ * moves, and the i-nodes deleted or moved, are write-locked; the other
+ * directories of the paths are read-locked. An operation may use a path
+ * moved by an operation before it, so each path is first mapped back
+ * through those moves to the one it had when the transaction started.
+ *
+ * Every lock is taken up front: the operations are then applied one by
+ * one without locking, recording how to undo each one. If one fails, the
+ * ones before it are undone in reverse order. I-nodes deleted by the
+ * transaction are only released when it commits, so undoing a delete puts
+ * back the same i-node (undoing may change the order of the entries of a
+ * directory).
+ *
+ * Lockless lookups fall back to locks while a transaction is in progress,
+ * and the cached paths it may change are invalidated when it starts and
+ * when it ends, so no other operation sees its intermediate states.
+ */
+
+#include <string.h>
+#include "transaction.h"
+#include "operations.h"
+
+/* i-nodes locked by a transaction */
+typedef struct txLocks {
+	int *inumbers;
+	int num;
+} TxLocks;
+
+/* directory entry of the paths of a transaction, in the tree it locks */
+typedef struct txNode {
+	char *name; /* NULL for the root */
+	int first_child, next_sibling; /* indexes of the nodes, or FAIL */
+	int inumber; /* found while locking */
+	int write; /* changed by an operation */
+} TxNode;
+
+/* how to undo an operation */
+typedef struct txUndo {
+	txOpType op;
+	int parent;
+	int child;
+	char name[MAX_FILE_NAME];
+	int dest_parent; /* for TX_MOVE */
+	char dest_name[MAX_FILE_NAME];
+} TxUndo;
+
+typedef struct tx {
+	TxNode *nodes;
+	int num_nodes, capacity;
+	TxLocks locks;
+	TxUndo *undo;
+	int num_undo;
+} Tx;
+
+/* path split in components */
+typedef struct txPath {
+	char copy[MAX_FILE_NAME];
+	char *components[MAX_PATH_COMPONENTS];
+	int num;
+} TxPath;
+
+static void tx_split_path(char *path, TxPath *split) {
+	strncpy(split->copy, path, MAX_FILE_NAME - 1);
+	split->copy[MAX_FILE_NAME - 1] = '\0';
+	split->num = split_path_components(split->copy, split->components);
+}
+
+/*
+ * Write-locks an i-node and adds it to the locks of the transaction.
+ */
+static void tx_lock(TxLocks *locks, int inumber) {
+	rwlock_write_lock(get_inode_lock(inumber));
+	locks->inumbers[locks->num++] = inumber;
+}
+
+/*
+ * Maps a path of an operation back to the one it had when the transaction
+ * started, undoing the moves of the operations before it, last first.
+ * Input:
+ *  - ops: operations
+ *  - paths: the path and destination of each operation, split
+ *  - op: index of the operation
+ *  - path: path to map
+ *  - components: array to fill with the components of the mapped path
+ * Returns: number of components
+ */
+static int tx_original_path(TxOp *ops, TxPath *paths, int op, TxPath *path, char **components) {
+	int num = path->num;
+
+	memcpy(components, path->components, sizeof(char*) * num);
+	for (int i = op - 1; i >= 0; i--) {
+		TxPath *src = &paths[2 * i], *dest = &paths[2 * i + 1];
+		int j;
+
+		if (ops[i].op != TX_MOVE || dest->num == 0 || dest->num > num ||
+			num - dest->num + src->num > MAX_PATH_COMPONENTS)
+			continue;
+		for (j = 0; j < dest->num && strcmp(dest->components[j], components[j]) == 0; j++)
+			;
+		if (j < dest->num)
+			continue;
+		memmove(components + src->num, components + dest->num, sizeof(char*) * (num - dest->num));
+		memcpy(components, src->components, sizeof(char*) * src->num);
+		num += src->num - dest->num;
+	}
+	return num;
+}
+
+/*
+ * Adds a path to the tree of the paths of a transaction.
+ * Input:
+ *  - tx: transaction
+ *  - components: components of the path
+ *  - num: number of components (0 for the root)
+ *  - write: whether its last i-node is changed by the operation
+ */
+static void tx_add_path(Tx *tx, char **components, int num, int write) {
+	int node = 0;
+
+	for (int i = 0; i < num; i++) {
+		int child;
+
+		for (child = tx->nodes[node].first_child; child != FAIL; child = tx->nodes[child].next_sibling)
+			if (strcmp(tx->nodes[child].name, components[i]) == 0)
+				break;
+		if (child == FAIL) {
+			if (tx->num_nodes == tx->capacity) {
+				tx->capacity *= 2;
+				if ((tx->nodes = (TxNode*) realloc(tx->nodes, sizeof(TxNode) * tx->capacity)) == NULL) {
+					fprintf(stderr, "Error: couldn't allocate memory for transaction.\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+			child = tx->num_nodes++;
+			tx->nodes[child].name = components[i];
+			tx->nodes[child].first_child = FAIL;
+			tx->nodes[child].next_sibling = tx->nodes[node].first_child;
+			tx->nodes[child].write = 0;
+			tx->nodes[node].first_child = child;
+		}
+		node = child;
+	}
+	tx->nodes[node].write |= write;
+}
+
+/*
+ * Adds the i-nodes an operation goes through and changes to the tree of
+ * the paths of a transaction.
+ */
+static void tx_add_op(Tx *tx, TxOp *ops, TxPath *paths, int op) {
+	char *components[MAX_PATH_COMPONENTS];
+	int num = tx_original_path(ops, paths, op, &paths[2 * op], components);
+
+	switch (ops[op].op) {
+		case TX_LOOKUP:
+			tx_add_path(tx, components, num, 0);
+			break;
+		case TX_CREATE:
+			if (num > 0)
+				tx_add_path(tx, components, num - 1, 1);
+			break;
+		case TX_DELETE:
+			if (num > 0) {
+				tx_add_path(tx, components, num - 1, 1);
+				tx_add_path(tx, components, num, 1);
+			}
+			break;
+		case TX_MOVE:
+			if (num > 0) {
+				tx_add_path(tx, components, num - 1, 1);
+				tx_add_path(tx, components, num, 1);
+			}
+			/* parent of the destination */
+			if ((num = tx_original_path(ops, paths, op, &paths[2 * op + 1], components)) > 0)
+				tx_add_path(tx, components, num - 1, 1);
+			break;
+	}
+}
+
+/*
+ * Locks a node of the tree of the paths of a transaction and, below it,
+ * the children found in its directory, by increasing inumber.
+ */
+static void tx_lock_node(Tx *tx, int node) {
+	TxNode *nodes = tx->nodes;
+	Directory *dir;
+	int child, next, sorted = FAIL;
+
+	if (nodes[node].write)
+		rwlock_write_lock(get_inode_lock(nodes[node].inumber));
+	else
+		rwlock_read_lock(get_inode_lock(nodes[node].inumber));
+	tx->locks.inumbers[tx->locks.num++] = nodes[node].inumber;
+	if ((dir = get_node_dir(nodes[node].inumber)) == NULL)
+		return;
+
+	/* resolve the children while the directory is locked, inserting each
+	 * one found in a list sorted by inumber */
+	for (child = nodes[node].first_child; child != FAIL; child = next) {
+		int *link = &sorted;
+
+		next = nodes[child].next_sibling;
+		if ((nodes[child].inumber = dir_lookup(dir, nodes[child].name)) == FAIL)
+			continue;
+		while (*link != FAIL && nodes[*link].inumber < nodes[child].inumber)
+			link = &nodes[*link].next_sibling;
+		nodes[child].next_sibling = *link;
+		*link = child;
+	}
+	for (child = sorted; child != FAIL; child = nodes[child].next_sibling)
+		tx_lock_node(tx, child);
+}
+
+/*
+ * Resolves components of a path below an i-node, through locked i-nodes.
+ * Returns: inumber or FAIL if not found
+ */
+static int tx_resolve(int inumber, char **components, int num) {
+	Directory *dir;
+
+	for (int i = 0; i < num; i++)
+		if ((dir = get_node_dir(inumber)) == NULL || (inumber = dir_lookup(dir, components[i])) == FAIL)
+			return FAIL;
+	return inumber;
+}
+
+/*
+ * Resolves the parent directory of a path.
+ * Returns: inumber or FAIL if not found or not a directory
+ */
+static int tx_resolve_parent(TxPath *path) {
+	int inumber = tx_resolve(FS_ROOT, path->components, path->num - 1);
+
+	if (inumber == FAIL || get_node_dir(inumber) == NULL)
+		return FAIL;
+	return inumber;
+}
+
+static TxUndo * tx_log(Tx *tx, txOpType op, int parent, int child, char *name) {
+	TxUndo *undo = &tx->undo[tx->num_undo++];
+
+	undo->op = op;
+	undo->parent = parent;
+	undo->child = child;
+	strcpy(undo->name, name);
+	return undo;
+}
+
+static int tx_create(Tx *tx, char *name, type nodeType) {
+	TxPath path;
+	int parent, child;
+	char *child_name;
+
+	tx_split_path(name, &path);
+	if (path.num == 0)
+		return TECNICOFS_ERROR_OTHER;
+	child_name = path.components[path.num - 1];
+
+	if ((parent = tx_resolve_parent(&path)) == FAIL) {
+		printf("failed to create %s, invalid parent dir\n", name);
+		return TECNICOFS_ERROR_FILE_NOT_FOUND;
+	}
+	if (dir_lookup(get_node_dir(parent), child_name) != FAIL) {
+		printf("failed to create %s, already exists\n", name);
+		return TECNICOFS_ERROR_FILE_ALREADY_EXISTS;
+	}
+	if ((child = generate_new_inumber()) == FAIL) {
+		printf("failed to create %s, couldn't allocate inode\n", name);
+		return TECNICOFS_ERROR_OTHER;
+	}
+	/* may still be locked by the operation that deleted it */
+	tx_lock(&tx->locks, child);
+	inode_create(nodeType, child);
+
+	if (dir_add_entry(parent, child, child_name) == FAIL) {
+		printf("could not add entry %s\n", name);
+		inode_delete(child);
+		return TECNICOFS_ERROR_OTHER;
+	}
+	tx_log(tx, TX_CREATE, parent, child, child_name);
+	return SUCCESS;
+}
+
+static int tx_delete(Tx *tx, char *name) {
+	TxPath path;
+	int parent, child;
+	char *child_name;
+
+	tx_split_path(name, &path);
+	if (path.num == 0)
+		return TECNICOFS_ERROR_OTHER;
+	child_name = path.components[path.num - 1];
+
+	if ((parent = tx_resolve_parent(&path)) == FAIL) {
+		printf("failed to delete %s, invalid parent dir\n", name);
+		return TECNICOFS_ERROR_FILE_NOT_FOUND;
+	}
+	if ((child = dir_lookup(get_node_dir(parent), child_name)) == FAIL) {
+		printf("could not delete %s, does not exist\n", name);
+		return TECNICOFS_ERROR_FILE_NOT_FOUND;
+	}
+	if (get_node_dir(child) != NULL && is_dir_empty(get_node_dir(child)) == FAIL) {
+		printf("could not delete %s: is a directory and not empty\n", name);
+		return TECNICOFS_ERROR_OTHER;
+	}
+	if (dir_reset_entry(parent, child, child_name) == FAIL) {
+		printf("failed to delete %s\n", name);
+		return TECNICOFS_ERROR_OTHER;
+	}
+	/* the i-node is deleted when the transaction commits */
+	tx_log(tx, TX_DELETE, parent, child, child_name);
+	return SUCCESS;
+}
+
+static int tx_move(Tx *tx, char *src_name, char *dest_name) {
+	TxPath src, dest;
+	int src_parent, child, dest_parent;
+	Directory *dir;
+
+	tx_split_path(src_name, &src);
+	tx_split_path(dest_name, &dest);
+	if (src.num == 0 || dest.num == 0 || strcmp(src_name, dest_name) == 0) {
+		printf("failed to move %s to %s, invalid paths\n", src_name, dest_name);
+		return TECNICOFS_ERROR_OTHER;
+	}
+
+	if ((src_parent = tx_resolve_parent(&src)) == FAIL ||
+		(child = dir_lookup(get_node_dir(src_parent), src.components[src.num - 1])) == FAIL) {
+		printf("could not move from %s, does not exist\n", src_name);
+		return TECNICOFS_ERROR_FILE_NOT_FOUND;
+	}
+
+	/* the destination can't be below the source */
+	dest_parent = FS_ROOT;
+	for (int i = 0; i < dest.num - 1; i++) {
+		if ((dir = get_node_dir(dest_parent)) == NULL || (dest_parent = dir_lookup(dir, dest.components[i])) == FAIL) {
+			printf("failed to move to %s, invalid destination parent dir\n", dest_name);
+			return TECNICOFS_ERROR_FILE_NOT_FOUND;
+		}
+		if (dest_parent == child) {
+			printf("failed to move %s to %s. Cannot move to a subdirectory of itself.\n", src_name, dest_name);
+			return TECNICOFS_ERROR_OTHER;
+		}
+	}
+	if ((dir = get_node_dir(dest_parent)) == NULL) {
+		printf("failed to move to %s, invalid destination parent dir\n", dest_name);
+		return TECNICOFS_ERROR_FILE_NOT_FOUND;
+	}
+	if (dir_lookup(dir, dest.components[dest.num - 1]) != FAIL) {
+		printf("could not move to %s, already exists\n", dest_name);
+		return TECNICOFS_ERROR_FILE_ALREADY_EXISTS;
+	}
+
+	if (dir_add_entry(dest_parent, child, dest.components[dest.num - 1]) == FAIL) {
+		printf("failed to move %s to %s\n", src_name, dest_name);
+		return TECNICOFS_ERROR_OTHER;
+	}
+	if (dir_reset_entry(src_parent, child, src.components[src.num - 1]) == FAIL) {
+		printf("failed to move %s to %s\n", src_name, dest_name);
+		dir_reset_entry(dest_parent, child, dest.components[dest.num - 1]);
+		return TECNICOFS_ERROR_OTHER;
+	}
+
+	TxUndo *undo = tx_log(tx, TX_MOVE, src_parent, child, src.components[src.num - 1]);
+	undo->dest_parent = dest_parent;
+	strcpy(undo->dest_name, dest.components[dest.num - 1]);
+	return SUCCESS;
+}
+
+static int tx_lookup(Tx *tx, char *name) {
+	TxPath path;
+	int inumber;
+
+	tx_split_path(name, &path);
+	inumber = tx_resolve(FS_ROOT, path.components, path.num);
+	return inumber == FAIL ? TECNICOFS_ERROR_FILE_NOT_FOUND : inumber;
+}
+
+static int tx_apply(Tx *tx, TxOp *op) {
+	switch (op->op) {
+		case TX_CREATE:
+			return tx_create(tx, op->path, op->nodeType);
+		case TX_DELETE:
+			return tx_delete(tx, op->path);
+		case TX_MOVE:
+			return tx_move(tx, op->path, op->dest);
+		case TX_LOOKUP:
+			return tx_lookup(tx, op->path);
+	}
+	return TECNICOFS_ERROR_OTHER;
+}
+
+/*
+ * Undoes the operations applied, in reverse order.
+ * Entries are added back where they were removed, so these can't fail.
+ */
+static void tx_rollback(Tx *tx) {
+	for (int i = tx->num_undo - 1; i >= 0; i--) {
+		TxUndo *undo = &tx->undo[i];
+		switch (undo->op) {
+			case TX_CREATE:
+				dir_reset_entry(undo->parent, undo->child, undo->name);
+				inode_delete(undo->child);
+				break;
+			case TX_DELETE:
+				dir_add_entry(undo->parent, undo->child, undo->name);
+				break;
+			case TX_MOVE:
+				dir_reset_entry(undo->dest_parent, undo->child, undo->dest_name);
+				dir_add_entry(undo->parent, undo->child, undo->name);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+/* releases the i-nodes deleted by a committed transaction */
+static void tx_commit(Tx *tx) {
+	for (int i = 0; i < tx->num_undo; i++)
+		if (tx->undo[i].op == TX_DELETE)
+			inode_delete(tx->undo[i].child);
+}
+
+/*
+ * Invalidates the cached paths the operations may change: the subtrees of
+ * their paths and of the destinations of moves.
+ */
+static void tx_invalidate(TxOp *ops, int num) {
+	for (int i = 0; i < num; i++) {
+		if (ops[i].op == TX_LOOKUP)
+			continue;
+		dcache_invalidate_subtree(ops[i].path);
+		if (ops[i].op == TX_MOVE)
+			dcache_invalidate_subtree(ops[i].dest);
+	}
+}
+
+/*
+ * Applies a sequence of operations as a unit: either all of them are
+ * applied, or none is, and no other operation sees intermediate states.
+ * Input:
+ *  - ops: operations, applied in order
+ *  - num: number of operations, up to TX_MAX_OPS
+ *  - results: array to store the result of each operation (as returned by
+ *    create, delete, move and lookup; operations not attempted after a
+ *    failure get TECNICOFS_ERROR_OTHER)
+ * Returns: SUCCESS if committed, otherwise the error of the operation that
+ *  failed
+ */
+int transaction(TxOp *ops, int num, int *results) {
+	TxPath *paths;
+	Tx tx;
+	int failed = FAIL, i;
+
+	for (i = 0; i < num; i++)
+		results[i] = TECNICOFS_ERROR_OTHER;
+	if (num <= 0 || num > TX_MAX_OPS)
+		return TECNICOFS_ERROR_OTHER;
+	for (i = 0; i < num; i++)
+		if (ops[i].path == NULL || (ops[i].op == TX_MOVE && ops[i].dest == NULL) ||
+			(ops[i].op == TX_CREATE && ops[i].nodeType != T_FILE && ops[i].nodeType != T_DIRECTORY))
+			return TECNICOFS_ERROR_OTHER;
+
+	memset(&tx, 0, sizeof(tx));
+	tx.capacity = 8 * num;
+	if ((paths = (TxPath*) malloc(sizeof(TxPath) * 2 * num)) == NULL ||
+		(tx.nodes = (TxNode*) malloc(sizeof(TxNode) * tx.capacity)) == NULL ||
+		(tx.undo = (TxUndo*) malloc(sizeof(TxUndo) * num)) == NULL) {
+		fprintf(stderr, "Error: couldn't allocate memory for transaction.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* the tree of the paths of the operations, from the root */
+	for (i = 0; i < num; i++) {
+		tx_split_path(ops[i].path, &paths[2 * i]);
+		if (ops[i].op == TX_MOVE)
+			tx_split_path(ops[i].dest, &paths[2 * i + 1]);
+		else
+			paths[2 * i + 1].num = 0;
+	}
+	tx.nodes[0].name = NULL;
+	tx.nodes[0].first_child = tx.nodes[0].next_sibling = FAIL;
+	tx.nodes[0].inumber = FS_ROOT;
+	tx.nodes[0].write = 0;
+	tx.num_nodes = 1;
+	for (i = 0; i < num; i++)
+		tx_add_op(&tx, ops, paths, i);
+
+	/* every node found and every i-node created */
+	if ((tx.locks.inumbers = (int*) malloc(sizeof(int) * (tx.num_nodes + num))) == NULL) {
+		fprintf(stderr, "Error: couldn't allocate memory for transaction locks.\n");
+		exit(EXIT_FAILURE);
+	}
+	tx_lock_node(&tx, 0);
+	/* the names of the nodes point into the paths */
+	free(paths);
+
+	tree_write_begin();
+	tx_invalidate(ops, num);
+	/* every directory changed is locked: clients of the published namespace
+	 * see the transaction as a unit */
+	nsmap_write_begin();
+
+	for (i = 0; i < num && failed == FAIL; i++)
+		if ((results[i] = tx_apply(&tx, &ops[i])) < 0)
+			failed = i;
+
+	if (failed == FAIL)
+		tx_commit(&tx);
+	else
+		tx_rollback(&tx);
+	nsmap_write_end();
+
+	/* again, for lockless lookups that resolved paths before it started */
+	tx_invalidate(ops, num);
+	tree_write_end();
+
+	for (i = 0; i < tx.locks.num; i++)
+		rwlock_unlock(get_inode_lock(tx.locks.inumbers[i]));
+	free(tx.locks.inumbers);
+	free(tx.nodes);
+	free(tx.undo);
+	return failed == FAIL ? SUCCESS : results[failed];
+}
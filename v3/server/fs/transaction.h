@@ -0,0 +1,21 @@
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+
+#include "state.h"
+
+/* Maximum number of operations in a transaction */
+#define TX_MAX_OPS 256
+
+/* Operations that can be part of a transaction */
+typedef enum txOpType { TX_CREATE, TX_DELETE, TX_MOVE, TX_LOOKUP } txOpType;
+
+typedef struct txOp {
+	txOpType op;
+	type nodeType; /* type of the node created */
+	char *path;
+	char *dest; /* destination path of a move */
+} TxOp;
+
+int transaction(TxOp*, int, int*);
+
+#endif /* TRANSACTION_H */
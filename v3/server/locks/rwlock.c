@@ -2,26 +2,92 @@
  * SOURCE FILE OF GLOBAL LOCKS (MUTEX OR RWLOCK) TO FS
  */
 
+#include <time.h>
 #include "rwlock.h"
+#include "../trace.h"
+#include "../probes.h"
+#include "../fs/state.h"
 
-/* Creates a list with an array of rwlocks and number of rwlocks */
-Locks * list_create(int size){
-	Locks * locks = (Locks*) malloc(sizeof(Locks));
-    if(!locks){
-        fprintf(stderr, "Error: couldn't allocate memory for locks list.\n");
-        exit(EXIT_FAILURE);
-    }
-	locks->rwlocks = (pthread_rwlock_t**) malloc(size * sizeof(pthread_rwlock_t*));
-    if(!(locks->rwlocks)){
-        fprintf(stderr, "Error: couldn't allocate memory for locks array of pointers.\n");
-        exit(EXIT_FAILURE);
+/* Nanoseconds this thread waited for rwlocks held by other threads */
+static __thread uint64_t wait_time;
+
+/* return monotonic time in nanoseconds */
+static uint64_t now_ns(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Profile of the rwlocks, off unless rwlock_profile_start is called: an
+ * open addressing table keyed by the address of the rwlock, whose slots
+ * are claimed with a compare and swap and never released. Locks that find
+ * the table full are only counted in profile_dropped.
+ */
+static RwlockProfile * profiles;
+static int profile_size; /* power of two */
+static int profiling;
+static uint64_t profile_dropped;
+
+/* return profile of a rwlock, or NULL if the table is full */
+static RwlockProfile * profile_of(pthread_rwlock_t * rwlock){
+    unsigned int slot = (unsigned int) (((uintptr_t) rwlock >> 4) * 0x9E3779B97F4A7C15ULL >> 32);
+
+    for(int i = 0; i < profile_size; i++){
+        RwlockProfile * profile = &profiles[(slot + i) & (profile_size - 1)];
+        pthread_rwlock_t * key = __atomic_load_n(&profile->rwlock, __ATOMIC_RELAXED);
+
+        if(key == NULL && __atomic_compare_exchange_n(&profile->rwlock, &key, rwlock, false,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return profile;
+        if(key == rwlock)
+            return profile;
     }
+    __atomic_fetch_add(&profile_dropped, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/*
+ * Counts an attempt to take a rwlock.
+ * Input:
+ *  - rwlock: rwlock
+ *  - mode: RWLOCK_READ or RWLOCK_WRITE
+ *  - acquired: if the rwlock was taken
+ *  - contended: if it was held by another thread
+ *  - wait: nanoseconds waited for it
+ */
+static void profile_record(pthread_rwlock_t * rwlock, int mode, int acquired, int contended, uint64_t wait){
+    RwlockProfile * profile = profile_of(rwlock);
+    RwlockModeProfile * counters;
+    uint64_t max;
+
+    if(profile == NULL)
+        return;
+    counters = &profile->modes[mode];
+    if(acquired)
+        __atomic_fetch_add(&counters->acquired, 1, __ATOMIC_RELAXED);
+    if(!contended)
+        return;
+    __atomic_fetch_add(&counters->contended, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counters->wait_total, wait, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&counters->wait_max, __ATOMIC_RELAXED);
+    while(wait > max && !__atomic_compare_exchange_n(&counters->wait_max, &max, wait, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Initializes an empty list of rwlocks */
+void list_init(Locks * locks){
 	locks->num = 0;
-	return locks;
 }
 
 /* Add last rwlock address and increments number of locks */
 void list_add_lock(Locks * locks, pthread_rwlock_t * p_rwlock){
+    if(locks->num == MAX_LOCKS){
+        fprintf(stderr, "Error: too many locks in locks list.\n");
+        exit(EXIT_FAILURE);
+    }
     locks->rwlocks[locks->num] = p_rwlock;
     locks->num++;
 }
@@ -38,10 +104,17 @@ void list_unlock_all(Locks * locks){
 		rwlock_unlock(locks->rwlocks[i]);
 }
 
-/* Free memory associated to rwlocks array and list */
-void list_free(Locks * locks){
-    free(locks->rwlocks);
-    free(locks);
+/* Unlock the rwlock before the last one and remove it from the list */
+void list_release_previous(Locks * locks){
+    rwlock_unlock(locks->rwlocks[locks->num - 2]);
+    locks->rwlocks[locks->num - 2] = locks->rwlocks[locks->num - 1];
+    locks->num--;
+}
+
+/* Unlock every rwlock in locks list and empty it */
+void list_reset(Locks * locks){
+    list_unlock_all(locks);
+    locks->num = 0;
 }
 
 /* Locks (write) last rwlock of array */
@@ -71,11 +144,29 @@ void rwlock_init(pthread_rwlock_t* rwlock){
 /* Locks rwlock or mutex in order to read critical areas of access */
 /* Ignores EDEADLK error */
 void rwlock_read_lock(pthread_rwlock_t* rwlock){
-    int value = pthread_rwlock_rdlock(rwlock);
+    int value, contended;
+    uint64_t wait = 0;
+
+    if(tracing())
+        trace_lock(TFS_TRACE_LOCK_REQUEST, rwlock, RWLOCK_READ);
+    value = pthread_rwlock_tryrdlock(rwlock);
+    if((contended = value == EBUSY)){
+        /* only waits are timed */
+        uint64_t start = now_ns();
+        PROBE2(lock__wait__start, inode_of_lock(rwlock), RWLOCK_READ);
+        value = pthread_rwlock_rdlock(rwlock);
+        wait = now_ns() - start;
+        wait_time += wait;
+        PROBE3(lock__wait__end, inode_of_lock(rwlock), RWLOCK_READ, wait);
+    }
     if(value != 0 && value != EDEADLK){ /* ignores error EDEADLK in case of move command */  
         fprintf(stderr, "Error: Couldn't apply read lock to read-write lock.\n");
         exit(EXIT_FAILURE);
     }
+    if(value == 0 && __atomic_load_n(&profiling, __ATOMIC_RELAXED))
+        profile_record(rwlock, RWLOCK_READ, 1, contended, wait);
+    if(value == 0 && tracing())
+        trace_lock(TFS_TRACE_LOCK_ACQUIRED, rwlock, RWLOCK_READ);
 }
 
 /* 
@@ -89,6 +180,10 @@ int rwlock_try_write_lock(pthread_rwlock_t* rwlock){
         fprintf(stderr, "Error while trying to lock rwlock in order to write.\n");
         exit(EXIT_FAILURE);
     }
+    if(__atomic_load_n(&profiling, __ATOMIC_RELAXED))
+        profile_record(rwlock, RWLOCK_WRITE, value == 0, value == EBUSY, 0);
+    if(value == 0 && tracing())
+        trace_lock(TFS_TRACE_LOCK_ACQUIRED, rwlock, RWLOCK_WRITE);
     return value;  
 }
 
@@ -103,20 +198,126 @@ int rwlock_try_read_lock(pthread_rwlock_t* rwlock){
         fprintf(stderr, "Error while trying to lock rwlock in order to write.\n");
         exit(EXIT_FAILURE);
     }
+    if(__atomic_load_n(&profiling, __ATOMIC_RELAXED))
+        profile_record(rwlock, RWLOCK_READ, value == 0, value == EBUSY, 0);
+    if(value == 0 && tracing())
+        trace_lock(TFS_TRACE_LOCK_ACQUIRED, rwlock, RWLOCK_READ);
     return value; 
         
 }
 
 /* Locks rwlock or mutex in order to write in critical areas of acess. */
 void rwlock_write_lock(pthread_rwlock_t* rwlock){
-    if(pthread_rwlock_wrlock(rwlock) != 0){
+    int value, contended;
+    uint64_t wait = 0;
+
+    if(tracing())
+        trace_lock(TFS_TRACE_LOCK_REQUEST, rwlock, RWLOCK_WRITE);
+    value = pthread_rwlock_trywrlock(rwlock);
+    if((contended = value == EBUSY)){
+        uint64_t start = now_ns();
+        PROBE2(lock__wait__start, inode_of_lock(rwlock), RWLOCK_WRITE);
+        value = pthread_rwlock_wrlock(rwlock);
+        wait = now_ns() - start;
+        wait_time += wait;
+        PROBE3(lock__wait__end, inode_of_lock(rwlock), RWLOCK_WRITE, wait);
+    }
+    if(value != 0){
         fprintf(stderr, "Error: Couldn't apply write lock to read-write lock.\n");
         exit(EXIT_FAILURE);
     }
+    if(__atomic_load_n(&profiling, __ATOMIC_RELAXED))
+        profile_record(rwlock, RWLOCK_WRITE, 1, contended, wait);
+    if(tracing())
+        trace_lock(TFS_TRACE_LOCK_ACQUIRED, rwlock, RWLOCK_WRITE);
+}
+
+/* return nanoseconds the calling thread waited for rwlocks so far */
+uint64_t rwlock_wait_time(){
+    return wait_time;
+}
+
+/*
+ * Starts profiling the acquisitions of every rwlock. Must be called before
+ * other threads take rwlocks.
+ * Input:
+ *  - size: rwlocks profiled (rounded up to a power of two), the others
+ *    are counted as dropped
+ * Returns: 0, or -1 if there's no memory for the profile
+ */
+int rwlock_profile_start(int size){
+    for(profile_size = 1; profile_size < size; profile_size <<= 1)
+        ;
+    if((profiles = (RwlockProfile*) calloc(profile_size, sizeof(RwlockProfile))) == NULL)
+        return -1;
+    profile_dropped = 0;
+    __atomic_store_n(&profiling, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* return if the rwlocks are being profiled */
+int rwlock_profiling(){
+    return __atomic_load_n(&profiling, __ATOMIC_ACQUIRE);
+}
+
+/* return if a profile is more contended than another */
+static int profile_greater(RwlockProfile * a, RwlockProfile * b){
+    uint64_t contended_a = a->modes[RWLOCK_READ].contended + a->modes[RWLOCK_WRITE].contended;
+    uint64_t contended_b = b->modes[RWLOCK_READ].contended + b->modes[RWLOCK_WRITE].contended;
+
+    if(contended_a != contended_b)
+        return contended_a > contended_b;
+    return a->modes[RWLOCK_READ].wait_total + a->modes[RWLOCK_WRITE].wait_total >
+        b->modes[RWLOCK_READ].wait_total + b->modes[RWLOCK_WRITE].wait_total;
+}
+
+/*
+ * Copies the profiles of the most contended rwlocks, while they may still
+ * be updated (each counter is read once). Rwlocks never contended in
+ * either mode are left out.
+ * Input:
+ *  - top: array to store the profiles, by decreasing contention
+ *  - num: size of top
+ *  - dropped: pointer to store the attempts to take rwlocks not profiled
+ * Returns: number of profiles copied (0 if not profiling)
+ */
+int rwlock_profile_top(RwlockProfile * top, int num, uint64_t * dropped){
+    int found = 0;
+
+    *dropped = 0;
+    if(!rwlock_profiling())
+        return 0;
+    for(int i = 0; i < profile_size; i++){
+        RwlockProfile profile;
+        int j;
+
+        if((profile.rwlock = __atomic_load_n(&profiles[i].rwlock, __ATOMIC_RELAXED)) == NULL)
+            continue;
+        for(int mode = RWLOCK_READ; mode <= RWLOCK_WRITE; mode++){
+            RwlockModeProfile * counters = &profiles[i].modes[mode];
+            profile.modes[mode].acquired = __atomic_load_n(&counters->acquired, __ATOMIC_RELAXED);
+            profile.modes[mode].contended = __atomic_load_n(&counters->contended, __ATOMIC_RELAXED);
+            profile.modes[mode].wait_total = __atomic_load_n(&counters->wait_total, __ATOMIC_RELAXED);
+            profile.modes[mode].wait_max = __atomic_load_n(&counters->wait_max, __ATOMIC_RELAXED);
+        }
+        if(profile.modes[RWLOCK_READ].contended == 0 && profile.modes[RWLOCK_WRITE].contended == 0)
+            continue;
+
+        /* insertion in the sorted array */
+        if(found == num && (num == 0 || !profile_greater(&profile, &top[num - 1])))
+            continue;
+        for(j = found < num ? found++ : num - 1; j > 0 && profile_greater(&profile, &top[j - 1]); j--)
+            top[j] = top[j - 1];
+        top[j] = profile;
+    }
+    *dropped = __atomic_load_n(&profile_dropped, __ATOMIC_RELAXED);
+    return found;
 }
 
 /* Unlocks rwlock or mutex */
 void rwlock_unlock(pthread_rwlock_t* rwlock){
+    if(tracing())
+        trace_lock(TFS_TRACE_LOCK_RELEASED, rwlock, 0);
     if(pthread_rwlock_unlock(rwlock) != 0){
         fprintf(stderr, "Error: Couldn't unlock read-write lock.\n");
         exit(EXIT_FAILURE);
@@ -10,17 +10,40 @@
 #include <pthread.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+/* Maximum locks in a list (every component of two paths and their children) */
+#define MAX_LOCKS 104
 
 typedef struct{
-    pthread_rwlock_t ** rwlocks;
+    pthread_rwlock_t * rwlocks[MAX_LOCKS];
     int num;
 } Locks;
 
-Locks * list_create();
+/* Modes of the profile of a rwlock */
+#define RWLOCK_READ 0
+#define RWLOCK_WRITE 1
+
+/* Acquisitions of a rwlock in one mode. Contended ones found the lock held:
+ * they waited for it, or failed to try it */
+typedef struct rwlockModeProfile {
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t wait_total; /* nanoseconds */
+    uint64_t wait_max;
+} RwlockModeProfile;
+
+typedef struct rwlockProfile {
+    pthread_rwlock_t * rwlock;
+    RwlockModeProfile modes[2];
+} RwlockProfile;
+
+void list_init(Locks*);
 void list_add_lock(Locks*, pthread_rwlock_t*);
 void list_remove_lock(Locks*);
 void list_unlock_all(Locks*);
-void list_free(Locks*);
+void list_reset(Locks*);
+void list_release_previous(Locks*);
 void list_write_lock(Locks*);
 int list_try_write_lock(Locks*);
 void list_read_lock(Locks*);
@@ -29,6 +52,10 @@ void rwlock_read_lock(pthread_rwlock_t*);
 int rwlock_try_write_lock(pthread_rwlock_t*);
 int rwlock_try_read_lock(pthread_rwlock_t*);
 void rwlock_write_lock(pthread_rwlock_t*);
+uint64_t rwlock_wait_time();
+int rwlock_profile_start(int);
+int rwlock_profiling();
+int rwlock_profile_top(RwlockProfile*, int, uint64_t*);
 void rwlock_unlock(pthread_rwlock_t*);
 void rwlock_destroy(pthread_rwlock_t*);
 
@@ -0,0 +1,24 @@
+/*
+ * SOURCE FILE OF THE STATIC PROBES OF THE SERVER
+ *
+ * Semaphores of the probes (see probes.h), in the section where tracers
+ * look for them.
+ */
+
+#include "probes.h"
+
+#ifdef TFS_PROBES
+
+#define SEMAPHORE(name) \
+    unsigned short tecnicofs_##name##_semaphore __attribute__((section(".probes")))
+
+SEMAPHORE(request__start);
+SEMAPHORE(request__end);
+SEMAPHORE(lock__wait__start);
+SEMAPHORE(lock__wait__end);
+SEMAPHORE(inode__alloc);
+SEMAPHORE(inode__free);
+SEMAPHORE(print__start);
+SEMAPHORE(print__end);
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * HEADER FILE FOR THE STATIC PROBES OF THE SERVER
+ *
+ * USDT probes of provider tecnicofs, for perf, bpftrace and SystemTap.
+ * They are built when <sys/sdt.h> is available (systemtap-sdt-dev) unless
+ * TFS_NO_PROBES is defined, and are empty otherwise. Every probe has a
+ * semaphore, raised by the tracers attached to it, and its arguments are
+ * only computed while it is traced.
+ *
+ *  request__start(opcode, request_id, path, path2)
+ *  request__end(opcode, request_id, result)
+ *  lock__wait__start(inumber, mode)            mode: 0 read, 1 write
+ *  lock__wait__end(inumber, mode, nanoseconds)
+ *  inode__alloc(inumber)                       -1 if the table is full
+ *  inode__free(inumber)
+ *  print__start(filename)
+ *  print__end(filename, result)
+ *
+ * Transactions are requests with opcode TFS_OP_BATCH and the paths of
+ * their first operation. Paths are NUL-terminated strings, passed as
+ * pointers (an array argument would be passed as its contents).
+ */
+
+#ifndef _PROBES_
+#define _PROBES_
+
+#if !defined(TFS_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define TFS_PROBES
+#endif
+#endif
+
+#ifdef TFS_PROBES
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+extern unsigned short tecnicofs_request__start_semaphore;
+extern unsigned short tecnicofs_request__end_semaphore;
+extern unsigned short tecnicofs_lock__wait__start_semaphore;
+extern unsigned short tecnicofs_lock__wait__end_semaphore;
+extern unsigned short tecnicofs_inode__alloc_semaphore;
+extern unsigned short tecnicofs_inode__free_semaphore;
+extern unsigned short tecnicofs_print__start_semaphore;
+extern unsigned short tecnicofs_print__end_semaphore;
+
+/* return if a probe is traced */
+#define PROBE_ENABLED(name) __builtin_expect(__atomic_load_n(&tecnicofs_##name##_semaphore, __ATOMIC_RELAXED), 0)
+
+#define PROBE1(name, a) \
+    do{ if(PROBE_ENABLED(name)) DTRACE_PROBE1(tecnicofs, name, a); }while(0)
+#define PROBE2(name, a, b) \
+    do{ if(PROBE_ENABLED(name)) DTRACE_PROBE2(tecnicofs, name, a, b); }while(0)
+#define PROBE3(name, a, b, c) \
+    do{ if(PROBE_ENABLED(name)) DTRACE_PROBE3(tecnicofs, name, a, b, c); }while(0)
+#define PROBE4(name, a, b, c, d) \
+    do{ if(PROBE_ENABLED(name)) DTRACE_PROBE4(tecnicofs, name, a, b, c, d); }while(0)
+
+#else
+
+#define PROBE_ENABLED(name) 0
+#define PROBE1(name, a) do{ }while(0)
+#define PROBE2(name, a, b) do{ }while(0)
+#define PROBE3(name, a, b, c) do{ }while(0)
+#define PROBE4(name, a, b, c, d) do{ }while(0)
+
+#endif
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * SOURCE FILE OF THE MESSAGE QUEUE BETWEEN I/O THREADS AND WORKERS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "queue.h"
+#include "locks/mutex.h"
+#include "locks/conditions.h"
+
+/*
+ * Initializes a queue and allocates its messages.
+ * Input:
+ *  - queue: queue to initialize
+ *  - capacity: number of messages
+ */
+void queue_init(MessageQueue * queue, int capacity){
+    queue->pending = (Message**) malloc(sizeof(Message*) * capacity);
+    queue->pool = (Message**) malloc(sizeof(Message*) * capacity);
+    if(queue->pending == NULL || queue->pool == NULL){
+        fprintf(stderr, "Error: couldn't allocate memory for message queue.\n");
+        exit(EXIT_FAILURE);
+    }
+    for(int i = 0; i < capacity; i++)
+        if((queue->pool[i] = (Message*) malloc(sizeof(Message))) == NULL){
+            fprintf(stderr, "Error: couldn't allocate memory for message queue.\n");
+            exit(EXIT_FAILURE);
+        }
+
+    queue->capacity = queue->num_free = capacity;
+    queue->head = queue->num = queue->max_num = 0;
+    queue->waiting = 0;
+    queue->wakeups = 0;
+    mutex_init(&queue->mutex);
+    cond_init(&queue->not_empty);
+    cond_init(&queue->not_exhausted);
+}
+
+/*
+ * Takes free messages to receive into.
+ * Input:
+ *  - queue: queue
+ *  - messages: array to store the messages
+ *  - min: number of messages to wait for
+ *  - max: maximum number of messages to take
+ * Returns: number of messages taken
+ */
+int queue_alloc(MessageQueue * queue, Message ** messages, int min, int max){
+    int num;
+
+    mutex_lock(&queue->mutex);
+    while(queue->num_free < min)
+        cond_wait(&queue->not_exhausted, &queue->mutex);
+    num = queue->num_free < max ? queue->num_free : max;
+    for(int i = 0; i < num; i++)
+        messages[i] = queue->pool[--queue->num_free];
+    mutex_unlock(&queue->mutex);
+    return num;
+}
+
+/*
+ * Wakes up a waiting worker, if any.
+ * Must be called with the queue mutex locked.
+ */
+static void queue_wake_worker(MessageQueue * queue){
+    if(queue->waiting > 0){
+        queue->wakeups++;
+        cond_signal(&queue->not_empty);
+    }
+}
+
+/*
+ * Appends received messages, waking up one waiting worker for the batch.
+ */
+void queue_push(MessageQueue * queue, Message ** messages, int num){
+    mutex_lock(&queue->mutex);
+    for(int i = 0; i < num; i++)
+        queue->pending[(queue->head + queue->num++) % queue->capacity] = messages[i];
+    if(queue->num > queue->max_num)
+        queue->max_num = queue->num;
+    queue_wake_worker(queue);
+    mutex_unlock(&queue->mutex);
+}
+
+/*
+ * Takes received messages, waiting for at least one. A worker that leaves
+ * messages behind wakes up another one, so workers are only woken up when
+ * there is work for them.
+ * Input:
+ *  - queue: queue
+ *  - messages: array to store the messages
+ *  - max: maximum number of messages to take
+ * Returns: number of messages taken
+ */
+int queue_pop(MessageQueue * queue, Message ** messages, int max){
+    int num;
+
+    mutex_lock(&queue->mutex);
+    while(queue->num == 0){
+        queue->waiting++;
+        cond_wait(&queue->not_empty, &queue->mutex);
+        queue->waiting--;
+    }
+    num = queue->num < max ? queue->num : max;
+    for(int i = 0; i < num; i++){
+        messages[i] = queue->pending[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->num--;
+    }
+    if(queue->num > 0)
+        queue_wake_worker(queue);
+    mutex_unlock(&queue->mutex);
+    return num;
+}
+
+/*
+ * Returns handled messages to the pool.
+ */
+void queue_release(MessageQueue * queue, Message ** messages, int num){
+    mutex_lock(&queue->mutex);
+    for(int i = 0; i < num; i++)
+        queue->pool[queue->num_free++] = messages[i];
+    cond_broadcast(&queue->not_exhausted);
+    mutex_unlock(&queue->mutex);
+}
+
+/* return number of wake-ups of waiting workers */
+unsigned long queue_wakeups(MessageQueue * queue){
+    unsigned long wakeups;
+
+    mutex_lock(&queue->mutex);
+    wakeups = queue->wakeups;
+    mutex_unlock(&queue->mutex);
+    return wakeups;
+}
+
+/*
+ * Gets the number of messages waiting for a worker.
+ * Input:
+ *  - queue: queue
+ *  - max_num: pointer to store the largest number of them so far
+ * Returns: number of messages waiting
+ */
+int queue_depth(MessageQueue * queue, int * max_num){
+    int num;
+
+    mutex_lock(&queue->mutex);
+    num = queue->num;
+    *max_num = queue->max_num;
+    mutex_unlock(&queue->mutex);
+    return num;
+}
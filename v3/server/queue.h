@@ -0,0 +1,47 @@
+/*
+ * HEADER FILE FOR THE MESSAGE QUEUE
+ */
+
+#ifndef _QUEUE_
+#define _QUEUE_
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../tecnicofs-protocol.h"
+
+/* Datagram received from a client, with the address to answer to */
+typedef struct message {
+    struct sockaddr_un addr;
+    socklen_t addrlen;
+    int size;
+    char buffer[TFS_MAX_BATCH_REQUEST_SIZE + 1];
+} Message;
+
+/*
+ * Messages received by I/O threads and waiting for a worker, and a pool of
+ * free messages to receive into. Messages are moved in batches: one lock
+ * and at most one wake-up per batch.
+ */
+typedef struct messageQueue {
+    Message ** pending; /* ring of received messages */
+    int head, num;
+    int max_num; /* largest number of pending messages */
+    Message ** pool; /* free messages */
+    int num_free;
+    int capacity;
+    int waiting; /* workers waiting for messages */
+    unsigned long wakeups;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty, not_exhausted;
+} MessageQueue;
+
+void queue_init(MessageQueue*, int);
+int queue_alloc(MessageQueue*, Message**, int, int);
+void queue_push(MessageQueue*, Message**, int);
+int queue_pop(MessageQueue*, Message**, int);
+void queue_release(MessageQueue*, Message**, int);
+unsigned long queue_wakeups(MessageQueue*);
+int queue_depth(MessageQueue*, int*);
+
+#endif
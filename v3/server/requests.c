@@ -0,0 +1,131 @@
+/*
+ * SOURCE FILE OF THE EXECUTION OF DECODED REQUESTS
+ */
+
+#include "requests.h"
+#include "stats.h"
+#include "trace.h"
+#include "probes.h"
+
+/* Handlers of the requests, indexed by opcode */
+int handle_create(TfsRequest * request){
+    return create(request->args[0], request->flags & TFS_FLAG_DIRECTORY ? T_DIRECTORY : T_FILE);
+}
+
+int handle_delete(TfsRequest * request){
+    return delete(request->args[0]);
+}
+
+int handle_lookup(TfsRequest * request){
+    return lookup(request->args[0]);
+}
+
+int handle_move(TfsRequest * request){
+    return move(request->args[0], request->args[1]);
+}
+
+/* prints a snapshot, other threads keep running */
+int handle_print(TfsRequest * request){
+    return print_tecnicofs_tree(request->args[0]);
+}
+
+int handle_locks(TfsRequest * request){
+    return print_lock_profile(request->args[0]);
+}
+
+int handle_trace(TfsRequest * request){
+    return trace_control(request->args[0]);
+}
+
+typedef int (*request_handler)(TfsRequest*);
+
+static const request_handler handlers[TFS_OP_MAX] = {
+    [TFS_OP_CREATE] = handle_create,
+    [TFS_OP_DELETE] = handle_delete,
+    [TFS_OP_LOOKUP] = handle_lookup,
+    [TFS_OP_MOVE] = handle_move,
+    [TFS_OP_PRINT] = handle_print,
+    [TFS_OP_LOCKS] = handle_locks,
+    [TFS_OP_TRACE] = handle_trace,
+};
+
+/*
+ * Executes a decoded request and records its latency.
+ * Returns: result of the request (TECNICOFS_ERROR_OTHER if invalid)
+ */
+int apply_request(TfsRequest * request){
+    uint64_t start, wait;
+    int result;
+
+    if(request->opcode <= 0 || request->opcode >= TFS_OP_MAX || handlers[request->opcode] == NULL)
+        return TECNICOFS_ERROR_OTHER;
+    PROBE4(request__start, request->opcode, request->request_id, (char*) request->args[0], (char*) request->args[1]);
+    if(tracing())
+        trace_begin(request->opcode, request->request_id);
+    start = stats_begin(&wait);
+    result = handlers[request->opcode](request);
+    stats_end(request->opcode, start, wait, result);
+    if(tracing())
+        trace_end(result);
+    PROBE3(request__end, request->opcode, request->request_id, result);
+    return result;
+}
+
+/*
+ * Applies the operations of a transaction as a unit, recorded as one
+ * TFS_OP_BATCH request.
+ * Input:
+ *  - ops: decoded operations
+ *  - num: number of operations
+ *  - results: array to store the result of each operation
+ */
+void apply_transaction(TfsRequest * ops, int num, int * results){
+    TxOp tx_ops[TFS_MAX_BATCH];
+    uint64_t start, wait;
+    int result = SUCCESS;
+
+    for(int i = 0; i < num; i++){
+        tx_ops[i].nodeType = ops[i].flags & TFS_FLAG_DIRECTORY ? T_DIRECTORY : T_FILE;
+        tx_ops[i].path = ops[i].args[0];
+        tx_ops[i].dest = ops[i].args[1];
+        switch(ops[i].opcode){
+            case TFS_OP_CREATE: tx_ops[i].op = TX_CREATE; break;
+            case TFS_OP_DELETE: tx_ops[i].op = TX_DELETE; break;
+            case TFS_OP_MOVE: tx_ops[i].op = TX_MOVE; break;
+            case TFS_OP_LOOKUP: tx_ops[i].op = TX_LOOKUP; break;
+            default:
+                /* can't be part of a transaction */
+                for(int j = 0; j < num; j++)
+                    results[j] = TECNICOFS_ERROR_OTHER;
+                return;
+        }
+    }
+    PROBE4(request__start, TFS_OP_BATCH, ops[0].request_id, (char*) ops[0].args[0], (char*) ops[0].args[1]);
+    if(tracing())
+        trace_begin(TFS_OP_BATCH, ops[0].request_id);
+    start = stats_begin(&wait);
+    transaction(tx_ops, num, results);
+    for(int i = 0; i < num && result == SUCCESS; i++)
+        result = results[i] < 0 ? results[i] : SUCCESS;
+    stats_end(TFS_OP_BATCH, start, wait, result);
+    if(tracing())
+        trace_end(result);
+    PROBE3(request__end, TFS_OP_BATCH, ops[0].request_id, result);
+}
+
+/*
+ * Executes the operations of a batch, in order, or as a unit if it is a
+ * transaction.
+ * Input:
+ *  - ops: decoded operations
+ *  - num: number of operations
+ *  - flags: flags of the batch (TFS_FLAG_ATOMIC)
+ *  - results: array to store the result of each operation
+ */
+void apply_batch_requests(TfsRequest * ops, int num, uint8_t flags, int * results){
+    if(flags & TFS_FLAG_ATOMIC)
+        apply_transaction(ops, num, results);
+    else
+        for(int i = 0; i < num; i++)
+            results[i] = apply_request(&ops[i]);
+}
@@ -0,0 +1,15 @@
+/*
+ * HEADER FILE FOR THE EXECUTION OF DECODED REQUESTS
+ */
+
+#ifndef _REQUESTS_
+#define _REQUESTS_
+
+#include "fs/operations.h"
+#include "../tecnicofs-protocol.h"
+
+int apply_request(TfsRequest*);
+void apply_transaction(TfsRequest*, int, int*);
+void apply_batch_requests(TfsRequest*, int, uint8_t, int*);
+
+#endif
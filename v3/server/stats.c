@@ -0,0 +1,174 @@
+/*
+ * SOURCE FILE OF THE STATISTICS OF THE REQUESTS
+ *
+ * Every thread executing requests records their latencies in histograms
+ * of its own, without locks, and they are merged when the statistics are
+ * collected. The time a request waited for i-node locks (see
+ * rwlock_wait_time) is recorded apart from the time it worked. A thread
+ * that exits leaves its histograms to the next thread that starts
+ * recording.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "stats.h"
+#include "locks/mutex.h"
+#include "locks/rwlock.h"
+
+typedef struct opHistograms {
+    TfsHistogram latency, wait, work;
+    uint64_t errors;
+} OpHistograms;
+
+typedef struct threadStats {
+    OpHistograms ops[TFS_OP_MAX];
+    int in_use; /* by a running thread */
+} ThreadStats;
+
+static ThreadStats * threads[STATS_MAX_THREADS];
+static int num_threads;
+static pthread_mutex_t threads_mutex;
+static pthread_key_t threads_key;
+static uint64_t start_time;
+
+/* histograms of this thread, NULL until it records a request */
+static __thread ThreadStats * local;
+
+/* return monotonic time in nanoseconds */
+static uint64_t now_ns(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* frees the histograms of an exiting thread for another one */
+static void release_thread(void * stats){
+    mutex_lock(&threads_mutex);
+    ((ThreadStats*) stats)->in_use = 0;
+    mutex_unlock(&threads_mutex);
+}
+
+/*
+ * Takes histograms for the calling thread: free ones, or new ones.
+ * Returns: histograms, or NULL if STATS_MAX_THREADS threads have them
+ */
+static ThreadStats * take_thread_stats(){
+    ThreadStats * stats = NULL;
+
+    mutex_lock(&threads_mutex);
+    for(int i = 0; i < num_threads && stats == NULL; i++)
+        if(!threads[i]->in_use)
+            stats = threads[i];
+    if(stats == NULL && num_threads < STATS_MAX_THREADS &&
+            (stats = (ThreadStats*) calloc(1, sizeof(ThreadStats))) != NULL)
+        threads[num_threads++] = stats;
+    if(stats != NULL){
+        stats->in_use = 1;
+        pthread_setspecific(threads_key, stats);
+    }
+    mutex_unlock(&threads_mutex);
+    return stats;
+}
+
+/*
+ * Starts counting the uptime. Must be called before any request is
+ * recorded.
+ */
+void stats_init(){
+    mutex_init(&threads_mutex);
+    if(pthread_key_create(&threads_key, release_thread) != 0){
+        fprintf(stderr, "Error: couldn't create key of thread statistics.\n");
+        exit(EXIT_FAILURE);
+    }
+    start_time = now_ns();
+}
+
+/*
+ * Marks the start of a request.
+ * Input:
+ *  - wait: pointer to store the lock wait time of the thread so far
+ * Returns: start time, for stats_end
+ */
+uint64_t stats_begin(uint64_t * wait){
+    *wait = rwlock_wait_time();
+    return now_ns();
+}
+
+/*
+ * Records an executed request.
+ * Input:
+ *  - opcode: operation (TFS_OP_BATCH for a transaction)
+ *  - start, wait: as given by stats_begin
+ *  - result: result of the request
+ */
+void stats_end(int opcode, uint64_t start, uint64_t wait, int result){
+    uint64_t latency = now_ns() - start;
+    OpHistograms * op;
+
+    wait = rwlock_wait_time() - wait;
+    if(local == NULL && (local = take_thread_stats()) == NULL)
+        return;
+
+    op = &local->ops[opcode];
+    tfs_hist_record(&op->latency, latency);
+    tfs_hist_record(&op->wait, wait);
+    tfs_hist_record(&op->work, latency > wait ? latency - wait : 0);
+    if(result < 0)
+        __atomic_store_n(&op->errors, op->errors + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Merges the histograms of every thread into statistics.
+ * Input:
+ *  - stats: statistics to fill (the fields of the queue are 0)
+ */
+void stats_collect(TfsStats * stats){
+    TfsHistogram latency, wait, work;
+    int num;
+
+    memset(stats, 0, sizeof(TfsStats));
+    stats->uptime = now_ns() - start_time;
+    mutex_lock(&threads_mutex);
+    num = num_threads;
+    mutex_unlock(&threads_mutex);
+    stats->threads = num;
+
+    for(int opcode = 0; opcode < TFS_OP_MAX; opcode++){
+        TfsOpStats * op = &stats->ops[opcode];
+
+        tfs_hist_init(&latency);
+        tfs_hist_init(&wait);
+        tfs_hist_init(&work);
+        for(int i = 0; i < num; i++){
+            tfs_hist_merge(&latency, &threads[i]->ops[opcode].latency);
+            tfs_hist_merge(&wait, &threads[i]->ops[opcode].wait);
+            tfs_hist_merge(&work, &threads[i]->ops[opcode].work);
+            op->errors += __atomic_load_n(&threads[i]->ops[opcode].errors, __ATOMIC_RELAXED);
+        }
+        op->count = latency.count;
+        op->latency_p50 = tfs_hist_percentile(&latency, 50);
+        op->latency_p99 = tfs_hist_percentile(&latency, 99);
+        op->latency_p999 = tfs_hist_percentile(&latency, 99.9);
+        op->latency_max = latency.max;
+        op->wait_mean = (uint64_t) tfs_hist_mean(&wait);
+        op->wait_p99 = tfs_hist_percentile(&wait, 99);
+        op->work_mean = (uint64_t) tfs_hist_mean(&work);
+        op->work_p99 = tfs_hist_percentile(&work, 99);
+    }
+}
+
+/*
+ * Frees the histograms of every thread.
+ */
+void stats_destroy(){
+    for(int i = 0; i < num_threads; i++)
+        free(threads[i]);
+    num_threads = 0;
+    local = NULL;
+    pthread_key_delete(threads_key);
+    mutex_destroy(&threads_mutex);
+}
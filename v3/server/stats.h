@@ -0,0 +1,22 @@
+/*
+ * HEADER FILE FOR THE STATISTICS OF THE REQUESTS
+ */
+
+#ifndef _STATS_
+#define _STATS_
+
+#include <stdint.h>
+#include "../tecnicofs-protocol.h"
+#include "../tecnicofs-histogram.h"
+
+/* Threads recording statistics at once (the requests of others aren't
+ * counted) */
+#define STATS_MAX_THREADS 256
+
+void stats_init();
+uint64_t stats_begin(uint64_t*);
+void stats_end(int, uint64_t, uint64_t, int);
+void stats_collect(TfsStats*);
+void stats_destroy();
+
+#endif
@@ -0,0 +1,364 @@
+/*
+ *
+ * TecnicoFS file system benchmark
+ * Runs the fs operations in-process, without sockets.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "fs/operations.h"
+#include "../tecnicofs-api-constants.h"
+
+/* fanout of the generated tree (every directory is filled up) */
+#define BENCH_FANOUT 20
+
+/* number of lookups done by the lookup benchmark */
+#define BENCH_LOOKUPS 1000000
+
+/* number of rounds measured by the churn benchmark (after one warm-up round) */
+#define BENCH_CHURN_ROUNDS 100
+
+/* moves done by each thread of the move benchmark, and nodes each one moves */
+#define BENCH_MOVES 100000
+#define BENCH_MOVE_NODES 4
+#define BENCH_DIR_NAME 32
+
+/*
+ * Heap allocations made by the file system. The benchmark is linked with
+ * --wrap=malloc (and calloc, realloc), so calls from our own objects land
+ * here while libc internals are not counted.
+ */
+static unsigned long allocations;
+
+void * __real_malloc(size_t);
+void * __real_calloc(size_t, size_t);
+void * __real_realloc(void*, size_t);
+
+void * __wrap_malloc(size_t size){
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t num, size_t size){
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(num, size);
+}
+
+void * __wrap_realloc(void * ptr, size_t size){
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+void display_usage(char* appName){
+    fprintf(stderr, "Usage: %s [-c] create numinodes [maxinodes]\n", appName);
+    fprintf(stderr, "       %s [-c] lookup numentries [maxinodes]\n", appName);
+    fprintf(stderr, "       %s [-c] churn numdirs [maxinodes]\n", appName);
+    fprintf(stderr, "       %s [-c] move numdirs [numthreads]\n", appName);
+    fprintf(stderr, "  -c: lock coupling traversal\n");
+    exit(EXIT_FAILURE);
+}
+
+/* return current time in seconds */
+double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Builds the path of a node of the generated tree. Nodes are numbered in
+ * breadth-first order (root is 0), so node k is child number (k-1) % fanout
+ * of node (k-1) / fanout.
+ * Input:
+ *  - node: number of the node
+ *  - path: buffer of size MAX_FILE_NAME to store the path
+ */
+void bench_node_path(long node, char * path){
+    char name[MAX_FILE_NAME];
+
+    path[0] = '\0';
+    while(node > 0){
+        snprintf(name, sizeof(name), "/%ld%s", (node - 1) % BENCH_FANOUT, path);
+        strcpy(path, name);
+        node = (node - 1) / BENCH_FANOUT;
+    }
+}
+
+/*
+ * Creates a full tree with num_inodes i-nodes (root included), where inner
+ * nodes are directories and leaves are files.
+ */
+int bench_create(long num_inodes){
+    char path[MAX_FILE_NAME];
+    double begin, duration;
+
+    begin = now();
+    for(long node = 1; node < num_inodes; node++){
+        bench_node_path(node, path);
+        type nodeType = node * BENCH_FANOUT + 1 < num_inodes ? T_DIRECTORY : T_FILE;
+        if(create(path, nodeType) != SUCCESS){
+            fprintf(stderr, "create: failed at %s (%ld i-nodes)\n", path, node);
+            return FAIL;
+        }
+    }
+    duration = now() - begin;
+
+    printf("create: %ld i-nodes in %0.4f seconds (%0.0f ops/s)\n",
+        num_inodes - 1, duration, (num_inodes - 1) / duration);
+    return SUCCESS;
+}
+
+/*
+ * Creates num_entries files in the root directory and looks them up.
+ */
+int bench_lookup(long num_entries){
+    char path[MAX_FILE_NAME];
+    double begin, duration;
+
+    for(long entry = 0; entry < num_entries; entry++){
+        snprintf(path, sizeof(path), "/f%ld", entry);
+        if(create(path, T_FILE) != SUCCESS){
+            fprintf(stderr, "lookup: failed to create %s\n", path);
+            return FAIL;
+        }
+    }
+
+    begin = now();
+    for(long i = 0; i < BENCH_LOOKUPS; i++){
+        snprintf(path, sizeof(path), "/f%ld", (i * 7919) % num_entries);
+        if(lookup(path) < 0){
+            fprintf(stderr, "lookup: %s not found\n", path);
+            return FAIL;
+        }
+    }
+    duration = now() - begin;
+
+    printf("lookup: %d lookups in a directory with %ld entries in %0.4f seconds (%0.1f ns/op)\n",
+        BENCH_LOOKUPS, num_entries, duration, duration * 1e9 / BENCH_LOOKUPS);
+
+    DcacheStats stats;
+    dcache_get_stats(&stats);
+    printf("lookup: dentry cache %lu hits, %lu misses\n", stats.hits, stats.misses);
+
+    unsigned long attempts, successes;
+    get_optimistic_stats(&attempts, &successes);
+    printf("lookup: %lu of %lu optimistic lookups succeeded\n", successes, attempts);
+    return SUCCESS;
+}
+
+/*
+ * Runs one round of the churn benchmark: in every directory creates a file
+ * and a subdirectory, looks the file up, moves it to the next directory and
+ * deletes both.
+ * Returns: number of operations or FAIL
+ */
+long bench_churn_round(long num_dirs){
+    char path[MAX_FILE_NAME], dest[MAX_FILE_NAME];
+    long ops = 0;
+
+    for(long dir = 0; dir < num_dirs; dir++){
+        snprintf(path, sizeof(path), "/d%06ld/s", dir);
+        if(create(path, T_DIRECTORY) != SUCCESS || delete(path) != SUCCESS)
+            return FAIL;
+
+        snprintf(path, sizeof(path), "/d%06ld/f", dir);
+        snprintf(dest, sizeof(dest), "/d%06ld/g", (dir + 1) % num_dirs);
+        if(create(path, T_FILE) != SUCCESS || lookup(path) < 0 ||
+            move(path, dest) != SUCCESS || delete(dest) != SUCCESS)
+            return FAIL;
+        ops += 6;
+    }
+    return ops;
+}
+
+/*
+ * Creates num_dirs directories and churns files in them, counting the heap
+ * allocations made after a warm-up round.
+ */
+int bench_churn(long num_dirs){
+    char path[MAX_FILE_NAME];
+    double begin, duration;
+    long ops = 0, round_ops;
+    unsigned long warm_allocations;
+
+    for(long dir = 0; dir < num_dirs; dir++){
+        snprintf(path, sizeof(path), "/d%06ld", dir);
+        if(create(path, T_DIRECTORY) != SUCCESS){
+            fprintf(stderr, "churn: failed to create %s\n", path);
+            return FAIL;
+        }
+    }
+
+    if(bench_churn_round(num_dirs) == FAIL){
+        fprintf(stderr, "churn: warm-up round failed\n");
+        return FAIL;
+    }
+
+    warm_allocations = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    begin = now();
+    for(int round = 0; round < BENCH_CHURN_ROUNDS; round++){
+        if((round_ops = bench_churn_round(num_dirs)) == FAIL){
+            fprintf(stderr, "churn: round %d failed\n", round);
+            return FAIL;
+        }
+        ops += round_ops;
+    }
+    duration = now() - begin;
+    warm_allocations = __atomic_load_n(&allocations, __ATOMIC_RELAXED) - warm_allocations;
+
+    printf("churn: %ld ops in %0.4f seconds (%0.0f ops/s)\n", ops, duration, ops / duration);
+    printf("churn: %lu heap allocations after warm-up (%0.4f per op)\n",
+        warm_allocations, (double) warm_allocations / ops);
+    return SUCCESS;
+}
+
+/* directories of the move benchmark are /aN and /aN/b */
+void bench_move_dir(long dir, char * path){
+    if(dir % 2 == 0)
+        snprintf(path, BENCH_DIR_NAME, "/a%03ld", dir / 2);
+    else
+        snprintf(path, BENCH_DIR_NAME, "/a%03ld/b", dir / 2);
+}
+
+typedef struct {
+    long num_dirs;
+    int thread;
+    long failed;
+    double max_latency;
+} MoveBenchArgs;
+
+/*
+ * Moves the nodes of a thread (files and a directory with a file inside)
+ * between random directories.
+ */
+void * bench_move_thread(void * arg){
+    MoveBenchArgs * args = (MoveBenchArgs*) arg;
+    char from[MAX_FILE_NAME], to[MAX_FILE_NAME], dir[BENCH_DIR_NAME];
+    long location[BENCH_MOVE_NODES];
+    unsigned int seed = args->thread;
+
+    for(int node = 0; node < BENCH_MOVE_NODES; node++)
+        location[node] = (args->thread + node) % args->num_dirs;
+
+    for(long i = 0; i < BENCH_MOVES; i++){
+        int node = i % BENCH_MOVE_NODES;
+        long dest = rand_r(&seed) % args->num_dirs;
+        if(dest == location[node])
+            dest = (dest + 1) % args->num_dirs;
+
+        bench_move_dir(location[node], dir);
+        snprintf(from, sizeof(from), "%s/t%dn%d", dir, args->thread, node);
+        bench_move_dir(dest, dir);
+        snprintf(to, sizeof(to), "%s/t%dn%d", dir, args->thread, node);
+
+        double begin = now();
+        if(move(from, to) != SUCCESS)
+            args->failed++;
+        else
+            location[node] = dest;
+        double latency = now() - begin;
+        if(latency > args->max_latency)
+            args->max_latency = latency;
+    }
+    return NULL;
+}
+
+/*
+ * Moves nodes across directories from many threads.
+ */
+int bench_move(long num_dirs, int num_threads){
+    char path[MAX_FILE_NAME], dir[BENCH_DIR_NAME];
+    pthread_t threads[num_threads];
+    MoveBenchArgs args[num_threads];
+    double begin, duration, max_latency = 0;
+    long failed = 0;
+
+    num_dirs += num_dirs % 2;
+    for(long d = 0; d < num_dirs; d++){
+        bench_move_dir(d, path);
+        if(create(path, T_DIRECTORY) != SUCCESS){
+            fprintf(stderr, "move: failed to create %s\n", path);
+            return FAIL;
+        }
+    }
+
+    /* node 0 of each thread is a directory, the others are files */
+    for(int t = 0; t < num_threads; t++){
+        for(int node = 0; node < BENCH_MOVE_NODES; node++){
+            bench_move_dir((t + node) % num_dirs, dir);
+            snprintf(path, sizeof(path), "%s/t%dn%d", dir, t, node);
+            if(create(path, node == 0 ? T_DIRECTORY : T_FILE) != SUCCESS)
+                return FAIL;
+            if(node == 0){
+                strcat(path, "/f");
+                if(create(path, T_FILE) != SUCCESS)
+                    return FAIL;
+            }
+        }
+    }
+
+    begin = now();
+    for(int t = 0; t < num_threads; t++){
+        args[t] = (MoveBenchArgs) { .num_dirs = num_dirs, .thread = t, .failed = 0, .max_latency = 0 };
+        if(pthread_create(&threads[t], NULL, bench_move_thread, &args[t]) != 0){
+            fprintf(stderr, "move: error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for(int t = 0; t < num_threads; t++){
+        pthread_join(threads[t], NULL);
+        failed += args[t].failed;
+        if(args[t].max_latency > max_latency)
+            max_latency = args[t].max_latency;
+    }
+    duration = now() - begin;
+
+    long ops = (long) num_threads * BENCH_MOVES;
+    printf("move: %ld moves by %d threads in %0.4f seconds (%0.0f ops/s)\n", ops, num_threads, duration, ops / duration);
+    printf("move: max latency %0.1f us, %ld failed\n", max_latency * 1e6, failed);
+    return failed == 0 ? SUCCESS : FAIL;
+}
+
+int main(int argc, char* argv[]) {
+    char * appName = argv[0];
+    int result = FAIL;
+    bool coupling = false;
+
+    if(argc > 1 && strcmp(argv[1], "-c") == 0){
+        coupling = true;
+        argc--;
+        argv++;
+    }
+
+    if(argc < 3 || argc > 4)
+        display_usage(appName);
+
+    long num_inodes = atol(argv[2]);
+    int max_inodes = argc == 4 ? atoi(argv[3]) : 0;
+    int num_threads = argc == 4 ? atoi(argv[3]) : 1;
+
+    if(num_inodes <= 0)
+        display_usage(appName);
+
+    init_fs(strcmp(argv[1], "move") == 0 ? 0 : max_inodes);
+    set_lock_coupling(coupling);
+
+    if(strcmp(argv[1], "create") == 0)
+        result = bench_create(num_inodes);
+    else if(strcmp(argv[1], "lookup") == 0)
+        result = bench_lookup(num_inodes);
+    else if(strcmp(argv[1], "churn") == 0)
+        result = bench_churn(num_inodes);
+    else if(strcmp(argv[1], "move") == 0 && num_threads > 0)
+        result = bench_move(num_inodes, num_threads);
+    else
+        display_usage(appName);
+
+    destroy_fs();
+    exit(result == SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -4,12 +4,17 @@
  * 
  */
 
+/* recvmmsg and sendmmsg */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <signal.h>
 #include <sys/time.h>
 
 #include <stdio.h>
@@ -21,13 +26,77 @@
 #include <sys/uio.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <errno.h>
 
 #include "fs/operations.h"
 #include "locks/mutex.h"
 #include "locks/conditions.h"
 #include "../tecnicofs-api-constants.h"
+#include "../tecnicofs-protocol.h"
+#include "../tecnicofs-shm.h"
+#include "requests.h"
+#include "stats.h"
+#include "trace.h"
+#include "queue.h"
+#include "uring.h"
+
+/* Concurrency models of the server */
+#define MODE_THREADS 0 /* every worker receives and answers datagrams */
+#define MODE_QUEUE 1 /* I/O threads receive batches of datagrams for the workers */
+#define MODE_EVENT 2 /* event loops execute short requests and queue long ones */
+#define MODE_URING 3 /* as event mode, with the I/O of each loop done through io_uring */
+
+static char * mode_names[] = {"threads", "queue", "event", "uring"};
+
+/* Datagrams received or sent per system call, in queue and event modes */
+#define IO_BATCH 64
+/* Requests executed, and responses sent per system call, by a worker in
+ * queue and event modes (larger batches are shared with other workers) */
+#define WORKER_BATCH 16
+/* Received datagrams waiting for a worker (besides the ones each I/O thread
+ * keeps to receive into) */
+#define QUEUE_SIZE 256
+
+/* Entries of the submission queue of each io_uring loop */
+#define URING_ENTRIES 256
+/* Buffers provided to the multishot receive of each loop, each holding the
+ * receive header, the client address and a datagram */
+#define URING_BUFFERS 64
+#define URING_BUFFER_SIZE (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_un) + \
+    TFS_MAX_BATCH_REQUEST_SIZE + 1)
+/* Responses each loop may be sending at the same time */
+#define URING_SENDS 128
+/* user_data of the receive completions (sends have the index of their slot) */
+#define URING_RECEIVE ((__u64) -1)
+
+/* Milliseconds a shared-memory session sleeps before checking if its
+ * client is still connected */
+#define SHM_TIMEOUT 100
+/* Shared-memory sessions served at once by default, each by a thread */
+#define SHM_DEFAULT_SESSIONS 16
 
 int numberThreads = 0;
+int maxInodes = 0;
+int serverMode = MODE_THREADS;
+int ioThreads = 0; /* default: 1 in queue mode, one per core in event and uring modes */
+int namespaceSize = 0; /* slots of the published namespace, 0 if not published */
+int lockProfileTop = 0; /* i-nodes listed by lock profiles, 0 if not profiling */
+int traceOnStart = 0;
+int shmSessions = 0; /* shared-memory sessions served at once, 0 if not accepted */
+int verbose = 0; /* print every text request received */
+
+/* I/O of each thread, in its own cache line */
+typedef struct ioStats {
+    unsigned long receive_calls, received;
+    unsigned long send_calls, sent;
+    unsigned long dropped; /* responses to clients that were gone */
+    unsigned long wait_calls; /* epoll_wait in event mode, io_uring_enter in uring mode */
+} __attribute__((aligned(64))) IoStats;
+
+IoStats * io_stats;
+MessageQueue queue;
 
 /* server socket variables */
 char * socketName;
@@ -36,13 +105,17 @@ int sockfd;
 struct sockaddr_un server_addr;
 socklen_t server_addrlen;
 
-/* variables and conditional variables */
-int threads_waiting_client = 0; // represents if a thread is waiting for a client message
-int printing = 0; // represents if one of the threads is currently printing a tree
-pthread_mutex_t commands_mutex;
-pthread_mutex_t counting_mutex;
-pthread_cond_t process_commands;
+/* socket where clients attach shared-memory sessions */
+char shm_socket_path[MAX_INPUT_SIZE + sizeof(TFS_SHM_SUFFIX)];
+int shm_sockfd = -1;
+unsigned long shm_sessions, shm_refused, shm_requests;
+int shm_active; /* sessions being served */
 
+/* Shared-memory session of a client, and its connection */
+typedef struct shmClient {
+    TfsShmSession * session;
+    int connfd;
+} ShmClient;
 
 
 /* write error message into stdin and exit program */
@@ -51,74 +124,213 @@ void exit_with_error(const char* err_msg){
     exit(EXIT_FAILURE);
 }
 
+/*
+ * Checks if a response couldn't be sent because its client is gone (its
+ * socket was closed or removed), in which case it is dropped: the server
+ * must keep serving the other clients.
+ */
+int client_gone(int error){
+    return error == ENOENT || error == ECONNREFUSED;
+}
+
 void error_parse(){
     fprintf(stderr, "Error: command invalid\n");
     exit(EXIT_FAILURE);
 }
 
 void display_usage(char* appName){
-    fprintf(stderr, "Usage: %s numthreads socketname\n", appName);
+    fprintf(stderr, "Usage: %s [options] numthreads socketname [maxinodes]\n", appName);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -c, --lock-coupling  release ancestor locks while traversing paths\n");
+    fprintf(stderr, "  --dcache=ENTRIES     entries of the dentry cache (default one per i-node,\n");
+    fprintf(stderr, "                       up to %d)\n", DCACHE_DEFAULT_MAX_ENTRIES);
+    fprintf(stderr, "  --publish[=SLOTS]    publish the namespace in shared memory, in a table of\n");
+    fprintf(stderr, "                       SLOTS entries (a power of two, default %d), so that\n", NSMAP_DEFAULT_SIZE);
+    fprintf(stderr, "                       clients resolve lookups without requests\n");
+    fprintf(stderr, "  --shm[=SESSIONS]     accept shared-memory sessions, up to SESSIONS at once\n");
+    fprintf(stderr, "                       (default %d), each served by a thread\n", SHM_DEFAULT_SESSIONS);
+    fprintf(stderr, "  --mode=MODE          threads (default): every thread receives requests\n");
+    fprintf(stderr, "                       queue: I/O threads receive requests for the workers\n");
+    fprintf(stderr, "                       event: event loops execute short requests and queue\n");
+    fprintf(stderr, "                       moves, prints and batches for the workers\n");
+    fprintf(stderr, "                       uring: as event, receiving and sending through io_uring\n");
+    fprintf(stderr, "                       (falls back to event if io_uring is not available)\n");
+    fprintf(stderr, "  --io-threads=N       number of I/O threads in queue mode (default 1), or of\n");
+    fprintf(stderr, "                       event loops in event and uring modes (default one per core)\n");
+    fprintf(stderr, "  --lock-profile[=N]   profile the i-node locks, listing the N most contended\n");
+    fprintf(stderr, "                       (default %d) on 'k file' commands and at exit\n", LOCK_PROFILE_DEFAULT_TOP);
+    fprintf(stderr, "  -v, --verbose        print every text request received\n");
+    fprintf(stderr, "  --trace              record the trace of the requests from the start, as\n");
+    fprintf(stderr, "                       't on' does ('t off' stops it, 't file' writes it)\n");
+    fprintf(stderr, "Statistics are printed when the server receives SIGINT or SIGTERM.\n");
     exit(EXIT_FAILURE);
 }
 
-int apply_commands(char * command){
-    int result = FAIL;
-    char token, type;
-    char arg1[MAX_INPUT_SIZE], arg2[MAX_INPUT_SIZE];
-    sscanf(command, "%c %s", &token, arg1);
-    switch (token) {
-        case 'c':
-            sscanf(command, "%c %s %c", &token, arg1, &type);
-            switch (type) {
-                case 'f':
-                    result  = create(arg1, T_FILE);
-                    break;
-                case 'd':
-                    result  = create(arg1, T_DIRECTORY);
-                    break;
-            }
-            break;
-        case 'l':
-            result  = lookup(arg1);
-            break;
+/*
+ * Executes the operations of a batch, in order (as a unit if it is a
+ * transaction), and encodes the response with their results.
+ * Input:
+ *  - rbuffer: received request
+ *  - nread: size of the request
+ *  - sbuffer: buffer for the response, of size TFS_MAX_RESPONSE_SIZE
+ * Returns: size of the response
+ */
+int apply_batch(char * rbuffer, int nread, char * sbuffer){
+    TfsRequest ops[TFS_MAX_BATCH];
+    int results[TFS_MAX_BATCH], num;
+    uint32_t request_id;
+    uint8_t flags;
 
-        case 'd':
-            result = delete(arg1);
-            break;
+    if(tfs_decode_batch(rbuffer, nread, ops, &num, &request_id, &flags) == FAIL){
+        TfsRequestHeader header;
+        memcpy(&header, rbuffer, sizeof(header));
+        memset(&ops[0], 0, sizeof(TfsRequest));
+        ops[0].opcode = TFS_OP_BATCH;
+        ops[0].request_id = header.request_id;
+        return tfs_encode_response(&ops[0], TECNICOFS_ERROR_OTHER, sbuffer);
+    }
 
-        case 'm':
-            sscanf(command, "%c %s %s", &token, arg1, arg2);
-            result = move(arg1, arg2);
-            break;
+    /* the operations are traced with the id of the batch */
+    for(int i = 0; i < num; i++)
+        ops[i].request_id = request_id;
+    apply_batch_requests(ops, num, flags, results);
+    return tfs_encode_batch_response(request_id, results, num, sbuffer);
+}
 
-        case 'p':
-            sscanf(command, "%c %s", &token, arg1);
-            printing = 1;
-            
-            /* wait until all threads complete their operation */
-            while(threads_waiting_client < numberThreads - 1);
+/*
+ * Collects the statistics of the requests and of the queue, and encodes
+ * them as the response to a TFS_OP_STATS request.
+ * Input:
+ *  - request: decoded request
+ *  - sbuffer: buffer for the response, of size TFS_MAX_RESPONSE_SIZE
+ * Returns: size of the response
+ */
+int apply_stats(TfsRequest * request, char * sbuffer){
+    TfsStats stats;
+    int max_depth;
+
+    stats_collect(&stats);
+    if(serverMode != MODE_THREADS){
+        stats.queue_depth = queue_depth(&queue, &max_depth);
+        stats.queue_max_depth = max_depth;
+    }
+    return tfs_encode_stats_response(request, &stats, sbuffer);
+}
 
-            result = print_tecnicofs_tree(arg1);
+/*
+ * Decodes and executes a binary or text request and encodes its response
+ * in the same format.
+ * Input:
+ *  - rbuffer: received request
+ *  - nread: size of the request
+ *  - sbuffer: buffer for the response, of size TFS_MAX_RESPONSE_SIZE
+ * Returns: size of the response
+ */
+int apply_commands(char * rbuffer, int nread, char * sbuffer){
+    TfsRequest request;
+    int result;
 
-            printing = 0;
-            cond_broadcast(&process_commands);
-            break;
+    if(nread > 0 && (unsigned char) rbuffer[0] == TFS_PROTOCOL_MAGIC){
+        if(nread >= sizeof(TfsRequestHeader) && rbuffer[offsetof(TfsRequestHeader, opcode)] == TFS_OP_BATCH)
+            return apply_batch(rbuffer, nread, sbuffer);
+
+        if(tfs_decode_request(rbuffer, nread, &request) == FAIL){
+            memset(&request, 0, sizeof(request));
+            result = TECNICOFS_ERROR_OTHER;
+        }
+        else if(request.opcode == TFS_OP_STATS)
+            return apply_stats(&request, sbuffer);
+        else
+            result = apply_request(&request);
+        return tfs_encode_response(&request, result, sbuffer);
     }
-    return result;
+
+    rbuffer[nread] = '\0';
+    if(verbose)
+        printf("%s\n", rbuffer);
+    if(tfs_decode_text_request(rbuffer, &request) == FAIL)
+        result = TECNICOFS_ERROR_OTHER;
+    else
+        result = apply_request(&request);
+    return sprintf(sbuffer, "%d", result);
 }
 
 /* Command line and argument passing */
 void parse_args(int argc, char* argv[]){
-    if(argc == 3){
+    static struct option long_options[] = {
+        {"lock-coupling", no_argument, NULL, 'c'},
+        {"dcache", required_argument, NULL, 'd'},
+        {"mode", required_argument, NULL, 'm'},
+        {"io-threads", required_argument, NULL, 'i'},
+        {"publish", optional_argument, NULL, 'n'},
+        {"shm", optional_argument, NULL, 's'},
+        {"lock-profile", optional_argument, NULL, 'l'},
+        {"trace", no_argument, NULL, 't'},
+        {"verbose", no_argument, NULL, 'v'},
+        {NULL, 0, NULL, 0}
+    };
+    char * appName = argv[0];
+    int option;
+
+    while((option = getopt_long(argc, argv, "cv", long_options, NULL)) != -1){
+        switch(option){
+            case 'c':
+                set_lock_coupling(true);
+                break;
+            case 'd':
+                if(atoi(optarg) <= 0)
+                    exit_with_error("Error: invalid number of dentry cache entries\n");
+                set_dcache_size(atoi(optarg));
+                break;
+            case 'm':
+                for(serverMode = 0; serverMode < sizeof(mode_names) / sizeof(mode_names[0]); serverMode++)
+                    if(strcmp(optarg, mode_names[serverMode]) == 0)
+                        break;
+                if(serverMode == sizeof(mode_names) / sizeof(mode_names[0]))
+                    display_usage(appName);
+                break;
+            case 'i':
+                if((ioThreads = atoi(optarg)) <= 0)
+                    exit_with_error("Error: invalid number of I/O threads\n");
+                break;
+            case 'n':
+                namespaceSize = optarg ? atoi(optarg) : NSMAP_DEFAULT_SIZE;
+                if(namespaceSize < TFS_NS_STRIPES || (namespaceSize & (namespaceSize - 1)) != 0)
+                    exit_with_error("Error: namespace size must be a power of two, at least 64\n");
+                break;
+            case 's':
+                if((shmSessions = optarg ? atoi(optarg) : SHM_DEFAULT_SESSIONS) <= 0)
+                    exit_with_error("Error: invalid number of shared-memory sessions\n");
+                break;
+            case 'l':
+                if((lockProfileTop = optarg ? atoi(optarg) : LOCK_PROFILE_DEFAULT_TOP) <= 0)
+                    exit_with_error("Error: invalid number of profiled i-nodes\n");
+                break;
+            case 't':
+                traceOnStart = 1;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                display_usage(appName);
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if(argc == 3 || argc == 4){
         numberThreads = atoi(argv[1]);
         socketName = argv[2];
 
         if(numberThreads <= 0)
             exit_with_error("Error: invalid number of threads\n");
 
+        if(argc == 4 && (maxInodes = atoi(argv[3])) <= 0)
+            exit_with_error("Error: invalid maximum number of i-nodes\n");
     }
     else
-        display_usage(argv[0]);
+        display_usage(appName);
 }
 
 /* Set socket address */
@@ -150,64 +362,737 @@ void * create_socket(){
     return NULL;
 }
 
-void * process_client(){
+/* Worker of threads mode: receives, executes and answers one request at a time */
+void * process_client(void * arg){
+    IoStats * stats = (IoStats*) arg;
+
     while(1){
         struct sockaddr_un client_addr;
         socklen_t client_addrlen;
-        char rbuffer[MAX_INPUT_SIZE], sbuffer[sizeof(int) + 1];
+        char rbuffer[TFS_MAX_BATCH_REQUEST_SIZE + 1], sbuffer[TFS_MAX_RESPONSE_SIZE];
 
         client_addrlen = sizeof(struct sockaddr_un);
 
-        /* increments number of threads waiting for client */
-        mutex_lock(&counting_mutex);
-        threads_waiting_client++;
-        mutex_unlock(&counting_mutex);
-
-        int nread = recvfrom(sockfd, rbuffer, MAX_INPUT_SIZE - 1, 0, (struct sockaddr *)&client_addr, &client_addrlen);
+        int nread = recvfrom(sockfd, rbuffer, sizeof(rbuffer) - 1, 0, (struct sockaddr *)&client_addr, &client_addrlen);
+        stats->receive_calls++;
         
         /* if no message was received */
         if(nread <= 0)
             continue;
+        stats->received++;
+        if(tracing())
+            trace_message(TFS_TRACE_RECEIVED, rbuffer, nread);
 
-        rbuffer[nread] = '\0';
+        int nresponse = apply_commands(rbuffer, nread, sbuffer);
 
-        printf("%s\n", rbuffer);
+        int nsent = sendto(sockfd, sbuffer, nresponse, 0, (struct sockaddr *)&client_addr, client_addrlen);
+        stats->send_calls++;
+    
+        if(nsent < 0 && client_gone(errno)){
+            stats->dropped++;
+            continue;
+        }
+        if(nsent < 0)
+            exit_with_error("tecnicofs-server: error sending message to the server\n");
+        stats->sent++;
+        if(tracing())
+            trace_message(TFS_TRACE_SENT, sbuffer, nresponse);
+    }
+    return NULL;
+}
+
+/*
+ * Receives up to IO_BATCH datagrams with one system call, into the free
+ * messages an I/O thread keeps (taken from the queue pool as needed).
+ * Input:
+ *  - messages: free messages of the thread, array of IO_BATCH
+ *  - num: pointer to the number of free messages
+ *  - flags: MSG_WAITFORONE to wait for the first datagram, or MSG_DONTWAIT
+ *  - stats: I/O statistics of the thread
+ * Returns: number of datagrams received, in the first messages
+ */
+int receive_batch(Message ** messages, int * num, int flags, IoStats * stats){
+    struct mmsghdr msgs[IO_BATCH];
+    struct iovec iov[IO_BATCH];
 
-        /* puts thread on wait if another thread is currently printing a tree */
-        mutex_lock(&commands_mutex);
-        while(printing == 1)
-            cond_wait(&process_commands, &commands_mutex);
+    /* wait for free messages only if there are none left */
+    if(*num < IO_BATCH)
+        *num += queue_alloc(&queue, messages + *num, *num == 0 ? 1 : 0, IO_BATCH - *num);
 
-        mutex_unlock(&commands_mutex);
-        
-        /* decrements number of threads waiting for client */
-        mutex_lock(&counting_mutex);
-        threads_waiting_client--;
-        mutex_unlock(&counting_mutex);
+    memset(msgs, 0, sizeof(struct mmsghdr) * *num);
+    for(int i = 0; i < *num; i++){
+        iov[i].iov_base = messages[i]->buffer;
+        iov[i].iov_len = sizeof(messages[i]->buffer) - 1;
+        msgs[i].msg_hdr.msg_name = &messages[i]->addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_un);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
 
-        int result = apply_commands(rbuffer);
-        sprintf(sbuffer, "%d", result);
+    int nread = recvmmsg(sockfd, msgs, *num, flags, NULL);
+    stats->receive_calls++;
+    if(nread <= 0)
+        return 0;
 
-        int nsent = sendto(sockfd, sbuffer, strlen(sbuffer), 0, (struct sockaddr *)&client_addr, client_addrlen);
-    
+    for(int i = 0; i < nread; i++){
+        messages[i]->size = msgs[i].msg_len;
+        messages[i]->addrlen = msgs[i].msg_hdr.msg_namelen;
+        if(tracing())
+            trace_message(TFS_TRACE_RECEIVED, messages[i]->buffer, messages[i]->size);
+    }
+    stats->received += nread;
+    return nread;
+}
+
+/*
+ * I/O thread of queue mode: receives up to IO_BATCH datagrams per system
+ * call and queues them for the workers.
+ */
+void * receive_messages(void * arg){
+    IoStats * stats = (IoStats*) arg;
+    Message * messages[IO_BATCH];
+    int num = 0;
+
+    while(1){
+        /* waits for the first datagram only */
+        int nread = receive_batch(messages, &num, MSG_WAITFORONE, stats);
+        if(nread == 0)
+            continue;
+        queue_push(&queue, messages, nread);
+
+        /* keep the messages not used */
+        num -= nread;
+        memmove(messages, messages + nread, sizeof(Message*) * num);
+    }
+    return NULL;
+}
+
+/*
+ * Sends responses, as many per system call as possible.
+ * Input:
+ *  - msgs: responses, with the address of their clients (reordered)
+ *  - num: number of responses
+ *  - flags: MSG_DONTWAIT to send the responses to clients whose queue is
+ *    full after the others, or 0
+ *  - stats: I/O statistics of the thread
+ */
+void send_responses(struct mmsghdr * msgs, int num, int flags, IoStats * stats){
+    int blocked = 0;
+
+    for(int sent = 0; sent < num; ){
+        int nsent = sendmmsg(sockfd, msgs + sent, num - sent, flags);
+        stats->send_calls++;
+        if(nsent < 0 && (flags & MSG_DONTWAIT) && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            /* move it to the front, to be sent after the others */
+            struct mmsghdr msg = msgs[sent];
+            msgs[sent++] = msgs[blocked];
+            msgs[blocked++] = msg;
+            continue;
+        }
+        if(nsent < 0 && client_gone(errno)){
+            sent++;
+            stats->dropped++;
+            continue;
+        }
         if(nsent < 0)
             exit_with_error("tecnicofs-server: error sending message to the server\n");
+        if(tracing())
+            for(int i = sent; i < sent + nsent; i++)
+                trace_message(TFS_TRACE_SENT, msgs[i].msg_hdr.msg_iov->iov_base, msgs[i].msg_hdr.msg_iov->iov_len);
+        sent += nsent;
+        stats->sent += nsent;
+    }
+    if(blocked > 0)
+        send_responses(msgs, blocked, 0, stats);
+}
+
+/*
+ * Prepares the response to a message, to be sent with send_responses.
+ * Input:
+ *  - msg: header to fill
+ *  - iov: buffer of the response, of size TFS_MAX_RESPONSE_SIZE
+ *  - message: request, executed to get the response
+ */
+void prepare_response(struct mmsghdr * msg, struct iovec * iov, Message * message){
+    iov->iov_len = apply_commands(message->buffer, message->size, iov->iov_base);
+    memset(msg, 0, sizeof(struct mmsghdr));
+    msg->msg_hdr.msg_name = &message->addr;
+    msg->msg_hdr.msg_namelen = message->addrlen;
+    msg->msg_hdr.msg_iov = iov;
+    msg->msg_hdr.msg_iovlen = 1;
+}
+
+/*
+ * Worker of queue and event modes: executes a batch of queued requests and
+ * sends their responses with one system call.
+ */
+void * process_queue(void * arg){
+    IoStats * stats = (IoStats*) arg;
+    Message * messages[WORKER_BATCH];
+    struct mmsghdr msgs[WORKER_BATCH];
+    struct iovec iov[WORKER_BATCH];
+    char (*sbuffers)[TFS_MAX_RESPONSE_SIZE];
+
+    if((sbuffers = malloc(sizeof(*sbuffers) * WORKER_BATCH)) == NULL)
+        exit_with_error("Error alocating memory to responses\n");
+
+    while(1){
+        int num = queue_pop(&queue, messages, WORKER_BATCH);
+
+        for(int i = 0; i < num; i++){
+            iov[i].iov_base = sbuffers[i];
+            prepare_response(&msgs[i], &iov[i], messages[i]);
+        }
+        send_responses(msgs, num, 0, stats);
+        queue_release(&queue, messages, num);
+    }
+    return NULL;
+}
+
+/*
+ * Checks if a request may take long: moves, prints, lock profiles, traces
+ * and batches lock many i-nodes or write files.
+ * Input:
+ *  - buffer: received request
+ *  - size: size of the request
+ */
+int is_long_request(char * buffer, int size){
+    int opcode;
+
+    if(size <= 0)
+        return 0;
+    if((unsigned char) buffer[0] == TFS_PROTOCOL_MAGIC){
+        if(size < sizeof(TfsRequestHeader))
+            return 0;
+        opcode = buffer[offsetof(TfsRequestHeader, opcode)];
+        return opcode == TFS_OP_MOVE || opcode == TFS_OP_PRINT || opcode == TFS_OP_LOCKS ||
+            opcode == TFS_OP_TRACE || opcode == TFS_OP_BATCH;
+    }
+    /* text commands */
+    return buffer[0] == 'm' || buffer[0] == 'p' || buffer[0] == 'k' || buffer[0] == 't';
+}
+
+/*
+ * Event loop of event mode: waits for the socket to be readable, then
+ * drains it without blocking. Short requests are executed and answered by
+ * the loop, and long ones are queued for the workers, so only long
+ * requests wake up another thread. Each loop has its own epoll instance,
+ * and EPOLLEXCLUSIVE wakes up one loop per event instead of every loop.
+ */
+void * event_loop(void * arg){
+    IoStats * stats = (IoStats*) arg;
+    Message * messages[IO_BATCH], * long_messages[IO_BATCH];
+    struct mmsghdr msgs[IO_BATCH];
+    struct iovec iov[IO_BATCH];
+    char (*sbuffers)[TFS_MAX_RESPONSE_SIZE];
+    struct epoll_event event = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.fd = sockfd };
+    int epfd, num = 0, nread;
+
+    if((sbuffers = malloc(sizeof(*sbuffers) * IO_BATCH)) == NULL)
+        exit_with_error("Error alocating memory to responses\n");
+    if((epfd = epoll_create1(0)) < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &event) < 0)
+        exit_with_error("tecnicofs-server: can't create event loop\n");
+
+    while(1){
+        int nevents = epoll_wait(epfd, &event, 1, -1);
+        stats->wait_calls++;
+        if(nevents <= 0)
+            continue;
+
+        do{
+            int nshort = 0, nlong = 0, nkept = 0;
+
+            nread = receive_batch(messages, &num, MSG_DONTWAIT, stats);
+            for(int i = 0; i < nread; i++){
+                if(is_long_request(messages[i]->buffer, messages[i]->size)){
+                    long_messages[nlong++] = messages[i];
+                    continue;
+                }
+                iov[nshort].iov_base = sbuffers[nshort];
+                prepare_response(&msgs[nshort], &iov[nshort], messages[i]);
+                nshort++;
+                /* keep the messages of short requests */
+                messages[nkept++] = messages[i];
+            }
+            send_responses(msgs, nshort, MSG_DONTWAIT, stats);
+
+            /* and the ones not used */
+            memmove(messages + nkept, messages + nread, sizeof(Message*) * (num - nread));
+            num -= nlong;
+            if(nlong > 0)
+                queue_push(&queue, long_messages, nlong);
+        } while(nread > 0);
+    }
+    return NULL;
+}
+
+/* Response being sent by an io_uring loop */
+typedef struct uringSend {
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_un addr;
+    char buffer[TFS_MAX_RESPONSE_SIZE];
+} UringSend;
+
+/*
+ * Creates the ring of an io_uring loop, with its provided buffers.
+ * Returns: SUCCESS or FAIL, with errno set
+ */
+int uring_setup(Uring * ring){
+    if(uring_init(ring, URING_ENTRIES, IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN) == FAIL)
+        return FAIL;
+    if(uring_provide_buffers(ring, URING_BUFFERS, URING_BUFFER_SIZE) == FAIL){
+        int err = errno;
+        uring_destroy(ring);
+        errno = err;
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+/* return a submission queue entry, submitting the prepared ones if it is full */
+struct io_uring_sqe * uring_next_sqe(Uring * ring, IoStats * stats){
+    struct io_uring_sqe * sqe;
+
+    while((sqe = uring_get_sqe(ring)) == NULL){
+        if(uring_submit(ring, 0) == FAIL)
+            exit_with_error("tecnicofs-server: error submitting to io_uring\n");
+        stats->wait_calls++;
+    }
+    return sqe;
+}
+
+/*
+ * Event loop of uring mode: a multishot receive takes datagrams into
+ * buffers provided to the kernel, so there is no receive system call per
+ * datagram, and responses are sent by entries submitted together with the
+ * next wait. Like in event mode, short requests are executed by the loop
+ * and long ones are queued for the workers.
+ */
+void * uring_loop(void * arg){
+    IoStats * stats = (IoStats*) arg;
+    Message * long_messages[IO_BATCH];
+    UringSend * sends;
+    int free_sends[URING_SENDS], num_free = URING_SENDS, nlong = 0, armed = 0;
+    struct msghdr recv_msg;
+    struct io_uring_sqe * sqe;
+    struct io_uring_cqe * cqe;
+    Uring ring;
+
+    if(uring_setup(&ring) == FAIL)
+        exit_with_error("tecnicofs-server: can't create io_uring\n");
+    if((sends = malloc(sizeof(UringSend) * URING_SENDS)) == NULL)
+        exit_with_error("Error alocating memory to responses\n");
+    for(int i = 0; i < URING_SENDS; i++)
+        free_sends[i] = i;
+
+    /* only the sizes of the address and control data are used */
+    memset(&recv_msg, 0, sizeof(recv_msg));
+    recv_msg.msg_namelen = sizeof(struct sockaddr_un);
+
+    while(1){
+        if(!armed){
+            sqe = uring_next_sqe(&ring, stats);
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->fd = sockfd;
+            sqe->addr = (unsigned long) &recv_msg;
+            sqe->len = 1;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = 0;
+            sqe->user_data = URING_RECEIVE;
+            armed = 1;
+        }
+        if(uring_submit(&ring, 1) == FAIL)
+            exit_with_error("tecnicofs-server: error submitting to io_uring\n");
+        stats->wait_calls++;
+
+        while((cqe = uring_peek_cqe(&ring)) != NULL){
+            __u64 data = cqe->user_data;
+            unsigned flags = cqe->flags;
+            int res = cqe->res;
+
+            uring_cqe_seen(&ring);
+            if(data != URING_RECEIVE){
+                free_sends[num_free++] = (int) data;
+                if(res < 0 && client_gone(-res)){
+                    stats->dropped++;
+                    continue;
+                }
+                if(res < 0)
+                    exit_with_error("tecnicofs-server: error sending message to the server\n");
+                stats->sent++;
+                if(tracing())
+                    trace_message(TFS_TRACE_SENT, sends[data].buffer, sends[data].iov.iov_len);
+                continue;
+            }
+
+            /* the receive is rearmed if it stopped (e.g. no buffers left) */
+            if(!(flags & IORING_CQE_F_MORE))
+                armed = 0;
+            if(!(flags & IORING_CQE_F_BUFFER)){
+                if(res < 0 && res != -ENOBUFS)
+                    exit_with_error("tecnicofs-server: error receiving message\n");
+                continue;
+            }
+
+            int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            struct io_uring_recvmsg_out * out = (struct io_uring_recvmsg_out*) uring_buffer(&ring, bid);
+            char * name = (char*) (out + 1);
+            char * payload = name + recv_msg.msg_namelen + recv_msg.msg_controllen;
+            int size = res - (payload - (char*) out);
+            socklen_t addrlen = out->namelen < sizeof(struct sockaddr_un) ? out->namelen : sizeof(struct sockaddr_un);
+
+            /* a larger datagram is truncated, as recvfrom does */
+            if(size > TFS_MAX_BATCH_REQUEST_SIZE)
+                size = TFS_MAX_BATCH_REQUEST_SIZE;
+            stats->received++;
+            if(tracing())
+                trace_message(TFS_TRACE_RECEIVED, payload, size);
+
+            if(is_long_request(payload, size)){
+                Message * message;
+                queue_alloc(&queue, &message, 1, 1);
+                memcpy(message->buffer, payload, size);
+                message->size = size;
+                memcpy(&message->addr, name, addrlen);
+                message->addrlen = addrlen;
+                long_messages[nlong++] = message;
+                if(nlong == IO_BATCH){
+                    queue_push(&queue, long_messages, nlong);
+                    nlong = 0;
+                }
+            }
+            else if(num_free == 0){
+                /* every response slot is being sent: answer directly */
+                char sbuffer[TFS_MAX_RESPONSE_SIZE];
+                int nresponse = apply_commands(payload, size, sbuffer);
+                int nsent = sendto(sockfd, sbuffer, nresponse, 0, (struct sockaddr*) name, addrlen);
+                stats->send_calls++;
+                if(nsent < 0 && client_gone(errno))
+                    stats->dropped++;
+                else if(nsent < 0)
+                    exit_with_error("tecnicofs-server: error sending message to the server\n");
+                else{
+                    stats->sent++;
+                    if(tracing())
+                        trace_message(TFS_TRACE_SENT, sbuffer, nresponse);
+                }
+            }
+            else{
+                int slot = free_sends[--num_free];
+                UringSend * send = &sends[slot];
+
+                send->iov.iov_base = send->buffer;
+                send->iov.iov_len = apply_commands(payload, size, send->buffer);
+                memcpy(&send->addr, name, addrlen);
+                memset(&send->msg, 0, sizeof(struct msghdr));
+                send->msg.msg_name = &send->addr;
+                send->msg.msg_namelen = addrlen;
+                send->msg.msg_iov = &send->iov;
+                send->msg.msg_iovlen = 1;
+
+                sqe = uring_next_sqe(&ring, stats);
+                sqe->opcode = IORING_OP_SENDMSG;
+                sqe->fd = sockfd;
+                sqe->addr = (unsigned long) &send->msg;
+                sqe->len = 1;
+                sqe->user_data = slot;
+            }
+            uring_recycle_buffer(&ring, bid);
+        }
+
+        if(nlong > 0){
+            queue_push(&queue, long_messages, nlong);
+            nlong = 0;
+        }
+    }
+    return NULL;
+}
+
+/* Checks if the client of a shared-memory session closed its connection */
+int shm_client_closed(int connfd){
+    struct pollfd pfd = { .fd = connfd, .events = POLLIN };
+
+    /* the client sends nothing after attaching: any event is a hang-up */
+    return poll(&pfd, 1, 0) != 0;
+}
+
+/*
+ * Serves a shared-memory session: executes the requests of its ring and
+ * writes the responses to the other one, until the client disconnects.
+ */
+void * serve_shm_session(void * arg){
+    ShmClient * client = (ShmClient*) arg;
+    char rbuffer[TFS_MAX_BATCH_REQUEST_SIZE + 1], sbuffer[TFS_MAX_RESPONSE_SIZE];
+
+    while(1){
+        int nread = tfs_shm_read(&client->session->requests, rbuffer, sizeof(rbuffer) - 1, SHM_TIMEOUT);
+        if(nread == FAIL)
+            break;
+        if(nread == 0){
+            if(shm_client_closed(client->connfd))
+                break;
+            continue;
+        }
+        __atomic_add_fetch(&shm_requests, 1, __ATOMIC_RELAXED);
+        if(tracing())
+            trace_message(TFS_TRACE_RECEIVED, rbuffer, nread);
+
+        int nresponse = apply_commands(rbuffer, nread, sbuffer);
+        while(tfs_shm_write(&client->session->responses, sbuffer, nresponse, SHM_TIMEOUT) == FAIL)
+            if(shm_client_closed(client->connfd))
+                goto end;
+        if(tracing())
+            trace_message(TFS_TRACE_SENT, sbuffer, nresponse);
+    }
+
+end:
+    tfs_shm_unmap(client->session);
+    close(client->connfd);
+    free(client);
+    __atomic_sub_fetch(&shm_active, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/*
+ * Receives what a client attaching to the shared-memory socket asks for.
+ * Input:
+ *  - connfd: connection of the client
+ *  - session: pointer to store the mapped session, or NULL if the client
+ *    didn't send one
+ * Returns: TFS_SHM_* flags sent by the client, or FAIL
+ */
+int receive_shm_attach(int connfd, TfsShmSession ** session){
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr * cmsg;
+    unsigned char flags;
+    int fd;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &flags;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    *session = NULL;
+    if(recvmsg(connfd, &msg, MSG_CMSG_CLOEXEC) != 1)
+        return FAIL;
+
+    if((cmsg = CMSG_FIRSTHDR(&msg)) != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        if(flags & TFS_SHM_SESSION)
+            *session = tfs_shm_map(fd);
+        /* the mapping keeps the memory */
+        close(fd);
+    }
+    if((flags & TFS_SHM_SESSION) && *session == NULL)
+        return FAIL;
+    return flags;
+}
+
+/*
+ * Answers a client attaching to the shared-memory socket.
+ * Input:
+ *  - connfd: connection of the client
+ *  - status: SUCCESS or FAIL
+ *  - fd: descriptor to pass to the client, or -1
+ * Returns: SUCCESS or FAIL
+ */
+int send_shm_reply(int connfd, char status, int fd){
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr * cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &status;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if(fd >= 0){
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof(control.buffer);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(connfd, &msg, MSG_NOSIGNAL) == 1 ? SUCCESS : FAIL;
+}
+
+/*
+ * Accepts clients attaching to the shared-memory socket: passes them the
+ * published namespace, and starts a thread to serve each session, up to
+ * shmSessions at once. Sessions refused (or if the server doesn't accept
+ * them) are answered with FAIL, and their clients use the socket.
+ */
+void * accept_shm_clients(void * arg){
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while(1){
+        pthread_t thread;
+        ShmClient * client = NULL;
+        TfsShmSession * session;
+        char status = FAIL;
+        int connfd, flags;
+
+        if((connfd = accept4(shm_sockfd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+            continue;
+        /* a client that doesn't send its attach doesn't stall the others */
+        if(tfs_shm_set_timeout(connfd, TFS_SHM_ATTACH_TIMEOUT) == FAIL){
+            close(connfd);
+            continue;
+        }
+
+        if((flags = receive_shm_attach(connfd, &session)) != FAIL){
+            status = SUCCESS;
+            if(session != NULL){
+                if(__atomic_load_n(&shm_active, __ATOMIC_RELAXED) >= shmSessions){
+                    tfs_shm_unmap(session);
+                    __atomic_add_fetch(&shm_refused, 1, __ATOMIC_RELAXED);
+                    status = FAIL;
+                }
+                else if((client = (ShmClient*) malloc(sizeof(ShmClient))) == NULL){
+                    tfs_shm_unmap(session);
+                    status = FAIL;
+                }
+                else{
+                    client->session = session;
+                    client->connfd = connfd;
+                    /* only this thread adds sessions */
+                    __atomic_add_fetch(&shm_active, 1, __ATOMIC_RELAXED);
+                }
+            }
+        }
+
+        /* the namespace is passed even if the session was refused */
+        if(send_shm_reply(connfd, status, flags != FAIL && (flags & TFS_SHM_NAMESPACE) ? nsmap_fd() : -1) == FAIL ||
+                client == NULL || pthread_create(&thread, &attr, serve_shm_session, client) != 0){
+            if(client != NULL){
+                tfs_shm_unmap(client->session);
+                free(client);
+                __atomic_sub_fetch(&shm_active, 1, __ATOMIC_RELAXED);
+            }
+            close(connfd);
+            continue;
+        }
+        __atomic_add_fetch(&shm_sessions, 1, __ATOMIC_RELAXED);
     }
     return NULL;
 }
 
-/* Runs threads and prints threads execution time */
+/* Create the socket where clients attach shared-memory sessions */
+void create_shm_socket(){
+    struct sockaddr_un addr;
+    socklen_t addrlen;
+
+    if((shm_sockfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+        exit_with_error("tecnicofs-server: can't open shared memory socket\n");
+
+    addrlen = set_socket_address(shm_socket_path, &addr);
+
+    if(bind(shm_sockfd, (struct sockaddr *) &addr, addrlen) < 0 || listen(shm_sockfd, 16) < 0)
+        exit_with_error("tecnicofs-server: shared memory socket bind error\n");
+}
+
+/* Prints the I/O statistics of every thread */
+void print_io_stats(int num_threads, double duration){
+    IoStats total;
+
+    memset(&total, 0, sizeof(total));
+    for(int i = 0; i < num_threads; i++){
+        total.receive_calls += io_stats[i].receive_calls;
+        total.received += io_stats[i].received;
+        total.send_calls += io_stats[i].send_calls;
+        total.sent += io_stats[i].sent;
+        total.dropped += io_stats[i].dropped;
+        total.wait_calls += io_stats[i].wait_calls;
+    }
+
+    fprintf(stdout, "Requests: %lu received in %lu calls, %lu answered in %lu calls\n",
+        total.received, total.receive_calls, total.sent, total.send_calls);
+    if(total.dropped > 0)
+        fprintf(stdout, "Requests: %lu responses dropped, their clients were gone\n", total.dropped);
+    if(serverMode == MODE_EVENT)
+        fprintf(stdout, "Requests: %lu event waits\n", total.wait_calls);
+    else if(serverMode == MODE_URING)
+        fprintf(stdout, "Requests: %lu io_uring_enter calls\n", total.wait_calls);
+    fprintf(stdout, "Requests: %0.1f per second, %0.3f system calls per request\n",
+        duration > 0 ? total.received / duration : 0.0,
+        total.received ? (double) (total.receive_calls + total.send_calls + total.wait_calls) / total.received : 0.0);
+    if(serverMode != MODE_THREADS)
+        fprintf(stdout, "Queue: %lu worker wake-ups (%0.3f per request)\n", queue_wakeups(&queue),
+            total.received ? (double) queue_wakeups(&queue) / total.received : 0.0);
+    if(shmSessions > 0)
+        fprintf(stdout, "Shared memory: %lu sessions (%lu refused), %lu requests\n",
+            __atomic_load_n(&shm_sessions, __ATOMIC_RELAXED), __atomic_load_n(&shm_refused, __ATOMIC_RELAXED),
+            __atomic_load_n(&shm_requests, __ATOMIC_RELAXED));
+}
+
+/* Prints the latencies of the requests of each operation */
+void print_request_stats(){
+    TfsStats stats;
+
+    stats_collect(&stats);
+    for(int opcode = 0; opcode < TFS_OP_MAX; opcode++){
+        TfsOpStats * op = &stats.ops[opcode];
+        if(op->count == 0)
+            continue;
+        fprintf(stdout, "Latency of %s: %lu requests, %lu errors, p50 %0.1f p99 %0.1f p99.9 %0.1f max %0.1f us, "
+            "%0.1f us waiting for locks and %0.1f us working on average\n", tfs_op_name(opcode), op->count, op->errors,
+            op->latency_p50 / 1e3, op->latency_p99 / 1e3, op->latency_p999 / 1e3, op->latency_max / 1e3,
+            op->wait_mean / 1e3, op->work_mean / 1e3);
+    }
+}
+
+/*
+ * Runs threads until the server receives SIGINT or SIGTERM, then prints
+ * the execution time and statistics
+ */
 void run_threads(){
-    pthread_t main_thread, *slave_threads;
+    pthread_t main_thread, shm_thread, *slave_threads;
     struct timeval begin, end;
     double duration;
+    sigset_t signals;
+    int num_threads = numberThreads, signal;
+
+    if(serverMode == MODE_URING){
+        Uring ring;
+        if(uring_setup(&ring) == FAIL){
+            fprintf(stderr, "tecnicofs-server: io_uring not available (%s), using event mode\n", strerror(errno));
+            serverMode = MODE_EVENT;
+        }
+        else
+            uring_destroy(&ring);
+    }
+    if(ioThreads == 0)
+        ioThreads = serverMode == MODE_EVENT || serverMode == MODE_URING ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    if(serverMode != MODE_THREADS)
+        num_threads += ioThreads;
 
     /* start counting time */
     gettimeofday(&begin, 0);
 
     /* allocate memory to slave threads pointer */
-    if((slave_threads = (pthread_t*) malloc(sizeof(pthread_t) * numberThreads)) == NULL)
+    if((slave_threads = (pthread_t*) malloc(sizeof(pthread_t) * num_threads)) == NULL)
         exit_with_error("Error alocating memory to slave threads\n");
+    if((io_stats = (IoStats*) aligned_alloc(sizeof(IoStats), sizeof(IoStats) * num_threads)) == NULL)
+        exit_with_error("Error alocating memory to thread statistics\n");
+    memset(io_stats, 0, sizeof(IoStats) * num_threads);
     
     /* create main thread */
     if(pthread_create(&main_thread, NULL, &create_socket, NULL) != 0)
@@ -217,32 +1102,67 @@ void run_threads(){
     if(pthread_join(main_thread, NULL) != 0)
         exit_with_error("Error joining main thread.\n");
 
-    /* create slave threads */
-    for (int i = 0; i < numberThreads; i++){
-        if(pthread_create(&slave_threads[i], NULL, &process_client, NULL) != 0)
+    /* the signals are only received by this thread */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if(pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0)
+        exit_with_error("Error blocking signals.\n");
+
+    if(serverMode != MODE_THREADS)
+        queue_init(&queue, QUEUE_SIZE + ioThreads * IO_BATCH);
+
+    /* clients attach sessions and get the published namespace there */
+    if(shmSessions > 0 || namespaceSize > 0){
+        create_shm_socket();
+        if(pthread_create(&shm_thread, NULL, accept_shm_clients, NULL) != 0)
             exit_with_error("Error creating thread.\n");
     }
 
-    /* waiting for slave threads to terminate */
-    for(int i = 0; i < numberThreads; i++){
-        if(pthread_join(slave_threads[i], NULL) != 0)
-            exit_with_error("Error joining thread.\n");
-        printf("completed %d\n", i);
+    /* create slave threads */
+    for (int i = 0; i < num_threads; i++){
+        void * (*thread)(void*) = process_client;
+        if(serverMode != MODE_THREADS)
+            thread = i < numberThreads ? process_queue : serverMode == MODE_QUEUE ? receive_messages :
+                serverMode == MODE_EVENT ? event_loop : uring_loop;
+        if(pthread_create(&slave_threads[i], NULL, thread, &io_stats[i]) != 0)
+            exit_with_error("Error creating thread.\n");
     }
 
+    if(sigwait(&signals, &signal) != 0)
+        exit_with_error("Error waiting for signals.\n");
+
     /* stop counting time */
     gettimeofday(&end, 0);
     duration = (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec) * 1e-6;
 
-    free(slave_threads);
-
     /* print threads execution time */
     fprintf(stdout, "TecnicoFS completed in %0.4f seconds.\n", duration);
+
+    print_io_stats(num_threads, duration);
+
+    DcacheStats stats;
+    dcache_get_stats(&stats);
+    fprintf(stdout, "Dentry cache: %lu hits, %lu negative hits, %lu misses, %lu invalidations\n",
+        stats.hits, stats.negative_hits, stats.misses, stats.invalidations);
+
+    unsigned long attempts, successes;
+    get_optimistic_stats(&attempts, &successes);
+    fprintf(stdout, "Optimistic lookups: %lu of %lu succeeded (%0.1f%%)\n",
+        successes, attempts, attempts ? 100.0 * successes / attempts : 0.0);
+    print_request_stats();
+    if(lockProfileTop > 0){
+        fprintf(stdout, "Most contended i-node locks:\n");
+        dump_lock_profile(stdout);
+    }
+    fflush(stdout);
 }
 
 void create_socket_path(){
     strcpy(socket_path, tmp_dir);
     strcat(socket_path, socketName);
+    strcpy(shm_socket_path, socket_path);
+    strcat(shm_socket_path, TFS_SHM_SUFFIX);
 }
 
 int main(int argc, char* argv[]) {
@@ -251,25 +1171,27 @@ int main(int argc, char* argv[]) {
 
     /* just to prevent cases where last application exit with error, without unlinking socket */
     unlink(socket_path);
+    unlink(shm_socket_path);
 
-    /* init all */
-    init_fs();
-    mutex_init(&commands_mutex);
-    mutex_init(&counting_mutex);
-    cond_init(&process_commands);
+    /* init all, publishing the namespace before the root is created */
+    if(namespaceSize > 0 && nsmap_publish(namespaceSize) == FAIL)
+        exit_with_error("tecnicofs-server: can't publish the namespace\n");
+    init_fs(maxInodes);
+    if(lockProfileTop > 0)
+        set_lock_profile(lockProfileTop);
+    stats_init();
+    trace_init();
+    if(traceOnStart)
+        trace_start();
 
     run_threads();
 
-    /* destroy all */
-    destroy_fs();
-    mutex_destroy(&commands_mutex);
-    mutex_destroy(&counting_mutex);
-    cond_destroy(&process_commands);
+    /* the threads are still running: the file system is released on exit */
 
     if(close(sockfd) != 0)
         exit_with_error("tecnicofs-server: error closing socket\n");
 
-    if(unlink(socket_path) != 0)
+    if(unlink(socket_path) != 0 || (shm_sockfd >= 0 && unlink(shm_socket_path) != 0))
         exit_with_error("tecnicofs-client: error unlinking client socket path\n");
 
     exit(EXIT_SUCCESS);
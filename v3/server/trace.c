@@ -0,0 +1,294 @@
+/*
+ * SOURCE FILE OF THE TRACES OF THE REQUESTS
+ *
+ * Every thread records its events in a ring of its own, without locks:
+ * the ring is written by its thread only, and an event is published by
+ * incrementing the head of the ring after it is written. A dump copies
+ * the rings while they are written, and drops the events that may have
+ * been overwritten during the copy. Nothing is recorded until tracing is
+ * started, and then only the events since the last start are dumped. A
+ * thread that exits leaves its ring, and its events, to the next thread
+ * that starts recording.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+#include "locks/mutex.h"
+#include "fs/state.h"
+#include "../tecnicofs-protocol.h"
+
+typedef struct traceRing {
+    TfsTraceEvent events[TRACE_RING_SIZE];
+    uint64_t head; /* events recorded */
+    int in_use; /* by a running thread */
+} TraceRing;
+
+int trace_enabled;
+
+static TraceRing * rings[TRACE_MAX_THREADS];
+static int num_rings;
+static pthread_mutex_t rings_mutex;
+static pthread_key_t rings_key;
+static uint64_t start_time;
+
+/* ring of this thread, NULL until it records an event */
+static __thread TraceRing * local;
+/* set if every ring was taken */
+static __thread int no_ring;
+/* request being executed by this thread, for its lock events */
+static __thread uint32_t current_request;
+static __thread uint8_t current_opcode;
+
+/* return monotonic time in nanoseconds */
+static uint64_t now_ns(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* frees the ring of an exiting thread for another one */
+static void release_ring(void * ring){
+    mutex_lock(&rings_mutex);
+    ((TraceRing*) ring)->in_use = 0;
+    mutex_unlock(&rings_mutex);
+}
+
+/*
+ * Takes a ring for the calling thread: a free one, or a new one.
+ * Returns: ring, or NULL if TRACE_MAX_THREADS threads have one
+ */
+static TraceRing * take_ring(){
+    TraceRing * ring = NULL;
+
+    mutex_lock(&rings_mutex);
+    for(int i = 0; i < num_rings && ring == NULL; i++)
+        if(!rings[i]->in_use)
+            ring = rings[i];
+    if(ring == NULL && num_rings < TRACE_MAX_THREADS &&
+            (ring = (TraceRing*) calloc(1, sizeof(TraceRing))) != NULL)
+        __atomic_store_n(&rings[num_rings++], ring, __ATOMIC_RELEASE);
+    if(ring != NULL){
+        ring->in_use = 1;
+        pthread_setspecific(rings_key, ring);
+    }
+    mutex_unlock(&rings_mutex);
+    return ring;
+}
+
+/*
+ * Records an event in the ring of the calling thread.
+ * Input:
+ *  - type: TFS_TRACE_* type
+ *  - opcode, request_id: request of the event
+ *  - inumber: of lock events (the address of the lock until dumped)
+ *  - mode: of lock events
+ *  - result: of TFS_TRACE_END and TFS_TRACE_SENT
+ */
+static void trace_record(int type, int opcode, uint32_t request_id, int64_t inumber, int mode, int result){
+    TfsTraceEvent * event;
+
+    if(local == NULL && (no_ring || (local = take_ring()) == NULL)){
+        no_ring = 1;
+        return;
+    }
+    event = &local->events[local->head & (TRACE_RING_SIZE - 1)];
+    event->time = now_ns();
+    event->inumber = inumber;
+    event->request_id = request_id;
+    event->result = result;
+    event->type = type;
+    event->opcode = opcode;
+    event->mode = mode;
+    __atomic_store_n(&local->head, local->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Prepares the rings. Must be called before tracing is started.
+ */
+void trace_init(){
+    mutex_init(&rings_mutex);
+    if(pthread_key_create(&rings_key, release_ring) != 0){
+        fprintf(stderr, "Error: couldn't create key of thread traces.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Starts recording events, forgetting the ones recorded before */
+void trace_start(){
+    mutex_lock(&rings_mutex);
+    start_time = now_ns();
+    mutex_unlock(&rings_mutex);
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+}
+
+/* Stops recording events, which are kept until tracing is started again */
+void trace_stop(){
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Records the reception of a request or the sending of a response.
+ * Input:
+ *  - type: TFS_TRACE_RECEIVED or TFS_TRACE_SENT
+ *  - buffer: binary or text request or response
+ *  - size: size of the buffer
+ */
+void trace_message(int type, char * buffer, int size){
+    TfsResponseHeader response;
+    TfsRequestHeader request;
+
+    if(size <= 0 || (unsigned char) buffer[0] != TFS_PROTOCOL_MAGIC)
+        trace_record(type, 0, 0, -1, 0, 0);
+    else if(type == TFS_TRACE_RECEIVED && size >= sizeof(request)){
+        memcpy(&request, buffer, sizeof(request));
+        trace_record(type, request.opcode, request.request_id, -1, 0, 0);
+    }
+    else if(type == TFS_TRACE_SENT && size >= sizeof(response)){
+        memcpy(&response, buffer, sizeof(response));
+        trace_record(type, response.opcode, response.request_id, -1, 0, response.result);
+    }
+}
+
+/*
+ * Records the start of the execution of a request, whose lock events are
+ * recorded with it until trace_end.
+ * Input:
+ *  - opcode: operation (TFS_OP_BATCH for a transaction)
+ *  - request_id: id of the request
+ */
+void trace_begin(int opcode, uint32_t request_id){
+    current_opcode = opcode;
+    current_request = request_id;
+    trace_record(TFS_TRACE_BEGIN, opcode, request_id, -1, 0, 0);
+}
+
+/* Records the end of the request being executed, with its result */
+void trace_end(int result){
+    trace_record(TFS_TRACE_END, current_opcode, current_request, -1, 0, result);
+    current_opcode = 0;
+    current_request = 0;
+}
+
+/*
+ * Records an event of a rwlock.
+ * Input:
+ *  - type: TFS_TRACE_LOCK_REQUEST, TFS_TRACE_LOCK_ACQUIRED or
+ *    TFS_TRACE_LOCK_RELEASED
+ *  - rwlock: lock
+ *  - mode: TFS_TRACE_READ or TFS_TRACE_WRITE (ignored for releases)
+ */
+void trace_lock(int type, pthread_rwlock_t * rwlock, int mode){
+    trace_record(type, current_opcode, current_request, (int64_t) (uintptr_t) rwlock, mode, 0);
+}
+
+/*
+ * Copies the events of a ring recorded since tracing started.
+ * Input:
+ *  - ring: ring, possibly being written
+ *  - events: array of TRACE_RING_SIZE events to store them
+ * Returns: number of events copied
+ */
+static int copy_ring(TraceRing * ring, TfsTraceEvent * events){
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), first, last;
+    int num = 0;
+
+    first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    for(uint64_t i = first; i < head; i++)
+        events[i - first] = ring->events[i & (TRACE_RING_SIZE - 1)];
+
+    /* the event after the new head may be being written over the oldest */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    last = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    for(uint64_t i = first; i < head; i++)
+        if(i + TRACE_RING_SIZE > last && events[i - first].time >= start_time)
+            events[num++] = events[i - first];
+    return num;
+}
+
+/*
+ * Writes the events recorded since tracing started to a file, in the
+ * format of tecnicofs-trace.h, with the locks of the lock events replaced
+ * by their inumbers. Tracing goes on.
+ * Input:
+ *  - filename: name of output file
+ * Returns: SUCCESS or TECNICOFS_ERROR_OTHER
+ */
+int trace_dump(char * filename){
+    TfsTraceHeader header = { TFS_TRACE_MAGIC, TFS_TRACE_VERSION, 0, 0 };
+    TfsTraceEvent * events;
+    FILE * fp;
+
+    if((events = (TfsTraceEvent*) malloc(sizeof(TfsTraceEvent) * TRACE_RING_SIZE)) == NULL)
+        return TECNICOFS_ERROR_OTHER;
+    if((fp = fopen(filename, "w")) == NULL){
+        printf("Error opening output file %s\n", filename);
+        free(events);
+        return TECNICOFS_ERROR_OTHER;
+    }
+
+    mutex_lock(&rings_mutex);
+    header.num_threads = num_rings;
+    mutex_unlock(&rings_mutex);
+    fwrite(&header, sizeof(header), 1, fp);
+
+    for(int i = 0; i < header.num_threads; i++){
+        TfsTraceThread thread = { i, 0 };
+        int64_t address = -1, inumber = -1;
+
+        thread.num_events = copy_ring(__atomic_load_n(&rings[i], __ATOMIC_ACQUIRE), events);
+        for(int j = 0; j < thread.num_events; j++){
+            if(events[j].type < TFS_TRACE_LOCK_REQUEST || events[j].type > TFS_TRACE_LOCK_RELEASED)
+                continue;
+            /* consecutive events are often of the same lock */
+            if(events[j].inumber != address){
+                address = events[j].inumber;
+                inumber = inode_of_lock((pthread_rwlock_t*) (uintptr_t) address);
+            }
+            events[j].inumber = inumber;
+        }
+        fwrite(&thread, sizeof(thread), 1, fp);
+        fwrite(events, sizeof(TfsTraceEvent), thread.num_events, fp);
+    }
+    free(events);
+
+    if(fclose(fp) != 0){
+        printf("Error closing output file %s\n", filename);
+        return TECNICOFS_ERROR_OTHER;
+    }
+    return SUCCESS;
+}
+
+/*
+ * Executes a trace command.
+ * Input:
+ *  - command: "on" to start tracing, "off" to stop it, or the name of the
+ *    file to dump the events to
+ * Returns: SUCCESS or TECNICOFS_ERROR_OTHER
+ */
+int trace_control(char * command){
+    if(strcmp(command, "on") == 0)
+        trace_start();
+    else if(strcmp(command, "off") == 0)
+        trace_stop();
+    else
+        return trace_dump(command);
+    return SUCCESS;
+}
+
+/*
+ * Stops tracing and frees the ring of every thread.
+ */
+void trace_destroy(){
+    trace_stop();
+    for(int i = 0; i < num_rings; i++)
+        free(rings[i]);
+    num_rings = 0;
+    local = NULL;
+    no_ring = 0;
+    pthread_key_delete(rings_key);
+    mutex_destroy(&rings_mutex);
+}
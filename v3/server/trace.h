@@ -0,0 +1,35 @@
+/*
+ * HEADER FILE FOR THE TRACES OF THE REQUESTS
+ */
+
+#ifndef _TRACE_
+#define _TRACE_
+
+#include <stdint.h>
+#include <pthread.h>
+#include "../tecnicofs-trace.h"
+
+/* Events kept by each thread (a power of two), the oldest are overwritten */
+#define TRACE_RING_SIZE (1 << 16)
+/* Threads recording events at once (the events of others are lost) */
+#define TRACE_MAX_THREADS 256
+
+extern int trace_enabled;
+
+/* return if events are being recorded */
+static inline int tracing(){
+    return __atomic_load_n(&trace_enabled, __ATOMIC_RELAXED);
+}
+
+void trace_init();
+void trace_start();
+void trace_stop();
+void trace_message(int, char*, int);
+void trace_begin(int, uint32_t);
+void trace_end(int);
+void trace_lock(int, pthread_rwlock_t*, int);
+int trace_dump(char*);
+int trace_control(char*);
+void trace_destroy();
+
+#endif
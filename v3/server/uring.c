@@ -0,0 +1,211 @@
+/*
+ * SOURCE FILE OF A MINIMAL IO_URING INTERFACE OVER THE RAW SYSTEM CALLS
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+#include "../tecnicofs-api-constants.h"
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params * params){
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags){
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void * arg, unsigned num){
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, num);
+}
+
+/*
+ * Creates an io_uring instance and maps its rings.
+ * Input:
+ *  - ring: ring to initialize
+ *  - entries: number of submission queue entries
+ *  - flags: IORING_SETUP_* flags
+ * Returns: SUCCESS or FAIL, with errno set
+ */
+int uring_init(Uring * ring, unsigned entries, unsigned flags){
+    struct io_uring_params params;
+    int err;
+
+    memset(ring, 0, sizeof(Uring));
+    memset(&params, 0, sizeof(params));
+    params.flags = flags;
+    if((ring->fd = sys_io_uring_setup(entries, &params)) < 0)
+        return FAIL;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = 0;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED)
+        goto fail;
+    if(ring->cq_ring_size == 0)
+        ring->cq_ring = ring->sq_ring;
+    else if((ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+        goto fail;
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+        goto fail;
+
+    ring->sq_head = (unsigned*) ((char*) ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned*) ((char*) ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned*) ((char*) ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*) ((char*) ring->sq_ring + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned*) ((char*) ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned*) ((char*) ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned*) ((char*) ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) ((char*) ring->cq_ring + params.cq_off.cqes);
+    return SUCCESS;
+
+fail:
+    err = errno;
+    uring_destroy(ring);
+    errno = err;
+    return FAIL;
+}
+
+/*
+ * Allocates buffers and registers them as a ring of provided buffers
+ * (group 0), so receives pick a buffer only when a datagram arrives.
+ * Input:
+ *  - ring: ring
+ *  - num: number of buffers, a power of two
+ *  - size: size of each buffer
+ * Returns: SUCCESS or FAIL, with errno set
+ */
+int uring_provide_buffers(Uring * ring, unsigned num, unsigned size){
+    struct io_uring_buf_reg reg;
+    long page = sysconf(_SC_PAGESIZE);
+
+    if(posix_memalign((void**) &ring->buf_ring, page, num * sizeof(struct io_uring_buf)) != 0 ||
+            (ring->buffers = (char*) malloc((size_t) num * size)) == NULL){
+        errno = ENOMEM;
+        return FAIL;
+    }
+    memset(ring->buf_ring, 0, num * sizeof(struct io_uring_buf));
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long) ring->buf_ring;
+    reg.ring_entries = num;
+    reg.bgid = 0;
+    if(sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return FAIL;
+
+    ring->num_buffers = num;
+    ring->buffer_size = size;
+    for(unsigned i = 0; i < num; i++)
+        uring_recycle_buffer(ring, i);
+    return SUCCESS;
+}
+
+/* return provided buffer with the given id */
+char * uring_buffer(Uring * ring, int bid){
+    return ring->buffers + (size_t) bid * ring->buffer_size;
+}
+
+/*
+ * Gives a provided buffer back to the kernel.
+ */
+void uring_recycle_buffer(Uring * ring, int bid){
+    unsigned short tail = ring->buf_ring->tail;
+    struct io_uring_buf * buf = &ring->buf_ring->bufs[tail & (ring->num_buffers - 1)];
+
+    buf->addr = (unsigned long) uring_buffer(ring, bid);
+    buf->len = ring->buffer_size;
+    buf->bid = bid;
+    __atomic_store_n(&ring->buf_ring->tail, (unsigned short) (tail + 1), __ATOMIC_RELEASE);
+}
+
+/*
+ * Takes a cleared submission queue entry.
+ * Returns: the entry, or NULL if the submission queue is full
+ */
+struct io_uring_sqe * uring_get_sqe(Uring * ring){
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe * sqe;
+    unsigned index;
+
+    if(ring->sq_local_tail - head >= ring->sq_entries)
+        return NULL;
+    index = ring->sq_local_tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    ring->to_submit++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/*
+ * Submits the prepared entries and waits for completions, in one system call.
+ * Input:
+ *  - ring: ring
+ *  - wait: minimum number of completions to wait for
+ * Returns: number of entries submitted, or FAIL with errno set
+ */
+int uring_submit(Uring * ring, unsigned wait){
+    unsigned to_submit = ring->to_submit;
+    int ret;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    do
+        ret = sys_io_uring_enter(ring->fd, to_submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+    while(ret < 0 && errno == EINTR);
+    if(ret < 0)
+        return FAIL;
+    ring->to_submit -= ret;
+    return ret;
+}
+
+/* return next completion, or NULL if there is none */
+struct io_uring_cqe * uring_peek_cqe(Uring * ring){
+    unsigned head = *ring->cq_head;
+
+    if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+/*
+ * Marks the completion returned by uring_peek_cqe as consumed.
+ */
+void uring_cqe_seen(Uring * ring){
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Unmaps the rings and closes the io_uring instance.
+ */
+void uring_destroy(Uring * ring){
+    if(ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if(ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if(ring->fd >= 0)
+        close(ring->fd);
+    free(ring->buf_ring);
+    free(ring->buffers);
+    memset(ring, 0, sizeof(Uring));
+    ring->fd = -1;
+}
@@ -0,0 +1,40 @@
+/*
+ * HEADER FILE FOR IO_URING
+ */
+
+#ifndef _URING_
+#define _URING_
+
+#include <linux/io_uring.h>
+
+/*
+ * Submission and completion rings of an io_uring instance, used through
+ * the raw system calls, and a ring of provided buffers (group 0) that
+ * receives pick their buffer from.
+ */
+typedef struct uring {
+    int fd;
+    unsigned * sq_head, * sq_tail, * sq_mask, * sq_array;
+    struct io_uring_sqe * sqes;
+    unsigned sq_entries, sq_local_tail, to_submit;
+    unsigned * cq_head, * cq_tail, * cq_mask;
+    struct io_uring_cqe * cqes;
+    void * sq_ring, * cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    /* provided buffers */
+    struct io_uring_buf_ring * buf_ring;
+    char * buffers;
+    unsigned num_buffers, buffer_size;
+} Uring;
+
+int uring_init(Uring*, unsigned, unsigned);
+int uring_provide_buffers(Uring*, unsigned, unsigned);
+char * uring_buffer(Uring*, int);
+void uring_recycle_buffer(Uring*, int);
+struct io_uring_sqe * uring_get_sqe(Uring*);
+int uring_submit(Uring*, unsigned);
+struct io_uring_cqe * uring_peek_cqe(Uring*);
+void uring_cqe_seen(Uring*);
+void uring_destroy(Uring*);
+
+#endif
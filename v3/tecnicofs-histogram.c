@@ -0,0 +1,97 @@
+/* tecnicofs-histogram.c */
+#include <string.h>
+#include "tecnicofs-histogram.h"
+
+/* return bucket of a value */
+static int bucket_of(uint64_t value) {
+    int high;
+
+    if (value < TFS_HIST_SUB)
+        return (int) value;
+    if (value >> TFS_HIST_MAX_BITS)
+        return TFS_HIST_BUCKETS - 1;
+    high = 63 - __builtin_clzll(value);
+    return ((high - TFS_HIST_SUB_BITS + 1) << TFS_HIST_SUB_BITS) +
+        (int) ((value >> (high - TFS_HIST_SUB_BITS)) - TFS_HIST_SUB);
+}
+
+/* return middle of the values of a bucket */
+static uint64_t value_of(int bucket) {
+    int group = bucket >> TFS_HIST_SUB_BITS;
+    uint64_t mantissa;
+
+    if (group == 0)
+        return bucket;
+    mantissa = TFS_HIST_SUB + (bucket & (TFS_HIST_SUB - 1));
+    return (mantissa << (group - 1)) + ((1ULL << (group - 1)) >> 1);
+}
+
+void tfs_hist_init(TfsHistogram *hist) {
+    memset(hist, 0, sizeof(TfsHistogram));
+}
+
+/*
+ * Counts a value.
+ * Input:
+ *  - hist: histogram
+ *  - value: value (a latency in nanoseconds)
+ */
+void tfs_hist_record(TfsHistogram *hist, uint64_t value) {
+    uint64_t *bucket = &hist->buckets[bucket_of(value)];
+
+    __atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&hist->count, hist->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&hist->sum, hist->sum + value, __ATOMIC_RELAXED);
+    if (value > hist->max)
+        __atomic_store_n(&hist->max, value, __ATOMIC_RELAXED);
+}
+
+/*
+ * Adds the values of a histogram to another.
+ * Input:
+ *  - dest: histogram to add to
+ *  - src: histogram to add
+ */
+void tfs_hist_merge(TfsHistogram *dest, TfsHistogram *src) {
+    uint64_t count = 0, max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+
+    /* the count is summed from the buckets, so it matches them if src is
+     * being written */
+    for (int i = 0; i < TFS_HIST_BUCKETS; i++) {
+        uint64_t num = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+        dest->buckets[i] += num;
+        count += num;
+    }
+    dest->count += count;
+    dest->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    if (max > dest->max)
+        dest->max = max;
+}
+
+/*
+ * Gets a percentile of the values.
+ * Input:
+ *  - hist: histogram
+ *  - percentile: between 0 and 100
+ * Returns: value of the percentile, or 0 if there are no values
+ */
+uint64_t tfs_hist_percentile(TfsHistogram *hist, double percentile) {
+    uint64_t rank, seen = 0;
+
+    if (hist->count == 0)
+        return 0;
+    rank = (uint64_t) (percentile / 100 * hist->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    for (int i = 0; i < TFS_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank)
+            return value_of(i) < hist->max ? value_of(i) : hist->max;
+    }
+    return hist->max;
+}
+
+/* return mean of the values, or 0 if there are none */
+double tfs_hist_mean(TfsHistogram *hist) {
+    return hist->count ? (double) hist->sum / hist->count : 0;
+}
@@ -0,0 +1,35 @@
+/* tecnicofs-histogram.h */
+#ifndef TECNICOFS_HISTOGRAM_H
+#define TECNICOFS_HISTOGRAM_H
+
+#include <stdint.h>
+
+/*
+ * Log-linear histogram of latencies (in nanoseconds): values below
+ * TFS_HIST_SUB are counted exactly, and larger ones in TFS_HIST_SUB
+ * buckets per power of two, so percentiles are within 1/TFS_HIST_SUB of
+ * the value. Values from 2^TFS_HIST_MAX_BITS (about 18 minutes) share the
+ * last bucket. Histograms have a fixed size and are merged by adding them.
+ * A histogram has one writer, but may be merged while it is written: its
+ * counters are updated with single stores.
+ */
+
+#define TFS_HIST_SUB_BITS 6
+#define TFS_HIST_SUB (1 << TFS_HIST_SUB_BITS)
+#define TFS_HIST_MAX_BITS 40
+#define TFS_HIST_BUCKETS ((TFS_HIST_MAX_BITS - TFS_HIST_SUB_BITS + 1) * TFS_HIST_SUB)
+
+typedef struct tfsHistogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[TFS_HIST_BUCKETS];
+} TfsHistogram;
+
+void tfs_hist_init(TfsHistogram*);
+void tfs_hist_record(TfsHistogram*, uint64_t);
+void tfs_hist_merge(TfsHistogram*, TfsHistogram*);
+uint64_t tfs_hist_percentile(TfsHistogram*, double);
+double tfs_hist_mean(TfsHistogram*);
+
+#endif /* TECNICOFS_HISTOGRAM_H */
@@ -0,0 +1,401 @@
+/* tecnicofs-protocol.c */
+#include <stdio.h>
+#include <string.h>
+#include "tecnicofs-protocol.h"
+
+/* Number of arguments of each operation */
+static const int op_num_args[TFS_OP_MAX] = {
+    [TFS_OP_CREATE] = 1,
+    [TFS_OP_DELETE] = 1,
+    [TFS_OP_LOOKUP] = 1,
+    [TFS_OP_MOVE] = 2,
+    [TFS_OP_PRINT] = 1,
+    [TFS_OP_BATCH] = 0,
+    [TFS_OP_STATS] = 0,
+    [TFS_OP_LOCKS] = 1,
+    [TFS_OP_TRACE] = 1,
+};
+
+_Static_assert(sizeof(TfsResponseHeader) + sizeof(TfsStats) <= TFS_MAX_RESPONSE_SIZE,
+    "statistics don't fit in a response");
+
+/* Names of the operations */
+static const char *op_names[TFS_OP_MAX] = {
+    [TFS_OP_CREATE] = "create",
+    [TFS_OP_DELETE] = "delete",
+    [TFS_OP_LOOKUP] = "lookup",
+    [TFS_OP_MOVE] = "move",
+    [TFS_OP_PRINT] = "print",
+    [TFS_OP_BATCH] = "transaction",
+    [TFS_OP_STATS] = "stats",
+    [TFS_OP_LOCKS] = "locks",
+    [TFS_OP_TRACE] = "trace",
+};
+
+/* return name of an operation (a batch is a transaction in statistics) */
+const char *tfs_op_name(int opcode) {
+    if (opcode <= 0 || opcode >= TFS_OP_MAX)
+        return "invalid";
+    return op_names[opcode];
+}
+
+/*
+ * Gets the number of arguments of an operation.
+ * Returns: number of arguments, or FAIL if the opcode is invalid
+ */
+int tfs_num_args(int opcode) {
+    if (opcode <= 0 || opcode >= TFS_OP_MAX)
+        return FAIL;
+    return op_num_args[opcode];
+}
+
+/*
+ * Encodes the arguments of an operation after its header.
+ * Returns: size of the arguments, or FAIL if an argument is too long
+ */
+static int encode_args(TfsRequest *request, uint16_t *arg_len, char *buffer) {
+    int size = 0, num_args = tfs_num_args(request->opcode);
+
+    for (int i = 0; i < num_args; i++) {
+        size_t len = strlen(request->args[i]);
+        if (len >= MAX_FILE_NAME)
+            return FAIL;
+        arg_len[i] = len;
+        memcpy(buffer + size, request->args[i], len);
+        size += len;
+    }
+    return size;
+}
+
+/*
+ * Encodes a request.
+ * Input:
+ *  - request: request to encode
+ *  - buffer: buffer of size TFS_MAX_REQUEST_SIZE
+ * Returns: size of the encoded request, or FAIL if an argument is too long
+ */
+int tfs_encode_request(TfsRequest *request, char *buffer) {
+    TfsRequestHeader header;
+    int args_size;
+
+    if (tfs_num_args(request->opcode) == FAIL || request->opcode == TFS_OP_BATCH)
+        return FAIL;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = TFS_PROTOCOL_MAGIC;
+    header.version = TFS_PROTOCOL_VERSION;
+    header.opcode = request->opcode;
+    header.flags = request->flags;
+    header.request_id = request->request_id;
+
+    if ((args_size = encode_args(request, header.arg_len, buffer + sizeof(header))) == FAIL)
+        return FAIL;
+    memcpy(buffer, &header, sizeof(header));
+    return sizeof(header) + args_size;
+}
+
+/*
+ * Decodes a binary request.
+ * Input:
+ *  - buffer: received datagram
+ *  - size: size of the datagram
+ *  - request: request to fill
+ * Returns: SUCCESS, or FAIL if the request is malformed
+ */
+int tfs_decode_request(char *buffer, int size, TfsRequest *request) {
+    TfsRequestHeader header;
+    int offset = sizeof(TfsRequestHeader), num_args;
+
+    if (size < offset)
+        return FAIL;
+    memcpy(&header, buffer, sizeof(header));
+    if (header.magic != TFS_PROTOCOL_MAGIC || header.version != TFS_PROTOCOL_VERSION ||
+        (num_args = tfs_num_args(header.opcode)) == FAIL || header.opcode == TFS_OP_BATCH)
+        return FAIL;
+
+    request->opcode = header.opcode;
+    request->flags = header.flags;
+    request->request_id = header.request_id;
+
+    for (int i = 0; i < TFS_MAX_ARGS; i++) {
+        int len = header.arg_len[i];
+        if (i >= num_args) {
+            request->args[i][0] = '\0';
+            continue;
+        }
+        if (len == 0 || len >= MAX_FILE_NAME || offset + len > size)
+            return FAIL;
+        memcpy(request->args[i], buffer + offset, len);
+        request->args[i][len] = '\0';
+        offset += len;
+    }
+    return offset == size ? SUCCESS : FAIL;
+}
+
+/*
+ * Decodes a text command ("c /a/b d", "m /a /b", "l /a", ...).
+ * Input:
+ *  - command: received command, terminated
+ *  - request: request to fill (its request_id is 0)
+ * Returns: SUCCESS, or FAIL if the command is invalid
+ */
+int tfs_decode_text_request(char *command, TfsRequest *request) {
+    char token, arg2[MAX_FILE_NAME];
+    int num_tokens;
+
+    memset(request, 0, sizeof(TfsRequest));
+    num_tokens = sscanf(command, "%c %99s %99s", &token, request->args[0], arg2);
+
+    switch (token) {
+        case 'c':
+            if (num_tokens != 3 || (arg2[0] != 'f' && arg2[0] != 'd'))
+                return FAIL;
+            request->opcode = TFS_OP_CREATE;
+            request->flags = arg2[0] == 'd' ? TFS_FLAG_DIRECTORY : 0;
+            return SUCCESS;
+        case 'm':
+            if (num_tokens != 3)
+                return FAIL;
+            request->opcode = TFS_OP_MOVE;
+            strcpy(request->args[1], arg2);
+            return SUCCESS;
+        case 'd':
+            request->opcode = TFS_OP_DELETE;
+            break;
+        case 'l':
+            request->opcode = TFS_OP_LOOKUP;
+            break;
+        case 'p':
+            request->opcode = TFS_OP_PRINT;
+            break;
+        case 'k':
+            request->opcode = TFS_OP_LOCKS;
+            break;
+        case 't':
+            request->opcode = TFS_OP_TRACE;
+            break;
+        default:
+            return FAIL;
+    }
+    return num_tokens >= 2 ? SUCCESS : FAIL;
+}
+
+/*
+ * Encodes the response to a request.
+ * Input:
+ *  - request: answered request
+ *  - result: result of the request
+ *  - buffer: buffer of size sizeof(TfsResponseHeader)
+ * Returns: size of the encoded response
+ */
+int tfs_encode_response(TfsRequest *request, int result, char *buffer) {
+    TfsResponseHeader header;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = TFS_PROTOCOL_MAGIC;
+    header.version = TFS_PROTOCOL_VERSION;
+    header.opcode = request->opcode;
+    header.request_id = request->request_id;
+    header.result = result;
+    memcpy(buffer, &header, sizeof(header));
+    return sizeof(header);
+}
+
+/*
+ * Decodes a response.
+ * Input:
+ *  - buffer: received datagram
+ *  - size: size of the datagram
+ *  - request_id: pointer to store the id of the answered request
+ *  - result: pointer to store the result
+ * Returns: SUCCESS, or FAIL if the response is malformed
+ */
+int tfs_decode_response(char *buffer, int size, uint32_t *request_id, int *result) {
+    TfsResponseHeader header;
+
+    if (size < sizeof(header))
+        return FAIL;
+    memcpy(&header, buffer, sizeof(header));
+    if (header.magic != TFS_PROTOCOL_MAGIC || header.version != TFS_PROTOCOL_VERSION)
+        return FAIL;
+
+    *request_id = header.request_id;
+    *result = header.result;
+    return SUCCESS;
+}
+
+/*
+ * Encodes a batch of operations in one request.
+ * Input:
+ *  - ops: operations (batches can't be nested)
+ *  - num: number of operations, up to TFS_MAX_BATCH
+ *  - request_id: id of the batch
+ *  - flags: flags of the batch (TFS_FLAG_ATOMIC)
+ *  - buffer: buffer of size TFS_MAX_BATCH_REQUEST_SIZE
+ * Returns: size of the encoded request, or FAIL if an operation is invalid
+ */
+int tfs_encode_batch(TfsRequest *ops, int num, uint32_t request_id, uint8_t flags, char *buffer) {
+    TfsRequestHeader header;
+    int size = sizeof(TfsRequestHeader), args_size;
+
+    if (num <= 0 || num > TFS_MAX_BATCH)
+        return FAIL;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = TFS_PROTOCOL_MAGIC;
+    header.version = TFS_PROTOCOL_VERSION;
+    header.opcode = TFS_OP_BATCH;
+    header.flags = flags;
+    header.request_id = request_id;
+    header.arg_len[0] = num;
+    memcpy(buffer, &header, sizeof(header));
+
+    for (int i = 0; i < num; i++) {
+        TfsBatchOpHeader op;
+
+        if (tfs_num_args(ops[i].opcode) == FAIL || ops[i].opcode == TFS_OP_BATCH)
+            return FAIL;
+        memset(&op, 0, sizeof(op));
+        op.opcode = ops[i].opcode;
+        op.flags = ops[i].flags;
+        if ((args_size = encode_args(&ops[i], op.arg_len, buffer + size + sizeof(op))) == FAIL)
+            return FAIL;
+        memcpy(buffer + size, &op, sizeof(op));
+        size += sizeof(op) + args_size;
+    }
+    return size;
+}
+
+/*
+ * Decodes a batch request.
+ * Input:
+ *  - buffer: received datagram
+ *  - size: size of the datagram
+ *  - ops: array of TFS_MAX_BATCH operations to fill
+ *  - num: pointer to store the number of operations
+ *  - request_id: pointer to store the id of the batch
+ *  - flags: pointer to store the flags of the batch
+ * Returns: SUCCESS, or FAIL if the request is malformed
+ */
+int tfs_decode_batch(char *buffer, int size, TfsRequest *ops, int *num, uint32_t *request_id, uint8_t *flags) {
+    TfsRequestHeader header;
+    int offset = sizeof(TfsRequestHeader);
+
+    if (size < offset)
+        return FAIL;
+    memcpy(&header, buffer, sizeof(header));
+    if (header.magic != TFS_PROTOCOL_MAGIC || header.version != TFS_PROTOCOL_VERSION ||
+        header.opcode != TFS_OP_BATCH || header.arg_len[0] == 0 || header.arg_len[0] > TFS_MAX_BATCH)
+        return FAIL;
+
+    *request_id = header.request_id;
+    *flags = header.flags;
+    *num = header.arg_len[0];
+    for (int i = 0; i < *num; i++) {
+        TfsBatchOpHeader op;
+        int num_args;
+
+        if (offset + (int) sizeof(op) > size)
+            return FAIL;
+        memcpy(&op, buffer + offset, sizeof(op));
+        offset += sizeof(op);
+        if ((num_args = tfs_num_args(op.opcode)) == FAIL || op.opcode == TFS_OP_BATCH)
+            return FAIL;
+
+        ops[i].opcode = op.opcode;
+        ops[i].flags = op.flags;
+        ops[i].request_id = header.request_id;
+        for (int j = 0; j < TFS_MAX_ARGS; j++) {
+            int len = op.arg_len[j];
+            if (j >= num_args) {
+                ops[i].args[j][0] = '\0';
+                continue;
+            }
+            if (len == 0 || len >= MAX_FILE_NAME || offset + len > size)
+                return FAIL;
+            memcpy(ops[i].args[j], buffer + offset, len);
+            ops[i].args[j][len] = '\0';
+            offset += len;
+        }
+    }
+    return offset == size ? SUCCESS : FAIL;
+}
+
+/*
+ * Encodes the response to a batch.
+ * Input:
+ *  - request_id: id of the batch
+ *  - results: result of each operation
+ *  - num: number of operations executed
+ *  - buffer: buffer of size TFS_MAX_RESPONSE_SIZE
+ * Returns: size of the encoded response
+ */
+int tfs_encode_batch_response(uint32_t request_id, int *results, int num, char *buffer) {
+    TfsRequest request;
+    int size;
+
+    memset(&request, 0, sizeof(request));
+    request.opcode = TFS_OP_BATCH;
+    request.request_id = request_id;
+    size = tfs_encode_response(&request, num, buffer);
+    for (int i = 0; i < num; i++) {
+        int32_t result = results[i];
+        memcpy(buffer + size, &result, sizeof(result));
+        size += sizeof(result);
+    }
+    return size;
+}
+
+/*
+ * Decodes the results of the operations of a batch response, whose header
+ * was decoded by tfs_decode_response.
+ * Input:
+ *  - buffer: received datagram
+ *  - size: size of the datagram
+ *  - results: array to store the result of each operation
+ *  - num: number of operations executed (result of the response)
+ * Returns: SUCCESS, or FAIL if the response is malformed
+ */
+int tfs_decode_batch_response(char *buffer, int size, int *results, int num) {
+    int offset = sizeof(TfsResponseHeader);
+
+    if (num < 0 || num > TFS_MAX_BATCH || size != offset + num * (int) sizeof(int32_t))
+        return FAIL;
+    for (int i = 0; i < num; i++) {
+        int32_t result;
+        memcpy(&result, buffer + offset, sizeof(result));
+        results[i] = result;
+        offset += sizeof(result);
+    }
+    return SUCCESS;
+}
+
+/*
+ * Encodes the response to a TFS_OP_STATS request.
+ * Input:
+ *  - request: answered request
+ *  - stats: statistics of the server
+ *  - buffer: buffer of size TFS_MAX_RESPONSE_SIZE
+ * Returns: size of the response
+ */
+int tfs_encode_stats_response(TfsRequest *request, TfsStats *stats, char *buffer) {
+    int size = tfs_encode_response(request, SUCCESS, buffer);
+
+    memcpy(buffer + size, stats, sizeof(TfsStats));
+    return size + sizeof(TfsStats);
+}
+
+/*
+ * Decodes the statistics following a response header.
+ * Input:
+ *  - buffer: received datagram
+ *  - size: size of the datagram
+ *  - stats: statistics to fill
+ * Returns: SUCCESS, or FAIL if the response is malformed
+ */
+int tfs_decode_stats_response(char *buffer, int size, TfsStats *stats) {
+    if (size != sizeof(TfsResponseHeader) + sizeof(TfsStats))
+        return FAIL;
+    memcpy(stats, buffer + sizeof(TfsResponseHeader), sizeof(TfsStats));
+    return SUCCESS;
+}
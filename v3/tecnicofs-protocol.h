@@ -0,0 +1,144 @@
+/* tecnicofs-protocol.h */
+#ifndef TECNICOFS_PROTOCOL_H
+#define TECNICOFS_PROTOCOL_H
+
+#include <stdint.h>
+#include "tecnicofs-api-constants.h"
+
+/*
+ * Binary protocol between clients and the server.
+ *
+ * Every request is one datagram: a fixed header followed by its arguments
+ * (paths), each prefixed by its length in the header and not terminated.
+ * Every response is a fixed header with the result of the request: SUCCESS,
+ * the inumber found by a lookup, or a TECNICOFS_ERROR_* code.
+ * Fields are in host byte order (both ends run on the same machine).
+ *
+ * A batch (TFS_OP_BATCH) carries many operations in one request: its header
+ * has the number of operations in arg_len[0], and is followed by each
+ * operation, a TfsBatchOpHeader followed by its arguments. The response
+ * has the number of operations executed as result, and is followed by the
+ * result of each one (int32_t).
+ * A batch with TFS_FLAG_ATOMIC is a transaction: its operations (creates,
+ * deletes, moves and lookups) are applied as a unit, all or none. The
+ * response has the result of every operation, and the transaction was
+ * committed if none of them is an error.
+ *
+ * A TFS_OP_STATS request (without arguments) is answered with SUCCESS
+ * followed by the statistics of the server, a TfsStats.
+ * A TFS_OP_LOCKS request writes the profile of the most contended i-node
+ * locks to a file of the server, like TFS_OP_PRINT writes the tree, and
+ * fails unless the server profiles its locks.
+ * A TFS_OP_TRACE request starts ("on") or stops ("off") the recording of
+ * the trace of the server, or writes it to a file of the server.
+ *
+ * Requests whose first byte isn't TFS_PROTOCOL_MAGIC are text commands
+ * ("c /a/b d"), answered with the result as text.
+ */
+
+#define TFS_PROTOCOL_MAGIC 0xF5
+#define TFS_PROTOCOL_VERSION 1
+
+/* Operation codes */
+#define TFS_OP_CREATE 1
+#define TFS_OP_DELETE 2
+#define TFS_OP_LOOKUP 3
+#define TFS_OP_MOVE 4
+#define TFS_OP_PRINT 5
+#define TFS_OP_BATCH 6
+#define TFS_OP_STATS 7
+#define TFS_OP_LOCKS 8
+#define TFS_OP_TRACE 9
+#define TFS_OP_MAX 10
+
+/* Request flags */
+#define TFS_FLAG_DIRECTORY 0x01 /* create a directory instead of a file */
+#define TFS_FLAG_ATOMIC 0x02 /* apply the operations of a batch as a unit */
+
+/* Arguments of a request */
+#define TFS_MAX_ARGS 2
+
+typedef struct tfsRequestHeader {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t opcode;
+    uint8_t flags;
+    uint32_t request_id;
+    uint16_t arg_len[TFS_MAX_ARGS];
+} TfsRequestHeader;
+
+typedef struct tfsResponseHeader {
+    uint8_t magic;
+    uint8_t version;
+    uint8_t opcode;
+    uint8_t flags;
+    uint32_t request_id;
+    int32_t result;
+} TfsResponseHeader;
+
+typedef struct tfsBatchOpHeader {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t arg_len[TFS_MAX_ARGS];
+} TfsBatchOpHeader;
+
+/* Maximum number of operations in a batch */
+#define TFS_MAX_BATCH 256
+
+/* Maximum size of a request (arguments are shorter than MAX_FILE_NAME) */
+#define TFS_MAX_REQUEST_SIZE (sizeof(TfsRequestHeader) + TFS_MAX_ARGS * (MAX_FILE_NAME - 1))
+#define TFS_MAX_BATCH_REQUEST_SIZE (sizeof(TfsRequestHeader) + \
+    TFS_MAX_BATCH * (sizeof(TfsBatchOpHeader) + TFS_MAX_ARGS * (MAX_FILE_NAME - 1)))
+
+/*
+ * Statistics of the requests of an operation since the server started,
+ * with latencies in nanoseconds. The latency of a request is split in the
+ * time it waited for i-node locks held by other requests and the time it
+ * worked.
+ */
+typedef struct tfsOpStats {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t latency_p50, latency_p99, latency_p999, latency_max;
+    uint64_t wait_mean, wait_p99;
+    uint64_t work_mean, work_p99;
+} TfsOpStats;
+
+/* Statistics of the server, answered to TFS_OP_STATS */
+typedef struct tfsStats {
+    uint64_t uptime; /* nanoseconds */
+    uint64_t queue_depth; /* requests waiting for a worker */
+    uint64_t queue_max_depth;
+    uint64_t threads; /* threads that executed requests */
+    TfsOpStats ops[TFS_OP_MAX]; /* by opcode, TFS_OP_BATCH for transactions */
+} TfsStats;
+
+/* Maximum size of a response (the results of a batch, larger than the
+ * statistics) */
+#define TFS_MAX_RESPONSE_SIZE (sizeof(TfsResponseHeader) + TFS_MAX_BATCH * sizeof(int32_t))
+
+/*
+ * Decoded request, with its arguments terminated.
+ */
+typedef struct tfsRequest {
+    uint8_t opcode;
+    uint8_t flags;
+    uint32_t request_id;
+    char args[TFS_MAX_ARGS][MAX_FILE_NAME];
+} TfsRequest;
+
+int tfs_num_args(int);
+const char *tfs_op_name(int);
+int tfs_encode_request(TfsRequest*, char*);
+int tfs_decode_request(char*, int, TfsRequest*);
+int tfs_decode_text_request(char*, TfsRequest*);
+int tfs_encode_response(TfsRequest*, int, char*);
+int tfs_decode_response(char*, int, uint32_t*, int*);
+int tfs_encode_batch(TfsRequest*, int, uint32_t, uint8_t, char*);
+int tfs_decode_batch(char*, int, TfsRequest*, int*, uint32_t*, uint8_t*);
+int tfs_encode_batch_response(uint32_t, int*, int, char*);
+int tfs_decode_batch_response(char*, int, int*, int);
+int tfs_encode_stats_response(TfsRequest*, TfsStats*, char*);
+int tfs_decode_stats_response(char*, int, TfsStats*);
+
+#endif /* TECNICOFS_PROTOCOL_H */
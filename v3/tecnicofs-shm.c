@@ -0,0 +1,445 @@
+/* tecnicofs-shm.c */
+/* memfd_create */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "tecnicofs-shm.h"
+
+/* Seals a session must have: its size can't change */
+#define SESSION_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+/* Checks of a position before sleeping, when there is another CPU to
+ * change it */
+#define TFS_SHM_SPIN 4096
+
+#define RING_MASK (TFS_SHM_RING_SIZE - 1)
+
+/* size of a frame in the ring */
+static uint32_t frame_size(uint32_t size) {
+    return (sizeof(uint32_t) + size + 7) & ~7u;
+}
+
+/* return number of checks of a position before sleeping */
+static int spin_limit() {
+    static int limit = -1;
+
+    if (limit < 0)
+        limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? TFS_SHM_SPIN : 0;
+    return limit;
+}
+
+static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/*
+ * Waits for a ring position to change from a value: spins, then sleeps on
+ * it with the waiting flag set, so the other end wakes it up.
+ * Input:
+ *  - word: position
+ *  - waiting: flag of the waiting end
+ *  - value: current value
+ *  - timeout: milliseconds to sleep, or -1 to sleep until woken up
+ * Returns: SUCCESS if it changed, FAIL otherwise
+ */
+static int wait_change(uint32_t *word, uint32_t *waiting, uint32_t value, int timeout) {
+    for (int i = 0; i < spin_limit(); i++) {
+        if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != value)
+            return SUCCESS;
+        cpu_relax();
+    }
+
+    /* the other end updates the position and then checks the flag */
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == value) {
+        struct timespec ts = { timeout / 1000, (timeout % 1000) * 1000000L };
+        syscall(SYS_futex, word, FUTEX_WAIT, value, timeout < 0 ? NULL : &ts, NULL, 0);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    return __atomic_load_n(word, __ATOMIC_ACQUIRE) != value ? SUCCESS : FAIL;
+}
+
+/* publishes a ring position and wakes up the other end if it sleeps on it */
+static void publish(uint32_t *word, uint32_t *waiting, uint32_t value) {
+    __atomic_store_n(word, value, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/*
+ * Creates a session in a new memfd.
+ * Input:
+ *  - fd: pointer to store the descriptor of the memfd
+ * Returns: mapped session, or NULL
+ */
+TfsShmSession *tfs_shm_create(int *fd) {
+    TfsShmSession *session;
+
+    if ((*fd = memfd_create("tecnicofs-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+        return NULL;
+    if (ftruncate(*fd, sizeof(TfsShmSession)) < 0 || fcntl(*fd, F_ADD_SEALS, SESSION_SEALS) < 0 ||
+            (session = tfs_shm_map(*fd)) == NULL) {
+        close(*fd);
+        return NULL;
+    }
+    return session;
+}
+
+/*
+ * Maps the session of a memfd.
+ * Returns: mapped session, or NULL if the memfd is too small or its size
+ *  can still change (the other end may be another process: don't trust it)
+ */
+TfsShmSession *tfs_shm_map(int fd) {
+    struct stat st;
+    void *session;
+    int seals;
+
+    if ((seals = fcntl(fd, F_GET_SEALS)) < 0 || (seals & SESSION_SEALS) != SESSION_SEALS ||
+            fstat(fd, &st) < 0 || st.st_size < sizeof(TfsShmSession))
+        return NULL;
+    session = mmap(NULL, sizeof(TfsShmSession), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    return session == MAP_FAILED ? NULL : (TfsShmSession*) session;
+}
+
+void tfs_shm_unmap(TfsShmSession *session) {
+    munmap(session, sizeof(TfsShmSession));
+}
+
+/*
+ * Bounds the time a connection of an attach waits to connect, send and
+ * receive.
+ * Input:
+ *  - fd: socket
+ *  - timeout: milliseconds
+ * Returns: SUCCESS or FAIL
+ */
+int tfs_shm_set_timeout(int fd, int timeout) {
+    struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0)
+        return FAIL;
+    return SUCCESS;
+}
+
+/*
+ * Writes a frame to a ring.
+ * Input:
+ *  - ring: ring, of which the caller is the producer
+ *  - buffer: frame
+ *  - size: size of the frame
+ *  - timeout: milliseconds to wait for room, 0 to not wait, or -1 to wait
+ *    until there is room
+ * Returns: SUCCESS, or FAIL if there was no room
+ */
+int tfs_shm_write(TfsShmRing *ring, char *buffer, int size, int timeout) {
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t needed = frame_size(size), offset = tail & RING_MASK;
+    /* frames don't wrap around the end of the ring */
+    uint32_t skip = TFS_SHM_RING_SIZE - offset < needed ? TFS_SHM_RING_SIZE - offset : 0;
+
+    if (size <= 0 || needed > TFS_SHM_RING_SIZE / 2)
+        return FAIL;
+
+    while (tail + skip + needed - head > TFS_SHM_RING_SIZE) {
+        if (timeout == 0 || (wait_change(&ring->head, &ring->producer_waiting, head, timeout) == FAIL && timeout > 0))
+            return FAIL;
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+
+    if (skip > 0) {
+        uint32_t wrap = TFS_SHM_WRAP;
+        memcpy(ring->data + offset, &wrap, sizeof(wrap));
+        offset = 0;
+    }
+    memcpy(ring->data + offset, &size, sizeof(uint32_t));
+    memcpy(ring->data + offset + sizeof(uint32_t), buffer, size);
+    publish(&ring->tail, &ring->consumer_waiting, tail + skip + needed);
+    return SUCCESS;
+}
+
+/*
+ * Reads a frame from a ring (truncated to the size of the buffer).
+ * Input:
+ *  - ring: ring, of which the caller is the consumer
+ *  - buffer: buffer to store the frame
+ *  - max: size of the buffer
+ *  - timeout: milliseconds to wait for a frame, 0 to not wait, or -1 to
+ *    wait until there is one
+ * Returns: size of the frame, 0 if there was none, or FAIL if the ring is
+ * corrupted
+ */
+int tfs_shm_read(TfsShmRing *ring, char *buffer, int max, int timeout) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t size, offset;
+
+    while (tail == head) {
+        if (timeout == 0 || (wait_change(&ring->tail, &ring->consumer_waiting, head, timeout) == FAIL && timeout > 0))
+            return 0;
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    }
+
+    offset = head & RING_MASK;
+    memcpy(&size, ring->data + offset, sizeof(size));
+    if (size == TFS_SHM_WRAP) {
+        head += TFS_SHM_RING_SIZE - offset;
+        offset = 0;
+        memcpy(&size, ring->data, sizeof(size));
+    }
+    /* the other end may be another process: don't trust the size */
+    if (size == 0 || size > TFS_SHM_RING_SIZE - offset - sizeof(uint32_t) || tail - head < frame_size(size))
+        return FAIL;
+
+    memcpy(buffer, ring->data + offset + sizeof(uint32_t), size < max ? size : max);
+    publish(&ring->head, &ring->producer_waiting, head + frame_size(size));
+    return size < max ? size : max;
+}
+
+/* size of a namespace table */
+static size_t ns_bytes(uint32_t size) {
+    return sizeof(TfsNamespace) + (size_t) size * sizeof(TfsNsEntry);
+}
+
+/*
+ * Creates a namespace table in a new memfd, mapped writable by the caller
+ * only: the memfd is sealed against any other write.
+ * Input:
+ *  - writer: pointer to store the server's side of the table
+ *  - fd: pointer to store the descriptor of the memfd
+ *  - size: number of slots, a power of two, at least TFS_NS_STRIPES
+ * Returns: SUCCESS or FAIL
+ */
+int tfs_ns_create(TfsNsWriter *writer, int *fd, int size) {
+    TfsNamespace *ns;
+
+    if (size < TFS_NS_STRIPES || (size & (size - 1)) != 0)
+        return FAIL;
+    if ((*fd = memfd_create("tecnicofs-namespace", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+        return FAIL;
+    if (ftruncate(*fd, ns_bytes(size)) < 0 ||
+            (ns = mmap(NULL, ns_bytes(size), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0)) == MAP_FAILED) {
+        close(*fd);
+        return FAIL;
+    }
+    ns->size = size;
+    if (fcntl(*fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+        munmap(ns, ns_bytes(size));
+        close(*fd);
+        return FAIL;
+    }
+    memset(writer, 0, sizeof(TfsNsWriter));
+    writer->ns = ns;
+    writer->size = size;
+    return SUCCESS;
+}
+
+/*
+ * Maps a namespace table read-only.
+ * Returns: mapped table, or NULL if the memfd is not a valid table
+ */
+TfsNamespace *tfs_ns_map(int fd) {
+    TfsNamespace header;
+    struct stat st;
+    void *ns;
+
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(TfsNamespace) ||
+            pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.size < TFS_NS_STRIPES ||
+            (header.size & (header.size - 1)) != 0 ||
+            st.st_size < ns_bytes(header.size))
+        return NULL;
+    ns = mmap(NULL, ns_bytes(header.size), PROT_READ, MAP_SHARED, fd, 0);
+    return ns == MAP_FAILED ? NULL : (TfsNamespace*) ns;
+}
+
+void tfs_ns_unmap(TfsNamespace *ns) {
+    munmap(ns, ns_bytes(ns->size));
+}
+
+/* hash of an entry (FNV-1a of the name, mixed with the parent) */
+static uint32_t ns_hash(int parent, char *name, int len) {
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+    return hash ^ ((uint32_t) parent * 2654435761u);
+}
+
+/* stripe of an entry, from the top bits of its hash */
+static uint32_t ns_stripe(uint32_t hash) {
+    return hash >> (32 - TFS_NS_STRIPE_BITS);
+}
+
+/*
+ * Returns the stripe of an entry, whose version the server makes odd
+ * while it changes it.
+ */
+int tfs_ns_stripe(int parent, char *name) {
+    return ns_stripe(ns_hash(parent, name, strlen(name)));
+}
+
+/*
+ * Finds the slot of an entry in its stripe, or the free slot where it
+ * would be.
+ * Returns: slot, or FAIL if every slot of the stripe was probed
+ */
+static int ns_find_slot(TfsNsWriter *writer, int parent, char *name, uint32_t hash) {
+    TfsNamespace *ns = writer->ns;
+    uint32_t stripe_size = writer->size / TFS_NS_STRIPES, mask = stripe_size - 1, base = ns_stripe(hash) * stripe_size;
+
+    for (uint32_t i = 0, slot = hash & mask; i < stripe_size; i++, slot = (slot + 1) & mask) {
+        TfsNsEntry *entry = &ns->entries[base + slot];
+        if (entry->inumber == 0 ||
+                (entry->hash == hash && entry->parent == parent && strcmp(entry->name, name) == 0))
+            return base + slot;
+    }
+    return FAIL;
+}
+
+/*
+ * Adds an entry to a namespace table. The caller makes the version of the
+ * table, or of the stripe of the entry, odd.
+ * Input:
+ *  - writer: server's side of the table
+ *  - parent: i-number of the directory
+ *  - name: name of the entry
+ *  - inumber: i-number of the entry
+ * Returns: SUCCESS, or FAIL if the stripe is full (overflow is set)
+ */
+int tfs_ns_add(TfsNsWriter *writer, int parent, char *name, int inumber) {
+    TfsNamespace *ns = writer->ns;
+    uint32_t hash = ns_hash(parent, name, strlen(name));
+    uint32_t *num = &writer->num[ns_stripe(hash)];
+    int slot;
+
+    /* keep probe sequences short */
+    if (*num >= writer->size / TFS_NS_STRIPES / 4 * 3 || (slot = ns_find_slot(writer, parent, name, hash)) == FAIL) {
+        __atomic_store_n(&ns->overflow, 1, __ATOMIC_RELAXED);
+        return FAIL;
+    }
+    if (ns->entries[slot].inumber == 0)
+        (*num)++;
+    ns->entries[slot].parent = parent;
+    ns->entries[slot].hash = hash;
+    strcpy(ns->entries[slot].name, name);
+    ns->entries[slot].inumber = inumber;
+    return SUCCESS;
+}
+
+/*
+ * Removes an entry from a namespace table, if it is there. The caller
+ * makes the version of the table, or of the stripe of the entry, odd.
+ */
+void tfs_ns_remove(TfsNsWriter *writer, int parent, char *name) {
+    TfsNamespace *ns = writer->ns;
+    uint32_t hash = ns_hash(parent, name, strlen(name));
+    uint32_t stripe_size = writer->size / TFS_NS_STRIPES, mask = stripe_size - 1, base = ns_stripe(hash) * stripe_size;
+    int slot = ns_find_slot(writer, parent, name, hash);
+
+    if (slot == FAIL || ns->entries[slot].inumber == 0)
+        return;
+
+    /* shift back the entries that probed past the removed slot, within the
+     * stripe (slots relative to its first one) */
+    slot -= base;
+    for (uint32_t next = (slot + 1) & mask; ns->entries[base + next].inumber != 0; next = (next + 1) & mask) {
+        uint32_t home = ns->entries[base + next].hash & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            ns->entries[base + slot] = ns->entries[base + next];
+            slot = next;
+        }
+    }
+    ns->entries[base + slot].inumber = 0;
+    writer->num[ns_stripe(hash)]--;
+}
+
+/*
+ * Resolves a path in a namespace table, without locks: a read of the
+ * table is retried if the server changed it meanwhile.
+ * Input:
+ *  - ns: table, mapped read-only
+ *  - path: path to resolve
+ *  - inumber: pointer to store the i-number, or TECNICOFS_ERROR_FILE_NOT_FOUND
+ * Returns: SUCCESS, or FAIL if the server must resolve it
+ */
+int tfs_ns_lookup(TfsNamespace *ns, char *path, int *inumber) {
+    uint32_t size = __atomic_load_n(&ns->size, __ATOMIC_RELAXED);
+    uint32_t stripe_size = size / TFS_NS_STRIPES, mask = stripe_size - 1;
+    /* stripes of the entries read, and their versions, validated at the end */
+    uint32_t stripes[MAX_FILE_NAME / 2 + 1], versions[MAX_FILE_NAME / 2 + 1];
+
+    if (strlen(path) >= MAX_FILE_NAME)
+        return FAIL;
+
+    for (int attempt = 0; attempt < 4; attempt++) {
+        uint32_t version = __atomic_load_n(&ns->version, __ATOMIC_ACQUIRE);
+        int current = TFS_NS_ROOT, num = 0, changed = 0;
+        char *component = path;
+
+        if (version & 1)
+            continue;
+
+        while (current != TECNICOFS_ERROR_FILE_NOT_FOUND) {
+            int len, found = TECNICOFS_ERROR_FILE_NOT_FOUND;
+            uint32_t hash, i, slot, base;
+
+            while (*component == '/')
+                component++;
+            if (*component == '\0')
+                break;
+            for (len = 0; component[len] != '\0' && component[len] != '/'; len++) {}
+
+            hash = ns_hash(current, component, len);
+            stripes[num] = ns_stripe(hash);
+            versions[num] = __atomic_load_n(&ns->stripes[stripes[num]].version, __ATOMIC_ACQUIRE);
+            if (versions[num++] & 1) {
+                changed = 1;
+                break;
+            }
+            base = stripes[num - 1] * stripe_size;
+            /* the table may change under us: every probe ends */
+            for (i = 0, slot = hash & mask; i < stripe_size; i++, slot = (slot + 1) & mask) {
+                TfsNsEntry *entry = &ns->entries[base + slot];
+                int entry_inumber = __atomic_load_n(&entry->inumber, __ATOMIC_RELAXED);
+                if (entry_inumber == 0)
+                    break;
+                if (__atomic_load_n(&entry->hash, __ATOMIC_RELAXED) == hash &&
+                        __atomic_load_n(&entry->parent, __ATOMIC_RELAXED) == current &&
+                        strncmp(entry->name, component, len) == 0 && entry->name[len] == '\0') {
+                    found = entry_inumber;
+                    break;
+                }
+            }
+            current = found;
+            component += len;
+        }
+
+        int overflow = __atomic_load_n(&ns->overflow, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        /* every entry read was still there when the last one was read */
+        for (int j = 0; j < num && !changed; j++)
+            changed = __atomic_load_n(&ns->stripes[stripes[j]].version, __ATOMIC_RELAXED) != versions[j];
+        if (changed || __atomic_load_n(&ns->version, __ATOMIC_RELAXED) != version)
+            continue;
+        if (current == TECNICOFS_ERROR_FILE_NOT_FOUND && overflow)
+            return FAIL;
+        *inumber = current;
+        return SUCCESS;
+    }
+    return FAIL;
+}
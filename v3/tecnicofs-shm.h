@@ -0,0 +1,133 @@
+/* tecnicofs-shm.h */
+#ifndef TECNICOFS_SHM_H
+#define TECNICOFS_SHM_H
+
+#include <stdint.h>
+#include "tecnicofs-protocol.h"
+
+/*
+ * Shared-memory transport between a client and a server on the same host.
+ *
+ * The client creates a session in a memfd and passes it to the server by
+ * connecting to the server socket path with TFS_SHM_SUFFIX (a
+ * SOCK_SEQPACKET socket) and sending the descriptor with SCM_RIGHTS. The
+ * server answers one byte, SUCCESS, and serves the session from its own
+ * thread until the client closes the connection, or FAIL if it doesn't
+ * accept more sessions (the client then uses the socket).
+ *
+ * The first byte the client sends has the TFS_SHM_* flags of what it
+ * wants: TFS_SHM_SESSION, with the memfd of the session attached, and
+ * TFS_SHM_NAMESPACE, to get the memfd of the namespace if the server
+ * publishes it. The server keeps the connection only for a session.
+ *
+ * A session has two single-producer single-consumer rings, requests and
+ * responses, carrying the same frames as the datagrams of the socket
+ * transport. Each frame is its size (uint32_t) followed by its bytes,
+ * aligned to 8 bytes, and never wraps around the end of the ring: a
+ * TFS_SHM_WRAP size skips to the start. Both ends spin for a while before
+ * sleeping on a futex, and only wake up the other end if it is sleeping.
+ *
+ * The memfd of a session is sealed by the client against shrinking and
+ * growing (F_SEAL_SHRINK, F_SEAL_GROW and F_SEAL_SEAL) before it is
+ * passed, and the server refuses sessions that aren't: otherwise the
+ * client could truncate it and make the server fault on the mapping. Both
+ * ends of an attach wait for each other at most TFS_SHM_ATTACH_TIMEOUT,
+ * after which the client uses the socket.
+ */
+
+#define TFS_SHM_SUFFIX ".shm"
+
+/* Flags of the first byte sent by the client */
+#define TFS_SHM_SESSION 0x01
+#define TFS_SHM_NAMESPACE 0x02
+
+/* Bytes of each ring, a power of two larger than any frame */
+#define TFS_SHM_RING_SIZE (1 << 18)
+
+#define TFS_SHM_WRAP 0xFFFFFFFF
+
+/* Milliseconds each end of an attach waits for the other */
+#define TFS_SHM_ATTACH_TIMEOUT 1000
+
+typedef struct tfsShmRing {
+    /* bytes consumed, written by the consumer */
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t producer_waiting; /* the producer sleeps on head */
+    /* bytes produced, written by the producer */
+    uint32_t tail __attribute__((aligned(64)));
+    uint32_t consumer_waiting; /* the consumer sleeps on tail */
+    char data[TFS_SHM_RING_SIZE] __attribute__((aligned(64)));
+} TfsShmRing;
+
+typedef struct tfsShmSession {
+    TfsShmRing requests;
+    TfsShmRing responses;
+} TfsShmSession;
+
+/*
+ * Namespace published by the server, mapped read-only by clients to
+ * resolve lookups without asking the server: an open addressing (linear
+ * probing) hash table from (parent i-number, name) to the i-number of the
+ * entry, split in TFS_NS_STRIPES stripes by the top bits of the hash. Each
+ * stripe is probed apart and has a seqlock of its own, so the server
+ * changes entries of different stripes at once: it makes the version of
+ * the stripe odd while it changes one of its entries, and the version of
+ * the table odd while it changes many entries as a unit (a move or a
+ * transaction). Readers retry (or ask the server) if the version of the
+ * table, or of the stripe of any entry they read, was odd or changed
+ * around their reads. If a stripe fills up, entries are left out and
+ * overflow is set: a name not found must then be confirmed by the server.
+ *
+ * The memfd is sealed against writes (F_SEAL_FUTURE_WRITE) once the server
+ * has mapped it, so clients can only map it read-only, and the server keeps
+ * the number of slots and the number of entries of each stripe in a
+ * TfsNsWriter of its own: it trusts nothing a client could change.
+ */
+/* i-number of the root directory */
+#define TFS_NS_ROOT 0
+
+#define TFS_NS_STRIPE_BITS 6
+#define TFS_NS_STRIPES (1 << TFS_NS_STRIPE_BITS)
+
+typedef struct tfsNsEntry {
+    int32_t parent;
+    int32_t inumber; /* 0 if the slot is free (the root is in no directory) */
+    uint32_t hash;
+    char name[MAX_FILE_NAME];
+} TfsNsEntry;
+
+/* each in a cache line of its own */
+typedef struct tfsNsStripe {
+    uint32_t version;
+} __attribute__((aligned(64))) TfsNsStripe;
+
+typedef struct tfsNamespace {
+    uint32_t version;
+    uint32_t overflow;
+    uint32_t size; /* number of slots, a power of two, at least TFS_NS_STRIPES */
+    TfsNsStripe stripes[TFS_NS_STRIPES];
+    TfsNsEntry entries[];
+} TfsNamespace;
+
+/* the server's side of a table */
+typedef struct tfsNsWriter {
+    TfsNamespace *ns; /* writable mapping */
+    uint32_t size; /* number of slots */
+    uint32_t num[TFS_NS_STRIPES]; /* number of entries of each stripe */
+} TfsNsWriter;
+
+TfsShmSession * tfs_shm_create(int*);
+TfsShmSession * tfs_shm_map(int);
+int tfs_shm_set_timeout(int, int);
+void tfs_shm_unmap(TfsShmSession*);
+int tfs_shm_write(TfsShmRing*, char*, int, int);
+int tfs_shm_read(TfsShmRing*, char*, int, int);
+int tfs_ns_create(TfsNsWriter*, int*, int);
+TfsNamespace * tfs_ns_map(int);
+void tfs_ns_unmap(TfsNamespace*);
+int tfs_ns_stripe(int, char*);
+int tfs_ns_add(TfsNsWriter*, int, char*, int);
+void tfs_ns_remove(TfsNsWriter*, int, char*);
+int tfs_ns_lookup(TfsNamespace*, char*, int*);
+
+#endif /* TECNICOFS_SHM_H */
@@ -0,0 +1,53 @@
+/* tecnicofs-trace.h */
+#ifndef TECNICOFS_TRACE_H
+#define TECNICOFS_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Format of the traces written by the server (see server/trace.c): a
+ * TfsTraceHeader followed, for each thread that recorded events, by a
+ * TfsTraceThread and its events in the order they were recorded. Fields
+ * are in host byte order.
+ */
+
+#define TFS_TRACE_MAGIC 0x54534654 /* "TFST" */
+#define TFS_TRACE_VERSION 1
+
+/* Types of events */
+#define TFS_TRACE_RECEIVED 1 /* request received from a client */
+#define TFS_TRACE_BEGIN 2 /* execution of a request started */
+#define TFS_TRACE_LOCK_REQUEST 3 /* i-node lock requested */
+#define TFS_TRACE_LOCK_ACQUIRED 4 /* i-node lock taken */
+#define TFS_TRACE_LOCK_RELEASED 5 /* i-node lock released */
+#define TFS_TRACE_END 6 /* execution of a request completed */
+#define TFS_TRACE_SENT 7 /* response sent to the client */
+
+/* Modes of lock events */
+#define TFS_TRACE_READ 0
+#define TFS_TRACE_WRITE 1
+
+typedef struct tfsTraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_threads;
+    uint32_t reserved;
+} TfsTraceHeader;
+
+typedef struct tfsTraceThread {
+    uint32_t thread; /* index of the ring of the thread */
+    uint32_t num_events;
+} TfsTraceThread;
+
+typedef struct tfsTraceEvent {
+    uint64_t time; /* nanoseconds, CLOCK_MONOTONIC */
+    int64_t inumber; /* of lock events, -1 if the lock isn't of an i-node */
+    uint32_t request_id; /* request being executed (0 for text commands) */
+    int32_t result; /* of TFS_TRACE_END and TFS_TRACE_SENT */
+    uint8_t type;
+    uint8_t opcode;
+    uint8_t mode; /* of lock events */
+    uint8_t reserved[5];
+} TfsTraceEvent;
+
+#endif /* TECNICOFS_TRACE_H */